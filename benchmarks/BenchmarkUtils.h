@@ -0,0 +1,175 @@
+#ifndef BENCHMARKUTILS_H
+#define BENCHMARKUTILS_H
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../include/MeshConnectivity.h"
+#include "../include/ElasticShell.h"
+#include "../include/MidedgeAngleTanFormulation.h"
+#include "../include/MidedgeAngleSinFormulation.h"
+#include "../include/MidedgeAverageFormulation.h"
+#include "../include/MidedgeAngleThetaFormulation.h"
+#include "../include/StVKMaterial.h"
+#include "../include/BilayerStVKMaterial.h"
+#include "../include/TensionFieldStVKMaterial.h"
+#include "../include/NeoHookeanMaterial.h"
+#include "../include/RestState.h"
+
+/*
+ * Shared setup code for the benchmarks: a randomly perturbed square grid, rest states for all material models, and
+ * helpers to loop over every (material, SFF) pair.
+ */
+namespace BenchmarkUtils {
+
+    const int nummats = 4;
+    const int numsff = 4;
+
+    inline const char* materialName(int matid)
+    {
+        const char* names[] = { "NeoHookean", "StVK", "TensionField", "BilayerStVK" };
+        return names[matid];
+    }
+
+    // dim x dim grid on [-1, 1]^2, triangulated like the test mesh
+    inline void makeSquareMesh(int dim, Eigen::MatrixXd& V, Eigen::MatrixXi& F)
+    {
+        V.resize(dim * dim, 3);
+        F.resize(2 * (dim - 1) * (dim - 1), 3);
+        int frow = 0;
+        for (int i = 0; i < dim; i++)
+        {
+            for (int j = 0; j < dim; j++)
+            {
+                V.row(i * dim + j) << 2.0 * j / double(dim - 1) - 1.0, 1.0 - 2.0 * i / double(dim - 1), 0;
+                if (i != 0 && j != 0)
+                {
+                    F.row(frow++) << (i - 1) * dim + j - 1, (i - 1) * dim + j, i * dim + j;
+                    F.row(frow++) << (i - 1) * dim + j - 1, i * dim + j, i * dim + j - 1;
+                }
+            }
+        }
+    }
+
+    /*
+     * Everything needed to evaluate the shell energy with any material and SFF: a flat rest state and a current
+     * configuration whose vertices are randomly displaced by up to perturbation times the grid spacing.
+     */
+    template <class SFF>
+    struct ShellProblem
+    {
+        ShellProblem(int dim, double perturbation = 0.2, unsigned int seed = 0)
+        {
+            Eigen::MatrixXi F;
+            makeSquareMesh(dim, restPos, F);
+            mesh = LibShell::MeshConnectivity(F);
+
+            // perturbation of a fraction of the grid spacing, so that the surface stays a plausible solver iterate
+            std::default_random_engine rng(seed);
+            double spacing = 2.0 / double(dim - 1);
+            std::uniform_real_distribution<double> noise(-perturbation * spacing, perturbation * spacing);
+            curPos = restPos;
+            for (int i = 0; i < curPos.rows(); i++)
+            {
+                for (int j = 0; j < 3; j++)
+                    curPos(i, j) += noise(rng);
+            }
+            setupRestState();
+        }
+
+        // The same problem on a given mesh and pair of configurations, e.g. a renumbered copy of a grid problem
+        ShellProblem(const Eigen::MatrixXi& F, const Eigen::MatrixXd& restPos, const Eigen::MatrixXd& curPos)
+            : mesh(F), restPos(restPos), curPos(curPos)
+        {
+            setupRestState();
+        }
+
+        void setupRestState()
+        {
+            Eigen::VectorXd restEdgeDOFs;
+            SFF::initializeExtraDOFs(restEdgeDOFs, mesh, restPos);
+            SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+            int nfaces = mesh.nFaces();
+            monolayer.thicknesses.resize(nfaces, 1e-2);
+            monolayer.lameAlpha.resize(nfaces, 1.0);
+            monolayer.lameBeta.resize(nfaces, 1.0);
+            LibShell::ElasticShell<SFF>::firstFundamentalForms(mesh, restPos, monolayer.abars);
+            LibShell::ElasticShell<SFF>::secondFundamentalForms(mesh, restPos, restEdgeDOFs, monolayer.bbars);
+            monolayer.updateCache();
+            bilayer.layers[0] = monolayer;
+            bilayer.layers[1] = monolayer;
+        }
+
+        const LibShell::RestState& restState(int matid) const
+        {
+            if (matid == 3)
+                return bilayer;
+            return monolayer;
+        }
+
+        LibShell::MeshConnectivity mesh;
+        Eigen::MatrixXd restPos;
+        Eigen::MatrixXd curPos;
+        Eigen::VectorXd edgeDOFs;
+        LibShell::MonolayerRestState monolayer;
+        LibShell::BilayerRestState bilayer;
+    };
+
+    template <class SFF>
+    std::unique_ptr<LibShell::MaterialModel<SFF> > makeMaterial(int matid)
+    {
+        switch (matid)
+        {
+        case 0:
+            return std::unique_ptr<LibShell::MaterialModel<SFF> >(new LibShell::NeoHookeanMaterial<SFF>());
+        case 1:
+            return std::unique_ptr<LibShell::MaterialModel<SFF> >(new LibShell::StVKMaterial<SFF>());
+        case 2:
+            return std::unique_ptr<LibShell::MaterialModel<SFF> >(new LibShell::TensionFieldStVKMaterial<SFF>());
+        default:
+            return std::unique_ptr<LibShell::MaterialModel<SFF> >(new LibShell::BilayerStVKMaterial<SFF>());
+        }
+    }
+
+    template <class SFF>
+    struct SFFTag
+    {
+        typedef SFF type;
+    };
+
+    /*
+     * Calls f(SFFTag<SFF>(), name) for each of the second fundamental form discretizations. Use
+     * typename decltype(tag)::type inside a generic lambda to recover the SFF.
+     */
+    template <class Func>
+    void forEachSFF(const Func& f)
+    {
+        f(SFFTag<LibShell::MidedgeAngleTanFormulation>(), "Tan");
+        f(SFFTag<LibShell::MidedgeAngleSinFormulation>(), "Sin");
+        f(SFFTag<LibShell::MidedgeAverageFormulation>(), "Avg");
+        f(SFFTag<LibShell::MidedgeAngleThetaFormulation>(), "Theta");
+    }
+
+    // Best-of-reps wall clock time of f(), in milliseconds
+    template <class Func>
+    double timeMs(int reps, const Func& f)
+    {
+        double best = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < reps; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            f();
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return best;
+    }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "BenchmarkUtils.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+/*
+ * Times the assembly of the energy, gradient, and Hessian triplets of ElasticShell::elasticEnergy for every
+ * (material, SFF) pair, with increasing numbers of threads, and reports the speedup over the serial assembly.
+ *
+ * Usage: assembly_scaling [grid dimension (default 200)] [max threads (default: hardware threads)]
+ */
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+    int maxThreads = argc > 2 ? std::atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    maxThreads = std::max(1, maxThreads);
+    int reps = 3;
+
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, best of " << reps << " runs" << std::endl;
+    std::cout << std::setw(14) << "material" << std::setw(7) << "sff" << std::setw(9) << "threads" << std::setw(12) << "time (ms)" << std::setw(10) << "speedup" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+
+            for (int matid = 0; matid < BenchmarkUtils::nummats; matid++)
+            {
+                auto mat = BenchmarkUtils::makeMaterial<SFF>(matid);
+                Eigen::VectorXd derivative;
+                std::vector<Eigen::Triplet<double> > hessian;
+
+                double serial = 0;
+                for (int nthreads : threadCounts)
+                {
+                    LibShell::ExecutionContext ctx(nthreads);
+                    double ms = BenchmarkUtils::timeMs(reps, [&]()
+                        {
+                            LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, *mat, problem.restState(matid),
+                                &derivative, &hessian, LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kFull, ctx);
+                        });
+                    if (nthreads == 1)
+                        serial = ms;
+                    std::cout << std::setw(14) << BenchmarkUtils::materialName(matid) << std::setw(7) << sffname << std::setw(9) << nthreads
+                        << std::setw(12) << std::fixed << std::setprecision(2) << ms << std::setw(9) << serial / ms << "x" << std::endl;
+                }
+            }
+        });
+}
@@ -0,0 +1,63 @@
+#include "BenchmarkUtils.h"
+#include "../include/HessianAssemblyPlan.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+/*
+ * Compares the two ways of accumulating the derivative and the (plan-based) Hessian from several threads: per-thread
+ * buffers that are summed afterwards, versus a face coloring (MeshConnectivity::bendingStencilColoring) under which
+ * the threads write directly into the outputs, one color at a time.
+ *
+ * Usage: colored_assembly [grid dimension (default 200)] [max threads (default: hardware threads)]
+ */
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+    int maxThreads = argc > 2 ? std::atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    maxThreads = std::max(1, maxThreads);
+    int reps = 3;
+
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, StVK, best of " << reps << " runs" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+            LibShell::StVKMaterial<SFF> mat;
+            LibShell::HessianAssemblyPlan plan(problem.mesh, (int)problem.curPos.rows(), SFF::numExtraDOFs);
+
+            LibShell::FaceColoring coloring;
+            double coloringms = BenchmarkUtils::timeMs(1, [&]()
+                {
+                    problem.mesh.bendingStencilColoring(coloring);
+                });
+            std::cout << sffname << ": " << coloring.nColors() << " colors, built in " << std::fixed << std::setprecision(2) << coloringms << " ms" << std::endl;
+            std::cout << std::setw(9) << "threads" << std::setw(15) << "buffers (ms)" << std::setw(15) << "colored (ms)" << std::setw(10) << "speedup" << std::endl;
+
+            Eigen::VectorXd derivative;
+            Eigen::SparseMatrix<double> H;
+            for (int nthreads : threadCounts)
+            {
+                double bufferms = BenchmarkUtils::timeMs(reps, [&]()
+                    {
+                        LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                            &derivative, plan, &H, LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(nthreads));
+                    });
+                double coloredms = BenchmarkUtils::timeMs(reps, [&]()
+                    {
+                        LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                            &derivative, plan, &H, LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(nthreads, &coloring));
+                    });
+                std::cout << std::setw(9) << nthreads << std::setw(15) << bufferms << std::setw(15) << coloredms
+                    << std::setw(9) << bufferms / coloredms << "x" << std::endl;
+            }
+        });
+}
@@ -0,0 +1,57 @@
+#include "BenchmarkUtils.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+/*
+ * Times energy-only evaluation (as in line searches), single threaded: the per-face kernels called one face at a time
+ * with NULL derivative and Hessian, as the assembly used to do, against ElasticShell::elasticEnergy with NULL outputs,
+ * which goes through the batched energy-only kernels (MaterialModel::stretchingEnergies and bendingEnergies).
+ *
+ * Usage: energy_only [grid dimension (default 250, about 124k faces)]
+ */
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 250;
+    int reps = 5;
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, best of " << reps << " runs" << std::endl;
+    std::cout << std::setw(7) << "sff" << std::setw(14) << "material" << std::setw(16) << "per-face (ms)" << std::setw(15) << "batched (ms)"
+        << std::setw(10) << "speedup" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+            int nfaces = problem.mesh.nFaces();
+
+            for (int matid = 0; matid < BenchmarkUtils::nummats; matid++)
+            {
+                auto mat = BenchmarkUtils::makeMaterial<SFF>(matid);
+                const LibShell::RestState& restState = problem.restState(matid);
+                double result = 0;
+
+                double perfacems = BenchmarkUtils::timeMs(reps, [&]()
+                    {
+                        typename SFF::GeometryCache cache;
+                        SFF::computeGeometryCache(problem.mesh, problem.curPos, false, false, cache);
+                        double energy = 0;
+                        for (int i = 0; i < nfaces; i++)
+                            energy += mat->stretchingEnergy(problem.mesh, problem.curPos, restState, i, NULL, NULL);
+                        for (int i = 0; i < nfaces; i++)
+                            energy += mat->bendingEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, restState, i, NULL, NULL, &cache);
+                        result += energy;
+                    });
+                double batchedms = BenchmarkUtils::timeMs(reps, [&]()
+                    {
+                        result += LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, *mat, restState,
+                            NULL, NULL);
+                    });
+
+                std::cout << std::setw(7) << sffname << std::setw(14) << BenchmarkUtils::materialName(matid) << std::fixed << std::setprecision(2)
+                    << std::setw(16) << perfacems << std::setw(15) << batchedms << std::setw(9) << perfacems / batchedms << "x"
+                    << (result == 0 ? " " : "") << std::endl;
+            }
+        });
+}
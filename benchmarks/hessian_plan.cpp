@@ -0,0 +1,63 @@
+#include "BenchmarkUtils.h"
+#include "../include/HessianAssemblyPlan.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+/*
+ * Compares the two ways of getting a sparse Hessian out of ElasticShell::elasticEnergy: emitting triplets and calling
+ * setFromTriplets, versus filling a matrix in place through a precomputed HessianAssemblyPlan. Both are timed for the
+ * full Hessian and for its lower triangle only.
+ *
+ * Usage: hessian_plan [grid dimension (default 200)] [threads (default 1)]
+ */
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+    int nthreads = argc > 2 ? std::atoi(argv[2]) : 1;
+    int reps = 3;
+    LibShell::ExecutionContext ctx(nthreads);
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, " << nthreads << " threads, best of " << reps << " runs" << std::endl;
+    std::cout << std::setw(7) << "sff" << std::setw(8) << "storage" << std::setw(12) << "triplets" << std::setw(12) << "nonzeros"
+        << std::setw(14) << "plan build" << std::setw(16) << "triplets (ms)" << std::setw(13) << "plan (ms)" << std::setw(10) << "speedup" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+            LibShell::StVKMaterial<SFF> mat;
+
+            LibShell::HessianStorage storages[] = { LibShell::HessianStorage::kFull, LibShell::HessianStorage::kLower };
+            const char* storagenames[] = { "full", "lower" };
+            for (int s = 0; s < 2; s++)
+            {
+                LibShell::HessianAssemblyPlan plan;
+                double buildms = BenchmarkUtils::timeMs(1, [&]()
+                    {
+                        plan = LibShell::HessianAssemblyPlan(problem.mesh, (int)problem.curPos.rows(), SFF::numExtraDOFs, storages[s]);
+                    });
+
+                std::vector<Eigen::Triplet<double> > triplets;
+                Eigen::SparseMatrix<double> H;
+                double tripletms = BenchmarkUtils::timeMs(reps, [&]()
+                    {
+                        LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                            NULL, &triplets, LibShell::HessianProjectType::kNone, storages[s], ctx);
+                        H.resize(plan.nDOFs(), plan.nDOFs());
+                        H.setFromTriplets(triplets.begin(), triplets.end());
+                    });
+
+                double planms = BenchmarkUtils::timeMs(reps, [&]()
+                    {
+                        LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                            NULL, plan, &H, LibShell::HessianProjectType::kNone, ctx);
+                    });
+
+                std::cout << std::setw(7) << sffname << std::setw(8) << storagenames[s] << std::setw(12) << triplets.size() << std::setw(12) << plan.nonZeros()
+                    << std::fixed << std::setprecision(2) << std::setw(14) << buildms << std::setw(16) << tripletms
+                    << std::setw(13) << planms << std::setw(9) << tripletms / planms << "x" << std::endl;
+            }
+        });
+}
@@ -0,0 +1,65 @@
+#include "BenchmarkUtils.h"
+#include "../include/HessianAssemblyPlan.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+/*
+ * Compares the virtual ElasticShell::elasticEnergy, which calls the material through the MaterialModel interface once
+ * per face, against the statically dispatched elasticEnergy<Material>, where the material kernels can be inlined
+ * into the assembly loop. Timed for the energy alone and for the energy, gradient and Hessian (assembled in place
+ * with a HessianAssemblyPlan), for every (material, SFF) pair.
+ *
+ * Usage: material_dispatch [grid dimension (default 200)]
+ */
+
+template <class SFF, class Material>
+static void benchmark(const BenchmarkUtils::ShellProblem<SFF>& problem, const Material& mat, const LibShell::RestState& restState,
+    const char* matname, const char* sffname, int reps)
+{
+    LibShell::HessianAssemblyPlan plan(problem.mesh, (int)problem.curPos.rows(), SFF::numExtraDOFs);
+    Eigen::VectorXd derivative;
+    Eigen::SparseMatrix<double> H;
+
+    double virtualEnergyms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, restState, NULL, NULL);
+        });
+    double staticEnergyms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            LibShell::ElasticShell<SFF>::template elasticEnergy<Material>(problem.mesh, problem.curPos, problem.edgeDOFs, mat, restState, NULL, NULL);
+        });
+    double virtualHessianms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, restState, &derivative, plan, &H);
+        });
+    double staticHessianms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            LibShell::ElasticShell<SFF>::template elasticEnergy<Material>(problem.mesh, problem.curPos, problem.edgeDOFs, mat, restState, &derivative, plan, &H);
+        });
+
+    std::cout << std::setw(14) << matname << std::setw(7) << sffname << std::fixed << std::setprecision(2)
+        << std::setw(14) << virtualEnergyms << std::setw(13) << staticEnergyms << std::setw(9) << virtualEnergyms / staticEnergyms << "x"
+        << std::setw(15) << virtualHessianms << std::setw(14) << staticHessianms << std::setw(9) << virtualHessianms / staticHessianms << "x" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+    int reps = 3;
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, 1 thread, best of " << reps << " runs" << std::endl;
+    std::cout << std::setw(14) << "material" << std::setw(7) << "sff" << std::setw(14) << "E virtual" << std::setw(13) << "E static" << std::setw(10) << "speedup"
+        << std::setw(15) << "E+g+H virtual" << std::setw(14) << "E+g+H static" << std::setw(10) << "speedup" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+            benchmark(problem, LibShell::NeoHookeanMaterial<SFF>(), problem.monolayer, "NeoHookean", sffname, reps);
+            benchmark(problem, LibShell::StVKMaterial<SFF>(), problem.monolayer, "StVK", sffname, reps);
+            benchmark(problem, LibShell::TensionFieldStVKMaterial<SFF>(), problem.monolayer, "TensionField", sffname, reps);
+            benchmark(problem, LibShell::BilayerStVKMaterial<SFF>(), problem.bilayer, "BilayerStVK", sffname, reps);
+        });
+}
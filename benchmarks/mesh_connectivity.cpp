@@ -0,0 +1,116 @@
+#include "BenchmarkUtils.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+
+/*
+ * Times the construction of MeshConnectivity on square grids from 10k to 10M faces, serially and with all hardware
+ * threads, against the std::map based edge construction it replaced (skipped above maxMapFaces faces, where it needs
+ * gigabytes of tree nodes).
+ *
+ * Usage: mesh_connectivity [max faces (default 10M)] [max threads (default: hardware threads)]
+ */
+
+// the previous construction of the edge list and face-edge table, for reference
+static int mapConnectivity(const Eigen::MatrixXi& F, Eigen::MatrixXi& EV, Eigen::MatrixXi& EF, Eigen::MatrixXi& FE)
+{
+    std::map<std::pair<int, int>, Eigen::Vector2i> edgeFaces;
+    int nfaces = (int)F.rows();
+    for (int i = 0; i < nfaces; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            int v0 = F(i, (j + 1) % 3);
+            int v1 = F(i, (j + 2) % 3);
+            int idx = 0;
+            if (v0 > v1)
+            {
+                std::swap(v0, v1);
+                idx = 1;
+            }
+            std::pair<int, int> p(v0, v1);
+            auto it = edgeFaces.find(p);
+            if (it == edgeFaces.end())
+            {
+                edgeFaces[p][idx] = i;
+                edgeFaces[p][1 - idx] = -1;
+            }
+            else
+            {
+                edgeFaces[p][idx] = i;
+            }
+        }
+    }
+
+    int nedges = (int)edgeFaces.size();
+    EV.resize(nedges, 2);
+    EF.resize(nedges, 2);
+    FE.resize(nfaces, 3);
+    std::map<std::pair<int, int>, int> edgeIndices;
+    int idx = 0;
+    for (auto it : edgeFaces)
+    {
+        edgeIndices[it.first] = idx;
+        EV(idx, 0) = it.first.first;
+        EV(idx, 1) = it.first.second;
+        EF(idx, 0) = it.second[0];
+        EF(idx, 1) = it.second[1];
+        idx++;
+    }
+    for (int i = 0; i < nfaces; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            int v0 = F(i, (j + 1) % 3);
+            int v1 = F(i, (j + 2) % 3);
+            if (v0 > v1) std::swap(v0, v1);
+            FE(i, j) = edgeIndices[std::pair<int, int>(v0, v1)];
+        }
+    }
+    return nedges;
+}
+
+int main(int argc, char* argv[])
+{
+    int maxFaces = argc > 1 ? std::atoi(argv[1]) : 10000000;
+    int maxThreads = argc > 2 ? std::atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    maxThreads = std::max(1, maxThreads);
+    const int maxMapFaces = 2000000;
+    int reps = 3;
+
+    std::cout << std::setw(10) << "faces" << std::setw(14) << "std::map (ms)" << std::setw(14) << "1 thread (ms)" << std::setw(10) << "speedup"
+        << std::setw(9) << "threads" << std::setw(11) << "time (ms)" << std::setw(10) << "speedup" << std::endl;
+
+    for (int targetFaces = 10000; targetFaces <= maxFaces; targetFaces *= 10)
+    {
+        // 2 (dim - 1)^2 faces
+        int dim = (int)std::lround(std::sqrt(targetFaces / 2.0)) + 1;
+        Eigen::MatrixXd V;
+        Eigen::MatrixXi F;
+        BenchmarkUtils::makeSquareMesh(dim, V, F);
+        int nfaces = (int)F.rows();
+
+        double mapms = std::numeric_limits<double>::quiet_NaN();
+        if (nfaces <= maxMapFaces)
+        {
+            mapms = BenchmarkUtils::timeMs(reps, [&]()
+                {
+                    Eigen::MatrixXi EV, EF, FE;
+                    mapConnectivity(F, EV, EF, FE);
+                });
+        }
+        double serialms = BenchmarkUtils::timeMs(reps, [&]() { LibShell::MeshConnectivity mesh(F); });
+        double threadedms = BenchmarkUtils::timeMs(reps, [&]() { LibShell::MeshConnectivity mesh(F, LibShell::ExecutionContext(maxThreads)); });
+
+        std::cout << std::setw(10) << nfaces << std::fixed << std::setprecision(2);
+        if (nfaces <= maxMapFaces)
+            std::cout << std::setw(14) << mapms << std::setw(14) << serialms << std::setw(9) << mapms / serialms << "x";
+        else
+            std::cout << std::setw(14) << "-" << std::setw(14) << serialms << std::setw(10) << "-";
+        std::cout << std::setw(9) << maxThreads << std::setw(11) << threadedms << std::setw(9) << serialms / threadedms << "x" << std::endl;
+    }
+}
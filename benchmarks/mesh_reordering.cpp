@@ -0,0 +1,145 @@
+#include "BenchmarkUtils.h"
+#include "../include/HessianAssemblyPlan.h"
+#include "../include/MeshReordering.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+
+/*
+ * Assembly time on a mesh with arbitrary vertex and face order (a square grid with randomly shuffled vertices and
+ * faces, standing in for meshes from files or triangulators), before and after MeshReordering, alongside the grid's
+ * own row-by-row order. Also reports the vertex bandwidth of the bending stencils (max over the faces of the spread of
+ * their vertex indices, which bounds the Hessian bandwidth) and its mean.
+ *
+ * Usage: mesh_reordering [grid dimension (default 200)]
+ */
+
+// max and mean spread of the vertex indices of the bending stencils
+static void stencilSpread(const LibShell::MeshConnectivity& mesh, int& maxSpread, double& meanSpread)
+{
+    maxSpread = 0;
+    meanSpread = 0;
+    for (int i = 0; i < mesh.nFaces(); i++)
+    {
+        const LibShell::FaceStencil& stencil = mesh.faceStencil(i);
+        int lo = stencil.vertices[0];
+        int hi = stencil.vertices[0];
+        for (int j = 0; j < 3; j++)
+        {
+            lo = std::min(lo, stencil.vertices[j]);
+            hi = std::max(hi, stencil.vertices[j]);
+            if (stencil.oppositeVertices[j] != -1)
+            {
+                lo = std::min(lo, stencil.oppositeVertices[j]);
+                hi = std::max(hi, stencil.oppositeVertices[j]);
+            }
+        }
+        maxSpread = std::max(maxSpread, hi - lo);
+        meanSpread += hi - lo;
+    }
+    meanSpread /= std::max(1, mesh.nFaces());
+}
+
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+    int reps = 3;
+
+    Eigen::MatrixXd V;
+    Eigen::MatrixXi F;
+    BenchmarkUtils::makeSquareMesh(dim, V, F);
+    int nverts = (int)V.rows();
+    int nfaces = (int)F.rows();
+
+    // random vertex and face order
+    std::default_random_engine rng(0);
+    std::vector<int> vertexPerm(nverts), faceOrder(nfaces);
+    std::iota(vertexPerm.begin(), vertexPerm.end(), 0);
+    std::iota(faceOrder.begin(), faceOrder.end(), 0);
+    std::shuffle(vertexPerm.begin(), vertexPerm.end(), rng);
+    std::shuffle(faceOrder.begin(), faceOrder.end(), rng);
+    Eigen::MatrixXi shuffledF(nfaces, 3);
+    for (int i = 0; i < nfaces; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            shuffledF(i, j) = vertexPerm[F(faceOrder[i], j)];
+    }
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << nfaces << " faces, StVK, derivative and Hessian, best of " << reps << " runs" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> grid(dim);
+            Eigen::MatrixXd shuffledRest(nverts, 3), shuffledCur(nverts, 3);
+            for (int v = 0; v < nverts; v++)
+            {
+                shuffledRest.row(vertexPerm[v]) = grid.restPos.row(v);
+                shuffledCur.row(vertexPerm[v]) = grid.curPos.row(v);
+            }
+            BenchmarkUtils::ShellProblem<SFF> shuffled(shuffledF, shuffledRest, shuffledCur);
+            LibShell::StVKMaterial<SFF> mat;
+
+            std::cout << sffname << ":" << std::endl;
+            std::cout << std::setw(10) << "order" << std::setw(12) << "bandwidth" << std::setw(12) << "mean" << std::setw(14) << "reorder (ms)"
+                << std::setw(15) << "triplets (ms)" << std::setw(10) << "speedup" << std::setw(11) << "plan (ms)" << std::setw(10) << "speedup" << std::endl;
+
+            double shuffledTriplets = 0, shuffledPlan = 0;
+            auto run = [&](const std::string& name, const BenchmarkUtils::ShellProblem<SFF>& problem, double reorderms)
+                {
+                    int maxSpread;
+                    double meanSpread;
+                    stencilSpread(problem.mesh, maxSpread, meanSpread);
+
+                    Eigen::VectorXd derivative;
+                    std::vector<Eigen::Triplet<double> > hessian;
+                    double tripletms = BenchmarkUtils::timeMs(reps, [&]()
+                        {
+                            LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                                LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING | LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING,
+                                &derivative, &hessian);
+                        });
+                    LibShell::HessianAssemblyPlan plan(problem.mesh, nverts, SFF::numExtraDOFs);
+                    Eigen::SparseMatrix<double> H;
+                    double planms = BenchmarkUtils::timeMs(reps, [&]()
+                        {
+                            LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                                &derivative, plan, &H);
+                        });
+                    if (name == "shuffled")
+                    {
+                        shuffledTriplets = tripletms;
+                        shuffledPlan = planms;
+                    }
+
+                    std::cout << std::setw(10) << name << std::setw(12) << maxSpread << std::fixed << std::setprecision(1) << std::setw(12) << meanSpread
+                        << std::setprecision(2);
+                    if (reorderms > 0)
+                        std::cout << std::setw(14) << reorderms;
+                    else
+                        std::cout << std::setw(14) << "-";
+                    std::cout << std::setw(15) << tripletms << std::setw(9) << shuffledTriplets / tripletms << "x"
+                        << std::setw(11) << planms << std::setw(9) << shuffledPlan / planms << "x" << std::endl;
+                };
+
+            run("shuffled", shuffled, 0);
+            run("grid", grid, 0);
+
+            for (LibShell::ReorderingMethod method : { LibShell::ReorderingMethod::kReverseCuthillMcKee, LibShell::ReorderingMethod::kMorton })
+            {
+                LibShell::MeshReordering reordering;
+                double reorderms = BenchmarkUtils::timeMs(1, [&]()
+                    {
+                        reordering = LibShell::MeshReordering(shuffled.mesh, shuffled.restPos, method);
+                    });
+                Eigen::MatrixXd restPos, curPos;
+                reordering.reorderVertices(shuffled.restPos, restPos);
+                reordering.reorderVertices(shuffled.curPos, curPos);
+                BenchmarkUtils::ShellProblem<SFF> reordered(reordering.reorderedMesh().faces(), restPos, curPos);
+                run(method == LibShell::ReorderingMethod::kMorton ? "Morton" : "RCM", reordered, reorderms);
+            }
+        });
+}
@@ -0,0 +1,117 @@
+#include "BenchmarkUtils.h"
+
+#include <Eigen/Dense>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+/*
+ * Times the PSD projection of element Hessians at the three instantiated sizes: 9 x 9 stretching Hessians, and
+ * 18 x 18 (MidedgeAverage) / 21 x 21 (MidedgeAngleTan) bending Hessians, collected from a perturbed grid. Compares
+ * the plain eigendecomposition and V D V^T reconstruction of every matrix against projSymMatrix, which skips the
+ * matrices passing its LDL^T definiteness test and only corrects the negative eigenpairs of the others.
+ * Also times evaluating and projecting the stretching Hessians with projSymMatrix against having the material build
+ * them positive semidefinite in strain space (HessianProjectType::kStrainSpace).
+ *
+ * Usage: projection_benchmark [grid dimension (default 100)] [vertex perturbation, in grid spacings (default 0.2)]
+ */
+
+template <int N>
+static void eigenProjection(Eigen::Matrix<double, N, N>& A)
+{
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, N, N> > eigenSolver(A);
+    if (eigenSolver.eigenvalues()[0] >= 0)
+        return;
+    Eigen::Matrix<double, N, 1> D = eigenSolver.eigenvalues();
+    for (int i = 0; i < N && D[i] < 0; i++)
+        D[i] = 0;
+    A = eigenSolver.eigenvectors() * D.asDiagonal() * eigenSolver.eigenvectors().transpose();
+}
+
+template <int N>
+static void benchmark(const char* name, const std::vector<Eigen::Matrix<double, N, N> >& hessians, int reps)
+{
+    // matrices left untouched by projSymMatrix
+    int nskipped = 0;
+    for (auto& H : hessians)
+    {
+        Eigen::Matrix<double, N, N> P = H;
+        LibShell::projSymMatrix(P, LibShell::HessianProjectType::kMaxZero);
+        if (P == H)
+            nskipped++;
+    }
+
+    std::vector<Eigen::Matrix<double, N, N> > work;
+    double eigenms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            work = hessians;
+            for (auto& H : work)
+                eigenProjection<N>(H);
+        });
+    std::vector<Eigen::Matrix<double, N, N> > reference = work;
+
+    double projms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            work = hessians;
+            for (auto& H : work)
+                LibShell::projSymMatrix(H, LibShell::HessianProjectType::kMaxZero);
+        });
+
+    double err = 0;
+    for (size_t i = 0; i < work.size(); i++)
+        err = std::max(err, (work[i] - reference[i]).norm() / std::max(1e-300, reference[i].norm()));
+
+    std::cout << std::setw(22) << name << std::setw(9) << hessians.size() << std::setw(9) << std::fixed << std::setprecision(1) << 100.0 * nskipped / hessians.size() << "%"
+        << std::setprecision(2) << std::setw(12) << eigenms << std::setw(17) << projms << std::setw(9) << eigenms / projms << "x"
+        << std::scientific << std::setprecision(1) << std::setw(10) << err << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 100;
+    double perturbation = argc > 2 ? std::atof(argv[2]) : 0.2;
+    int reps = 3;
+
+    typedef LibShell::MidedgeAngleTanFormulation TanSFF;
+    typedef LibShell::MidedgeAverageFormulation AvgSFF;
+    BenchmarkUtils::ShellProblem<TanSFF> tanProblem(dim, perturbation);
+    BenchmarkUtils::ShellProblem<AvgSFF> avgProblem(dim, perturbation);
+    LibShell::NeoHookeanMaterial<TanSFF> tanMat;
+    LibShell::NeoHookeanMaterial<AvgSFF> avgMat;
+
+    int nfaces = tanProblem.mesh.nFaces();
+    std::vector<Eigen::Matrix<double, 9, 9> > stretching(nfaces);
+    std::vector<Eigen::Matrix<double, 18, 18> > avgBending(nfaces);
+    std::vector<Eigen::Matrix<double, 21, 21> > tanBending(nfaces);
+    for (int i = 0; i < nfaces; i++)
+    {
+        tanMat.stretchingEnergy(tanProblem.mesh, tanProblem.curPos, tanProblem.monolayer, i, NULL, &stretching[i]);
+        avgMat.bendingEnergy(avgProblem.mesh, avgProblem.curPos, avgProblem.edgeDOFs, avgProblem.monolayer, i, NULL, &avgBending[i]);
+        tanMat.bendingEnergy(tanProblem.mesh, tanProblem.curPos, tanProblem.edgeDOFs, tanProblem.monolayer, i, NULL, &tanBending[i]);
+    }
+
+    std::cout << "Grid " << dim << " x " << dim << ", perturbation " << perturbation << ", NeoHookean element Hessians, max zero projection, best of " << reps << " runs" << std::endl;
+    std::cout << std::setw(22) << "hessians" << std::setw(9) << "count" << std::setw(10) << "skipped" << std::setw(12) << "eigen (ms)"
+        << std::setw(17) << "projSym (ms)" << std::setw(10) << "speedup" << std::setw(10) << "max err" << std::endl;
+    benchmark<9>("stretching 9x9", stretching, reps);
+    benchmark<18>("Avg bending 18x18", avgBending, reps);
+    benchmark<21>("Tan bending 21x21", tanBending, reps);
+
+    Eigen::Matrix<double, 9, 9> H;
+    double projms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            for (int i = 0; i < nfaces; i++)
+            {
+                tanMat.stretchingEnergy(tanProblem.mesh, tanProblem.curPos, tanProblem.monolayer, i, NULL, &H);
+                LibShell::projSymMatrix(H, LibShell::HessianProjectType::kMaxZero);
+            }
+        });
+    double strainms = BenchmarkUtils::timeMs(reps, [&]()
+        {
+            for (int i = 0; i < nfaces; i++)
+                tanMat.stretchingEnergy(tanProblem.mesh, tanProblem.curPos, tanProblem.monolayer, i, NULL, &H, LibShell::HessianProjectType::kStrainSpace);
+        });
+    std::cout << "Stretching Hessians, evaluated and projected: " << std::fixed << std::setprecision(2) << projms << " ms (projSymMatrix), "
+        << strainms << " ms (strain space), " << projms / strainms << "x" << std::endl;
+}
@@ -0,0 +1,89 @@
+#include "BenchmarkUtils.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+/*
+ * Reports the peak heap usage of the triplet-based Hessian assembly, which reserves the exact number of triplets
+ * (ElasticShell::numHessianTriplets) up front, against growing the same triplet vector by push_back alone, as the
+ * assembly used to do: every regrowth briefly holds both the old and the new buffer.
+ *
+ * Usage: triplet_memory [grid dimension (default 200)]
+ */
+
+// heap usage tracking, through a size header in front of every allocation
+static size_t currentBytes = 0;
+static size_t peakBytes = 0;
+
+void* operator new(size_t size)
+{
+    void* p = std::malloc(size + 16);
+    if (!p)
+        throw std::bad_alloc();
+    *(size_t*)p = size;
+    currentBytes += size;
+    peakBytes = std::max(peakBytes, currentBytes);
+    return (char*)p + 16;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (!p)
+        return;
+    void* base = (char*)p - 16;
+    currentBytes -= *(size_t*)base;
+    std::free(base);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+// peak heap usage of f() above the usage before the call, in MB
+template <class Func>
+static double peakMB(const Func& f)
+{
+    peakBytes = currentBytes;
+    size_t start = currentBytes;
+    f();
+    return (peakBytes - start) / (1024.0 * 1024.0);
+}
+
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, StVK, full Hessian, 1 thread" << std::endl;
+    std::cout << std::setw(7) << "sff" << std::setw(12) << "triplets" << std::setw(14) << "exact (MB)" << std::setw(17) << "assembly (MB)"
+        << std::setw(18) << "push_back (MB)" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+            LibShell::StVKMaterial<SFF> mat;
+
+            size_t ntriplets = LibShell::ElasticShell<SFF>::numHessianTriplets(problem.mesh);
+            double exactmb = ntriplets * sizeof(Eigen::Triplet<double>) / (1024.0 * 1024.0);
+
+            double assemblymb = peakMB([&]()
+                {
+                    std::vector<Eigen::Triplet<double> > hessian;
+                    LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                        NULL, &hessian, LibShell::HessianProjectType::kNone);
+                });
+
+            double growthmb = peakMB([&]()
+                {
+                    std::vector<Eigen::Triplet<double> > hessian;
+                    for (size_t i = 0; i < ntriplets; i++)
+                        hessian.push_back(Eigen::Triplet<double>(0, 0, 0.0));
+                });
+
+            std::cout << std::setw(7) << sffname << std::setw(12) << ntriplets << std::fixed << std::setprecision(1)
+                << std::setw(14) << exactmb << std::setw(17) << assemblymb << std::setw(18) << growthmb << std::endl;
+        });
+}
@@ -0,0 +1,52 @@
+#include "BenchmarkUtils.h"
+#include "../include/AssemblyWorkspace.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+/*
+ * Times repeated derivative and (triplet) Hessian assembly, as in a solver loop, with fresh output and scratch buffers
+ * on every call against an AssemblyWorkspace kept alive across the calls.
+ *
+ * Usage: workspace_reuse [grid dimension (default 200)] [threads (default: hardware threads)]
+ */
+int main(int argc, char* argv[])
+{
+    int dim = argc > 1 ? std::atoi(argv[1]) : 200;
+    int nthreads = argc > 2 ? std::atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    nthreads = std::max(1, nthreads);
+    int reps = 5;
+
+    std::cout << "Grid " << dim << " x " << dim << ", " << 2 * (dim - 1) * (dim - 1) << " faces, StVK, " << nthreads
+        << " threads, best of " << reps << " runs" << std::endl;
+    std::cout << std::setw(7) << "sff" << std::setw(13) << "fresh (ms)" << std::setw(17) << "workspace (ms)" << std::setw(10) << "speedup" << std::endl;
+
+    BenchmarkUtils::forEachSFF([&](auto tag, const char* sffname)
+        {
+            typedef typename decltype(tag)::type SFF;
+            BenchmarkUtils::ShellProblem<SFF> problem(dim);
+            LibShell::StVKMaterial<SFF> mat;
+
+            double freshms = BenchmarkUtils::timeMs(reps, [&]()
+                {
+                    Eigen::VectorXd derivative;
+                    std::vector<Eigen::Triplet<double> > hessian;
+                    LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                        &derivative, &hessian, LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kFull,
+                        LibShell::ExecutionContext(nthreads));
+                });
+
+            LibShell::AssemblyWorkspace workspace;
+            double workspacems = BenchmarkUtils::timeMs(reps, [&]()
+                {
+                    LibShell::ElasticShell<SFF>::elasticEnergy(problem.mesh, problem.curPos, problem.edgeDOFs, mat, problem.monolayer,
+                        &workspace.derivative, &workspace.triplets, LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kFull,
+                        LibShell::ExecutionContext(nthreads, NULL, &workspace));
+                });
+
+            std::cout << std::setw(7) << sffname << std::fixed << std::setprecision(2) << std::setw(13) << freshms
+                << std::setw(17) << workspacems << std::setw(9) << freshms / workspacems << "x" << std::endl;
+        });
+}
@@ -1,6 +1,7 @@
 #include "QuadraticExpansionBending.h"
 #include "../include/MeshConnectivity.h"
 #include "../include/RestState.h"
+#include "../include/ElasticShell.h"
 #include <Eigen/Sparse>
 #include <Eigen/Dense>
 #include "../include/MidedgeAngleSinFormulation.h"
@@ -52,7 +53,8 @@ void bendingMatrix(
     const Eigen::MatrixXd& restPos,
     const Eigen::VectorXd& restExtraDOFs,
     const LibShell::RestState& restState,    
-    std::vector<Eigen::Triplet<double> >& Mcoeffs
+    std::vector<Eigen::Triplet<double> >& Mcoeffs,
+    LibShell::HessianStorage storage
 )
 {
     int nfaces = mesh.nFaces();
@@ -60,11 +62,23 @@ void bendingMatrix(
     int nverts = (int)restPos.rows();
 
     constexpr int nedgedofs = SFF::numExtraDOFs;
-    
+
+    // skips the entries outside the requested triangle
+    auto addCoeff = [&](int row, int col, double val)
+    {
+        if ((storage == LibShell::HessianStorage::kLower && row < col) || (storage == LibShell::HessianStorage::kUpper && row > col))
+            return;
+        Mcoeffs.push_back(Eigen::Triplet<double>(row, col, val));
+    };
+
+    // one triplet per stored pair of valid bending stencil DOFs, as counted for the elastic energy assembly
+    Mcoeffs.reserve(Mcoeffs.size() + LibShell::ElasticShell<SFF>::numHessianTriplets(mesh, LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING, storage));
+
     for (int i = 0; i < nfaces; i++)
     {
         Eigen::Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> hess;
         bendingMatrixTerm<SFF>(mesh, restPos, restExtraDOFs, restState, i, hess);
+        const LibShell::FaceStencil& stencil = mesh.faceStencil(i);
         for (int j = 0; j < 3; j++)
         {
             for (int k = 0; k < 3; k++)
@@ -73,25 +87,25 @@ void bendingMatrix(
                 {
                     for (int m = 0; m < 3; m++)
                     {
-                        Mcoeffs.push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * mesh.faceVertex(i, k) + m, hess(3 * j + l, 3 * k + m)));
-                        int oppidxk = mesh.vertexOppositeFaceEdge(i, k);
+                        addCoeff(3 * stencil.vertices[j] + l, 3 * stencil.vertices[k] + m, hess(3 * j + l, 3 * k + m));
+                        int oppidxk = stencil.oppositeVertices[k];
                         if (oppidxk != -1)
-                            Mcoeffs.push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * oppidxk + m, hess(3 * j + l, 9 + 3 * k + m)));
-                        int oppidxj = mesh.vertexOppositeFaceEdge(i, j);
+                            addCoeff(3 * stencil.vertices[j] + l, 3 * oppidxk + m, hess(3 * j + l, 9 + 3 * k + m));
+                        int oppidxj = stencil.oppositeVertices[j];
                         if (oppidxj != -1)
-                            Mcoeffs.push_back(Eigen::Triplet<double>(3 * oppidxj + l, 3 * mesh.faceVertex(i, k) + m, hess(9 + 3 * j + l, 3 * k + m)));
+                            addCoeff(3 * oppidxj + l, 3 * stencil.vertices[k] + m, hess(9 + 3 * j + l, 3 * k + m));
                         if (oppidxj != -1 && oppidxk != -1)
-                            Mcoeffs.push_back(Eigen::Triplet<double>(3 * oppidxj + l, 3 * oppidxk + m, hess(9 + 3 * j + l, 9 + 3 * k + m)));
+                            addCoeff(3 * oppidxj + l, 3 * oppidxk + m, hess(9 + 3 * j + l, 9 + 3 * k + m));
                     }
                     for (int m = 0; m < nedgedofs; m++)
                     {
-                        Mcoeffs.push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, hess(3 * j + l, 18 + nedgedofs * k + m)));
-                        Mcoeffs.push_back(Eigen::Triplet<double>(3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, 3 * mesh.faceVertex(i, j) + l, hess(18 + nedgedofs * k + m, 3 * j + l)));
-                        int oppidxj = mesh.vertexOppositeFaceEdge(i, j);
+                        addCoeff(3 * stencil.vertices[j] + l, 3 * nverts + nedgedofs * stencil.edges[k] + m, hess(3 * j + l, 18 + nedgedofs * k + m));
+                        addCoeff(3 * nverts + nedgedofs * stencil.edges[k] + m, 3 * stencil.vertices[j] + l, hess(18 + nedgedofs * k + m, 3 * j + l));
+                        int oppidxj = stencil.oppositeVertices[j];
                         if (oppidxj != -1)
                         {
-                            Mcoeffs.push_back(Eigen::Triplet<double>(3 * oppidxj + l, 3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, hess(9 + 3 * j + l, 18 + nedgedofs * k + m)));
-                            Mcoeffs.push_back(Eigen::Triplet<double>(3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, 3 * oppidxj + l, hess(18 + nedgedofs * k + m, 9 + 3 * j + l)));
+                            addCoeff(3 * oppidxj + l, 3 * nverts + nedgedofs * stencil.edges[k] + m, hess(9 + 3 * j + l, 18 + nedgedofs * k + m));
+                            addCoeff(3 * nverts + nedgedofs * stencil.edges[k] + m, 3 * oppidxj + l, hess(18 + nedgedofs * k + m, 9 + 3 * j + l));
                         }
                     }
                 }
@@ -99,7 +113,7 @@ void bendingMatrix(
                 {
                     for (int n = 0; n < nedgedofs; n++)
                     {
-                        Mcoeffs.push_back(Eigen::Triplet<double>(3 * nverts + nedgedofs * mesh.faceEdge(i, j) + m, 3 * nverts + nedgedofs * mesh.faceEdge(i, k) + n, hess(18 + nedgedofs * j + m, 18 + nedgedofs * k + n)));
+                        addCoeff(3 * nverts + nedgedofs * stencil.edges[j] + m, 3 * nverts + nedgedofs * stencil.edges[k] + n, hess(18 + nedgedofs * j + m, 18 + nedgedofs * k + n));
                     }
                 }
             }
@@ -112,7 +126,8 @@ template void bendingMatrix<LibShell::MidedgeAngleSinFormulation>(
     const Eigen::MatrixXd& restPos,
     const Eigen::VectorXd& restExtraDOFs,
     const LibShell::RestState& restState,
-    std::vector<Eigen::Triplet<double> >& Mcoeffs
+    std::vector<Eigen::Triplet<double> >& Mcoeffs,
+    LibShell::HessianStorage storage
 );
 
 template void bendingMatrix<LibShell::MidedgeAngleTanFormulation>(
@@ -120,7 +135,8 @@ template void bendingMatrix<LibShell::MidedgeAngleTanFormulation>(
     const Eigen::MatrixXd& restPos,
     const Eigen::VectorXd& restExtraDOFs,
     const LibShell::RestState& restState,
-    std::vector<Eigen::Triplet<double> >& Mcoeffs
+    std::vector<Eigen::Triplet<double> >& Mcoeffs,
+    LibShell::HessianStorage storage
     );
 
 template void bendingMatrix<LibShell::MidedgeAverageFormulation>(
@@ -128,5 +144,6 @@ template void bendingMatrix<LibShell::MidedgeAverageFormulation>(
     const Eigen::MatrixXd& restPos,
     const Eigen::VectorXd& restExtraDOFs,
     const LibShell::RestState& restState,
-    std::vector<Eigen::Triplet<double> >& Mcoeffs
+    std::vector<Eigen::Triplet<double> >& Mcoeffs,
+    LibShell::HessianStorage storage
     );
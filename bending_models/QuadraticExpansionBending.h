@@ -6,6 +6,7 @@
 #include <vector>
 #include "../include/MeshConnectivity.h"
 #include "../include/RestState.h"
+#include "../include/types.h"
 
 template <class SFF>
 void bendingMatrix(
@@ -13,7 +14,8 @@ void bendingMatrix(
     const Eigen::MatrixXd& restPos,
     const Eigen::VectorXd& restExtraDOFs,
     const LibShell::RestState& restState,    
-    std::vector<Eigen::Triplet<double> >& Mcoeffs
+    std::vector<Eigen::Triplet<double> >& Mcoeffs,
+    LibShell::HessianStorage storage = LibShell::HessianStorage::kFull
 );
 
 
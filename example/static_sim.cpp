@@ -1,6 +1,7 @@
 #include "../optimization/include/NewtonDescent.h"
 
 #include "../include/ElasticShell.h"
+#include "../include/HessianAssemblyPlan.h"
 #include "../include/MeshConnectivity.h"
 #include "../include/MidedgeAngleSinFormulation.h"
 #include "../include/MidedgeAngleTanFormulation.h"
@@ -116,8 +117,6 @@ void run_simulation(const LibShell::MeshConnectivity &mesh,
   P.resize(nfree, 3 * cur_pos.rows() + nedges * nedgedofs);
   P.setFromTriplets(Pcoeffs.begin(), Pcoeffs.end());
 
-  int totalDOFs = 3 * cur_pos.rows() + nedges * nedgedofs;
-
   // project the current position
   auto pos_edgedofs_to_variable = [&](const Eigen::MatrixXd &pos,
                                       const Eigen::VectorXd &edge_DOFs) {
@@ -148,17 +147,20 @@ void run_simulation(const LibShell::MeshConnectivity &mesh,
     return std::pair<Eigen::MatrixXd, Eigen::VectorXd>{pos, edge_DOFs};
   };
 
+  // the Hessian sparsity pattern is fixed, so it is planned once and the full Hessian is refilled in place
+  LibShell::HessianAssemblyPlan hessian_plan(mesh, cur_pos.rows(), nedgedofs);
+  Eigen::SparseMatrix<double> full_hessian;
+
   // energy, gradient, and hessian
   auto obj_func = [&](const Eigen::VectorXd &var, Eigen::VectorXd *grad,
                       Eigen::SparseMatrix<double> *hessian, bool psd_proj) {
     Eigen::MatrixXd pos;
     Eigen::VectorXd edge_DOFs;
-    std::vector<Eigen::Triplet<double>> hessian_triplets;
     std::tie(pos, edge_DOFs) = variable_to_pos_edgedofs(var);
 
     double energy = LibShell::ElasticShell<SFF>::elasticEnergy(
-        mesh, pos, edge_DOFs, *mat, rest_state, grad,
-        hessian ? &hessian_triplets : nullptr, psd_proj ? proj_type : LibShell::HessianProjectType::kNone);
+        mesh, pos, edge_DOFs, *mat, rest_state, grad, hessian_plan,
+        hessian ? &full_hessian : nullptr, psd_proj ? proj_type : LibShell::HessianProjectType::kNone);
 
     if (grad) {
       if (fixed_verts) {
@@ -167,11 +169,10 @@ void run_simulation(const LibShell::MeshConnectivity &mesh,
     }
 
     if (hessian) {
-      hessian->resize(totalDOFs, totalDOFs);
-      hessian->setFromTriplets(hessian_triplets.begin(),
-                               hessian_triplets.end());
       if (fixed_verts) {
-        *hessian = P * (*hessian) * P.transpose();
+        *hessian = P * full_hessian * P.transpose();
+      } else {
+        *hessian = full_hessian;
       }
     }
 
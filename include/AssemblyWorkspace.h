@@ -0,0 +1,57 @@
+#ifndef ASSEMBLYWORKSPACE_H
+#define ASSEMBLYWORKSPACE_H
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <vector>
+
+#include "SecondFundamentalFormCache.h"
+
+namespace LibShell {
+
+    /*
+     * Scratch memory of the energy assembly (ElasticShell::elasticEnergy, hessianVectorProduct and hessianDiagonalBlocks)
+     * that the caller keeps alive across calls, and passes in through ExecutionContext::workspace. Without one, every
+     * call allocates (and the OS zero-fills) fresh per-thread buffers and per-edge geometry caches; with one, these are
+     * resized in place and keep their capacity, so repeated evaluations on the same mesh do not allocate after the first.
+     *
+     * The workspace also owns derivative and Hessian outputs that callers can pass in (e.g. &workspace.derivative,
+     * &workspace.triplets), which then keep their capacity too. Buffers only grow; release() frees them. A workspace
+     * is not thread safe: it may be used by only one assembly at a time.
+     */
+    class AssemblyWorkspace
+    {
+    public:
+        // Outputs for the caller's use
+        Eigen::VectorXd derivative;
+        std::vector<Eigen::Triplet<double> > triplets;
+
+        // Frees all buffers
+        void release() { *this = AssemblyWorkspace(); }
+
+        // Internal to the assembly: per-thread buffers (the first thread writes into the outputs directly) and energies
+        struct ThreadBuffers
+        {
+            Eigen::VectorXd derivative;
+            std::vector<Eigen::Triplet<double> > triplets;
+            std::vector<double> values;
+            Eigen::VectorXd product;
+            std::vector<Eigen::Matrix3d> vertexBlocks;
+            Eigen::VectorXd edgeDiagonal;
+        };
+        std::vector<ThreadBuffers> threadBuffers;
+        std::vector<double> threadEnergies;
+
+        // Internal to the assembly: the geometry cache of the second fundamental form in use (see SFF::GeometryCache)
+        template <class Cache> Cache& geometryCache();
+
+    private:
+        EdgeThetaCache edgeThetas;
+        FaceNormalCache faceNormals;
+    };
+
+    template <> inline EdgeThetaCache& AssemblyWorkspace::geometryCache<EdgeThetaCache>() { return edgeThetas; }
+    template <> inline FaceNormalCache& AssemblyWorkspace::geometryCache<FaceNormalCache>() { return faceNormals; }
+};
+
+#endif
@@ -25,20 +25,22 @@ namespace LibShell {
 
         virtual double stretchingEnergy(
             const MeshConnectivity& mesh,
-            const Eigen::MatrixXd& curPos,
+            const PositionsRef& curPos,
             const RestState &restState,
             int face,
             Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
-            Eigen::Matrix<double, 9, 9>* hessian) const;
+            Eigen::Matrix<double, 9, 9>* hessian,
+            HessianProjectType projType = HessianProjectType::kNone) const;
 
         virtual double bendingEnergy(
             const MeshConnectivity& mesh,
-            const Eigen::MatrixXd& curPos,
-            const Eigen::VectorXd& extraDOFs,
+            const PositionsRef& curPos,
+            const EdgeDOFsRef& extraDOFs,
             const RestState &restState,
             int face,
             Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
-            Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian) const;
+            Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+            const typename SFF::GeometryCache* geometryCache = NULL) const;
 
 
     };
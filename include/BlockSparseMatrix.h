@@ -0,0 +1,90 @@
+#ifndef BLOCKSPARSEMATRIX_H
+#define BLOCKSPARSEMATRIX_H
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <vector>
+
+#include "types.h"
+
+namespace LibShell {
+
+    class MeshConnectivity;
+
+    /*
+     * Block-sparse (BSR) storage of the shell Hessian. The DOFs are grouped into one block per vertex (its 3 coordinates)
+     * followed by one block per edge (its numExtraDOFs extra DOFs), and the matrix stores dense blocks, row-major, for
+     * every pair of DOF blocks coupled by some face's bending stencil. Compared to a scalar CSC matrix, this needs one
+     * column index per block instead of one per entry, and the products work on whole 3 x 3 blocks.
+     *
+     * The pattern depends only on the mesh connectivity, the number of vertices and numExtraDOFs, like a
+     * HessianAssemblyPlan, and is built once; ElasticShell::elasticEnergy then fills its values in place. The full
+     * (symmetric) matrix is stored.
+     */
+    class BlockSparseMatrix
+    {
+    public:
+        BlockSparseMatrix();
+        BlockSparseMatrix(const MeshConnectivity& mesh, int nverts, int numExtraDOFs);
+
+        int rows() const { return ndofs; }
+        int cols() const { return ndofs; }
+        int nFaces() const { return nfaces; }
+        int nVertices() const { return nverts; }
+        int numExtraDOFs() const { return nedgedofs; }
+
+        // number of block rows (vertices, then edges if numExtraDOFs > 0) and of stored blocks
+        int nBlockRows() const { return (int)rowOffsets.size() - 1; }
+        int nBlocks() const { return (int)blockCols.size(); }
+
+        // number of stored scalar entries
+        int nonZeros() const { return (int)values.size(); }
+
+        // size and first DOF of block row (or column) b
+        int blockSize(int b) const { return b < nverts ? 3 : nedgedofs; }
+        int blockStart(int b) const { return b < nverts ? 3 * b : 3 * nverts + nedgedofs * (b - nverts); }
+
+        /*
+         * Offsets into valuePtr() of the blocks coupling the DOF blocks of a face's bending stencil, as a row-major 9 x 9 table
+         * indexed by stencil slot: the three face vertices, the three opposite vertices, then the three face edges. Slots of missing
+         * opposite vertices (and the edge slots, without extra DOFs) have offset -1.
+         */
+        const int* faceBlockOffsets(int face) const { return faceOffsets.data() + (size_t)face * 81; }
+
+        double* valuePtr() { return values.data(); }
+        const double* valuePtr() const { return values.data(); }
+
+        void setZero();
+
+        // y = A x, parallel over block rows
+        void multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y, const ExecutionContext& ctx = ExecutionContext()) const;
+
+        // Converts to a compressed Eigen sparse matrix (e.g. for Eigen's direct solvers)
+        void toSparse(Eigen::SparseMatrix<double>& H) const;
+
+        /*
+         * Inverses of the diagonal blocks, packed block after block (row-major), for a block Jacobi preconditioner. Blocks that
+         * are not invertible are replaced by the inverse of their diagonal (with zero diagonal entries replaced by 1).
+         */
+        void invertDiagonalBlocks(std::vector<double>& inverses) const;
+
+        // y = D x, for block diagonal matrices D packed as returned by invertDiagonalBlocks
+        void multiplyBlockDiagonal(const std::vector<double>& blocks, const Eigen::VectorXd& x, Eigen::VectorXd& y) const;
+
+    private:
+        int nfaces;
+        int nverts;
+        int nedgedofs;
+        int ndofs;
+
+        // blocks of block row r are rowOffsets[r] .. rowOffsets[r + 1] - 1, sorted by column
+        std::vector<int> rowOffsets;
+        std::vector<int> blockCols;
+        std::vector<int> blockValueOffsets;
+        std::vector<int> diagonalBlocks;
+        std::vector<int> faceOffsets;
+        std::vector<double> values;
+    };
+};
+
+#endif
@@ -11,11 +11,26 @@
 namespace LibShell {
 
     class MeshConnectivity;
+    class HessianAssemblyPlan;
+    class BlockSparseMatrix;
     struct RestState;
 
+    /*
+     * Projects the symmetric matrix A onto the positive semidefinite cone (as selected by projType). Matrices that are
+     * positive semidefinite up to round-off (checked with a cheap LDL^T factorization) are left untouched; the others are
+     * projected through an eigendecomposition. Instantiated for the 9 x 9 stretching and the 18 x 18 / 21 x 21 bending
+     * element Hessians.
+     */
     template <class DerivedA>
     void projSymMatrix(Eigen::MatrixBase<DerivedA>& A, const HessianProjectType& projType);
 
+    // Identity, for function parameters whose type must not be used to deduce template arguments
+    template <class T>
+    struct NonDeduced
+    {
+        typedef T type;
+    };
+
     template <class SFF>
     class ElasticShell
     {
@@ -34,7 +49,14 @@ namespace LibShell {
          * - SFF:           the choice of second fundamental form discretization.
          * - whichTerms     optional flags offering finer-grained control over which terms to include. ET_STRETCHING includes the bending energy, and
                             ET_BENDING the bending energy. Default is both (ET_STRETCHING | ET_BENDING).
-         * - projType:      the type of projection to use for the Hessian. kNone: no projection, kMaxZero: Max Zero projection, kAbs: Abs projection.
+         * - projType:      the type of projection to use for the Hessian. kNone: no projection, kMaxZero: Max Zero projection, kAbs: Abs projection,
+         *                  kStrainSpace: Max Zero projection, except for the stretching Hessians of materials supporting it, which are made positive
+         *                  semidefinite in the (much smaller) space of first fundamental forms instead.
+         * - storage:       which part of the symmetric Hessian to output. kFull: all entries, kLower/kUpper: only the entries with row >= col
+         *                  (resp. row <= col), which halves the number of triplets. Pass the result to solvers through selfadjointView().
+         * - ctx:           optional execution settings (number of threads). Faces are split into contiguous per-thread ranges with their own
+         *                  derivative and triplet buffers, which are then merged in thread order, so the output is deterministic for a fixed
+         *                  thread count. With a face coloring set in ctx, the faces are instead processed color by color, without buffers.
          *
          * Outputs:
          * - returns the total elastic energy of the shell.
@@ -52,7 +74,9 @@ namespace LibShell {
             const RestState &restState,
             Eigen::VectorXd* derivative, // positions, then thetas
             std::vector<Eigen::Triplet<double> >* hessian,
-            const HessianProjectType projType = HessianProjectType::kMaxZero);
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const HessianStorage storage = HessianStorage::kFull,
+            const ExecutionContext& ctx = ExecutionContext());
 
         static double elasticEnergy(
             const MeshConnectivity& mesh,
@@ -63,7 +87,259 @@ namespace LibShell {
             int whichTerms,
             Eigen::VectorXd* derivative, // positions, then thetas
             std::vector<Eigen::Triplet<double> >* hessian,
-            const HessianProjectType projType = HessianProjectType::kMaxZero);
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const HessianStorage storage = HessianStorage::kFull,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Same as above, but the Hessian is written directly into the values of a sparse matrix, using a HessianAssemblyPlan built once for the
+         * mesh topology, instead of into a list of triplets. No triplets are created and nothing is sorted or reallocated.
+         *
+         * Additional inputs:
+         * - plan:          sparsity plan built from mesh, |V| and SFF::numExtraDOFs. The energy is infinite if it does not match them. The
+         *                  plan also fixes which part of the Hessian is stored (see HessianAssemblyPlan).
+         *
+         * Outputs:
+         * - hessian:       if not null, will be set to the Hessian of the elastic energy. If it already has the plan's sparsity pattern (e.g. it
+         *                  was filled by a previous call) only its values are overwritten; otherwise it is reinitialized from the plan.
+         */
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            const HessianAssemblyPlan& plan,
+            Eigen::SparseMatrix<double>* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            int whichTerms,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            const HessianAssemblyPlan& plan,
+            Eigen::SparseMatrix<double>* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Same as above, but the Hessian is written into a BlockSparseMatrix (3 x 3 vertex blocks and numExtraDOFs x numExtraDOFs edge blocks),
+         * whose pattern was built once from mesh, |V| and SFF::numExtraDOFs. The energy is infinite if it does not match them. Always stores the
+         * full Hessian.
+         */
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            BlockSparseMatrix& hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            int whichTerms,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            BlockSparseMatrix& hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Same as above, but with all degrees of freedom in one flat vector, laid out like the derivative: the vertex positions interleaved
+         * (x0, y0, z0, x1, ...), then the edge DOFs. The vector is read in place, rather than copied into a |V| x 3 matrix and an edge DOF
+         * vector, so solvers working on such a vector can call this directly. The energy is infinite if dofs.size() is not
+         * 3 |V| + SFF::numExtraDOFs |E| for some |V|.
+         */
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::Ref<const Eigen::VectorXd>& dofs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            int whichTerms,
+            Eigen::VectorXd* derivative,
+            std::vector<Eigen::Triplet<double> >* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const HessianStorage storage = HessianStorage::kFull,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::Ref<const Eigen::VectorXd>& dofs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            int whichTerms,
+            Eigen::VectorXd* derivative,
+            const HessianAssemblyPlan& plan,
+            Eigen::SparseMatrix<double>* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Computes the product of the Hessian of the elastic energy with a vector v, without assembling the Hessian: every element
+         * Hessian is projected (as selected by projType, like for elasticEnergy) and multiplied with the entries of v on its stencil
+         * as soon as it is computed, so memory use does not grow with the number of nonzeros. Suited to Krylov (e.g. conjugate
+         * gradient) solves of the Newton system. Threads (ctx) accumulate into their own copies of the product, which are summed in
+         * thread order.
+         *
+         * Inputs:
+         * - v:             vector with the layout of the derivative returned by elasticEnergy (3 |V| + SFF::numExtraDOFs |E| entries).
+         * - other inputs as for elasticEnergy.
+         *
+         * Outputs:
+         * - returns the total elastic energy of the shell, or infinity (leaving out untouched) if the sizes of curPos, edgeDOFs or v do not
+         *   fit the mesh.
+         * - out:           set to H v, where H is the full (symmetric) Hessian. Must not alias v.
+         */
+        static double hessianVectorProduct(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            const Eigen::VectorXd& v,
+            Eigen::VectorXd& out,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        static double hessianVectorProduct(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            int whichTerms,
+            const Eigen::VectorXd& v,
+            Eigen::VectorXd& out,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Computes only the diagonal of the Hessian of the elastic energy, for (block) Jacobi preconditioners: the 3 x 3 block of every
+         * vertex and the diagonal entry of every edge DOF. The element Hessians are computed and projected as for elasticEnergy, but
+         * only their diagonal blocks are accumulated, into compact dense arrays; no triplets or sparse matrix are built.
+         *
+         * Inputs: as for elasticEnergy.
+         *
+         * Outputs:
+         * - returns the total elastic energy of the shell, or infinity (leaving the outputs untouched) if the sizes of curPos or edgeDOFs
+         *   do not fit the mesh.
+         * - vertexBlocks:  resized to |V|; entry i is the 3 x 3 block of the Hessian at rows and columns 3i, 3i+1, 3i+2.
+         * - edgeDOFDiagonal: resized to SFF::numExtraDOFs |E|; entry j is the diagonal entry of the Hessian at edge DOF j (i.e. at
+         *                  row and column 3 |V| + j).
+         */
+        static double hessianDiagonalBlocks(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            std::vector<Eigen::Matrix3d>& vertexBlocks,
+            Eigen::VectorXd& edgeDOFDiagonal,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        static double hessianDiagonalBlocks(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const MaterialModel<SFF>& mat,
+            const RestState &restState,
+            int whichTerms,
+            std::vector<Eigen::Matrix3d>& vertexBlocks,
+            Eigen::VectorXd& edgeDOFDiagonal,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Same as the overloads above, but with the material type fixed at compile time: its energy kernels are called directly, and
+         * can be inlined into the assembly loop, rather than through the virtual MaterialModel interface once per face. The material
+         * must be named explicitly, e.g. elasticEnergy<StVKMaterial<SFF> >(...); it is not deduced from mat, so that calls without
+         * template arguments keep resolving to the virtual overloads. Instantiated for NeoHookeanMaterial, StVKMaterial,
+         * TensionFieldStVKMaterial and BilayerStVKMaterial.
+         */
+        template <class Material>
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const typename NonDeduced<Material>::type& mat,
+            const RestState &restState,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            std::vector<Eigen::Triplet<double> >* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const HessianStorage storage = HessianStorage::kFull,
+            const ExecutionContext& ctx = ExecutionContext())
+        {
+            return elasticEnergy<Material>(mesh, curPos, edgeDOFs, mat, restState, EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
+                derivative, hessian, projType, storage, ctx);
+        }
+
+        template <class Material>
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const typename NonDeduced<Material>::type& mat,
+            const RestState &restState,
+            int whichTerms,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            std::vector<Eigen::Triplet<double> >* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const HessianStorage storage = HessianStorage::kFull,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        template <class Material>
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const typename NonDeduced<Material>::type& mat,
+            const RestState &restState,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            const HessianAssemblyPlan& plan,
+            Eigen::SparseMatrix<double>* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext())
+        {
+            return elasticEnergy<Material>(mesh, curPos, edgeDOFs, mat, restState, EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
+                derivative, plan, hessian, projType, ctx);
+        }
+
+        template <class Material>
+        static double elasticEnergy(
+            const MeshConnectivity& mesh,
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const typename NonDeduced<Material>::type& mat,
+            const RestState &restState,
+            int whichTerms,
+            Eigen::VectorXd* derivative, // positions, then thetas
+            const HessianAssemblyPlan& plan,
+            Eigen::SparseMatrix<double>* hessian,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Exact number of triplets elasticEnergy outputs for the Hessian of the given terms with the given storage. It only depends on the
+         * mesh connectivity (boundary faces have fewer opposite vertices) and SFF::numExtraDOFs. elasticEnergy reserves the triplet vector
+         * with it, so the vector is never regrown during assembly; reserving it yourself once also avoids reallocating it between calls.
+         */
+        static size_t numHessianTriplets(
+            const MeshConnectivity& mesh,
+            int whichTerms = EnergyTerm::ET_STRETCHING | EnergyTerm::ET_BENDING,
+            const HessianStorage storage = HessianStorage::kFull);
 
         static std::vector<double> elasticEnergyPerElement(
             const MeshConnectivity& mesh,
@@ -71,7 +347,8 @@ namespace LibShell {
             const Eigen::VectorXd& edgeDOFs,
             const MaterialModel<SFF>& mat,
             const RestState &restState,
-            int whichTerms);
+            int whichTerms,
+            const ExecutionContext& ctx = ExecutionContext());
 
         /*
          * Computes current fundamental forms for a given mesh. Can be used to initialize these forms from a given mesh rest state.
@@ -0,0 +1,62 @@
+#ifndef HESSIANASSEMBLYPLAN_H
+#define HESSIANASSEMBLYPLAN_H
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <vector>
+
+#include "types.h"
+
+namespace LibShell {
+
+    class MeshConnectivity;
+
+    /*
+     * Precomputed sparsity pattern of the shell Hessian, together with the location of every element Hessian entry
+     * inside the values array of that pattern. Built once per mesh topology, it lets ElasticShell::elasticEnergy fill
+     * a sparse matrix in place (no triplets, no sorting, no reallocation).
+     *
+     * The plan depends only on the mesh connectivity, the number of vertices and SFF::numExtraDOFs; it stays valid
+     * for as long as those do not change. With storage kLower or kUpper, only that triangle of the Hessian is part of
+     * the pattern, and the offsets of the other entries are -1.
+     */
+    class HessianAssemblyPlan
+    {
+    public:
+        HessianAssemblyPlan();
+        HessianAssemblyPlan(const MeshConnectivity& mesh, int nverts, int numExtraDOFs, HessianStorage storage = HessianStorage::kFull);
+
+        int nDOFs() const { return (int)pattern.rows(); }
+        int nFaces() const { return nfaces; }
+        int numExtraDOFs() const { return nedgedofs; }
+        int nonZeros() const { return (int)pattern.nonZeros(); }
+        HessianStorage storage() const { return storagetype; }
+
+        // number of local DOFs of a face's bending stencil, 18 + 3 * numExtraDOFs
+        int localDOFs() const { return nlocal; }
+
+        /*
+         * Offsets into the valuePtr() of a matrix with the plan's pattern of the entries of the face's element Hessian,
+         * as a row-major localDOFs() x localDOFs() table indexed by bending-stencil DOF (face vertices, opposite
+         * vertices, then edge DOFs). Entries of missing opposite vertices, and entries outside the stored triangle, are -1. The top-left 9 x 9 block addresses the
+         * stretching Hessian.
+         */
+        const int* faceOffsets(int face) const { return offsets.data() + (size_t)face * nlocal * nlocal; }
+
+        // Sets H to the plan's sparsity pattern, with all values zero
+        void initializeMatrix(Eigen::SparseMatrix<double>& H) const;
+
+        // Whether H can be filled through the plan's offsets (compressed, with the same dimensions and sparsity pattern)
+        bool matches(const Eigen::SparseMatrix<double>& H) const;
+
+    private:
+        int nfaces;
+        int nedgedofs;
+        int nlocal;
+        HessianStorage storagetype;
+        Eigen::SparseMatrix<double> pattern;
+        std::vector<int> offsets;
+    };
+};
+
+#endif
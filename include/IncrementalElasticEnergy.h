@@ -0,0 +1,127 @@
+#ifndef INCREMENTALELASTICENERGY_H
+#define INCREMENTALELASTICENERGY_H
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <vector>
+
+#include "ElasticShell.h"
+#include "HessianAssemblyPlan.h"
+#include "MaterialModel.h"
+#include "types.h"
+
+namespace LibShell {
+
+    class MeshConnectivity;
+    struct RestState;
+
+    /*
+     * Elastic energy, derivative and Hessian of a shell (as computed by ElasticShell::elasticEnergy) that can be updated
+     * after only a few vertices or edge DOFs have moved, e.g. during interactive editing or localized contact. The
+     * energy, derivative and Hessian contributions of every face are kept from the previous evaluation; update()
+     * recomputes only the faces whose stencil contains a changed DOF, and patches the totals in place: the old
+     * contributions of those faces are subtracted, and the new ones added.
+     *
+     * The mesh, material and rest state are referenced, not copied, and must outlive the evaluator. Incremental updates
+     * accumulate round-off in the totals; calling evaluate() again recomputes everything from scratch.
+     */
+    template <class SFF>
+    class IncrementalElasticEnergy
+    {
+    public:
+        /*
+         * Inputs:
+         * - nverts:        number of vertices of the positions that will be passed to evaluate() and update().
+         * - whichTerms, projType, storage: as for ElasticShell::elasticEnergy. The Hessian has the layout of a HessianAssemblyPlan
+         *                  built from mesh, nverts, SFF::numExtraDOFs and storage.
+         */
+        IncrementalElasticEnergy(
+            const MeshConnectivity& mesh,
+            const MaterialModel<SFF>& mat,
+            const RestState& restState,
+            int nverts,
+            int whichTerms = ElasticShell<SFF>::EnergyTerm::ET_STRETCHING | ElasticShell<SFF>::EnergyTerm::ET_BENDING,
+            const HessianProjectType projType = HessianProjectType::kMaxZero,
+            const HessianStorage storage = HessianStorage::kFull);
+
+        /*
+         * Recomputes the contributions of all faces at the given configuration, in parallel over ctx.numThreads threads. Returns the
+         * energy, or infinity (leaving the evaluator untouched) if the sizes of curPos or edgeDOFs do not fit.
+         */
+        double evaluate(const Eigen::MatrixXd& curPos, const Eigen::VectorXd& edgeDOFs, const ExecutionContext& ctx = ExecutionContext());
+
+        /*
+         * Recomputes only the faces affected by a change of the given vertices and edges (for SFFs with extra DOFs, the DOFs of
+         * these edges) since the previous evaluate() or update(), which must have been called before. curPos and edgeDOFs are the
+         * full new configuration; DOFs outside the dirty lists must be unchanged. A vertex changes the stretching energy of the faces
+         * containing it, and the bending energy of the faces whose bending stencil (face vertices and opposite vertices) contains it.
+         * Returns the updated energy, or infinity (leaving the evaluator untouched) if the sizes do not fit or nothing was evaluated yet.
+         */
+        double update(
+            const Eigen::MatrixXd& curPos,
+            const Eigen::VectorXd& edgeDOFs,
+            const std::vector<int>& dirtyVertices,
+            const std::vector<int>& dirtyEdges = std::vector<int>(),
+            const ExecutionContext& ctx = ExecutionContext());
+
+        double energy() const { return totalEnergy; }
+
+        // derivative of the energy, with the layout of the ElasticShell::elasticEnergy derivative
+        const Eigen::VectorXd& derivative() const { return gradient; }
+
+        // Hessian of the energy, with the sparsity pattern of plan()
+        const Eigen::SparseMatrix<double>& hessian() const { return H; }
+
+        const HessianAssemblyPlan& plan() const { return assemblyPlan; }
+
+        // faces recomputed by the last evaluate() or update()
+        int numUpdatedFaces() const { return nupdated; }
+
+    private:
+        static constexpr int nbend = 18 + 3 * SFF::numExtraDOFs;
+        typedef Eigen::Matrix<double, 1, 9> StretchingDerivative;
+        typedef Eigen::Matrix<double, 9, 9> StretchingHessian;
+        typedef Eigen::Matrix<double, 1, nbend> BendingDerivative;
+        typedef Eigen::Matrix<double, nbend, nbend> BendingHessian;
+
+        // recomputes the stored contributions of face; cache may be NULL
+        void computeStretching(const PositionsRef& curPos, int face);
+        void computeBending(const PositionsRef& curPos, const EdgeDOFsRef& edgeDOFs, int face, const typename SFF::GeometryCache* cache);
+
+        // adds sign times the stored contributions of face to the totals
+        void scatterStretching(int face, double sign);
+        void scatterBending(int face, double sign);
+
+        bool sizesMatch(const Eigen::MatrixXd& curPos, const Eigen::VectorXd& edgeDOFs) const;
+
+        const MeshConnectivity& mesh;
+        const MaterialModel<SFF>& mat;
+        const RestState& restState;
+        int nverts;
+        int whichTerms;
+        HessianProjectType projType;
+        HessianAssemblyPlan assemblyPlan;
+        bool evaluated;
+        int nupdated;
+
+        // faces affected by each vertex and edge, in compressed (offsets, indices) form
+        std::vector<int> vertexStretchingOffsets, vertexStretchingFaces;
+        std::vector<int> vertexBendingOffsets, vertexBendingFaces;
+
+        std::vector<double> stretchingEnergies, bendingEnergies;
+        std::vector<StretchingDerivative, Eigen::aligned_allocator<StretchingDerivative> > stretchingDerivatives;
+        std::vector<StretchingHessian, Eigen::aligned_allocator<StretchingHessian> > stretchingHessians;
+        std::vector<BendingDerivative, Eigen::aligned_allocator<BendingDerivative> > bendingDerivatives;
+        std::vector<BendingHessian, Eigen::aligned_allocator<BendingHessian> > bendingHessians;
+
+        double totalEnergy;
+        Eigen::VectorXd gradient;
+        Eigen::SparseMatrix<double> H;
+
+        // per-face markers for collecting the affected faces without duplicates
+        std::vector<int> stretchingMarks, bendingMarks;
+        int markStamp;
+    };
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define MATERIALMODEL_H
 
 #include <Eigen/Core>
+#include "types.h"
 
 namespace LibShell {
 
@@ -14,20 +15,88 @@ namespace LibShell {
     public:
         virtual double stretchingEnergy(
             const MeshConnectivity& mesh,
-            const Eigen::MatrixXd& curPos,
+            const PositionsRef& curPos,
             const RestState &restState,
             int face,
             Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
-            Eigen::Matrix<double, 9, 9>* hessian) const = 0;
+            Eigen::Matrix<double, 9, 9>* hessian, // if projType is HessianProjectType::kStrainSpace and supportsStrainSpaceProjection(), positive semidefinite
+            HessianProjectType projType = HessianProjectType::kNone) const = 0;
 
         virtual double bendingEnergy(
             const MeshConnectivity& mesh,
-            const Eigen::MatrixXd& curPos,
-            const Eigen::VectorXd& extraDOFs,
+            const PositionsRef& curPos,
+            const EdgeDOFsRef& extraDOFs,
             const RestState &restState,
             int face,
             Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
-            Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian) const = 0;
+            Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+            const typename SFF::GeometryCache* geometryCache = NULL) const = 0; // optional, see SFF::computeGeometryCache
+
+        /*
+         * Whether stretchingEnergy builds a positive semidefinite Hessian itself when passed
+         * HessianProjectType::kStrainSpace (otherwise the element Hessian is projected by the caller).
+         */
+        virtual bool supportsStrainSpaceProjection() const { return false; }
+
+        /*
+         * Stretching plus bending energy of one face, for assemblies that request both terms. derivative is laid out like the
+         * bending derivative, and receives the derivative of the sum (the stretching derivative is over the face vertices, its
+         * first 9 entries). The Hessians of the two terms are returned separately, as by stretchingEnergy and bendingEnergy,
+         * so that they can be projected separately. The default calls both kernels; materials whose bending energy also
+         * depends on the first fundamental form (of the built-in ones, only NeoHookeanMaterial) override it to compute the
+         * work shared by both terms once.
+         */
+        virtual double stretchingAndBendingEnergy(
+            const MeshConnectivity& mesh,
+            const PositionsRef& curPos,
+            const EdgeDOFsRef& extraDOFs,
+            const RestState& restState,
+            int face,
+            Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative,
+            Eigen::Matrix<double, 9, 9>* stretchingHessian,
+            Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* bendingHessian,
+            HessianProjectType projType = HessianProjectType::kNone,
+            const typename SFF::GeometryCache* geometryCache = NULL) const
+        {
+            Eigen::Matrix<double, 1, 9> stretchingDerivative;
+            double result = stretchingEnergy(mesh, curPos, restState, face, derivative ? &stretchingDerivative : NULL, stretchingHessian, projType);
+            result += bendingEnergy(mesh, curPos, extraDOFs, restState, face, derivative, bendingHessian, geometryCache);
+            if (derivative)
+                derivative->template head<9>() += stretchingDerivative;
+            return result;
+        }
+
+        /*
+         * Energy-only evaluation of a batch of faces, used by the assembly whenever neither the derivative nor the Hessian
+         * is requested (e.g. in line searches, and by elasticEnergyPerElement): energies[i] is set to the stretching
+         * (bending) energy of face faces[i]. The default evaluates the faces one by one; materials can override these
+         * with kernels that gather the batch into arrays and evaluate it in vectorizable loops.
+         */
+        virtual void stretchingEnergies(
+            const MeshConnectivity& mesh,
+            const PositionsRef& curPos,
+            const RestState& restState,
+            int nfaces,
+            const int* faces,
+            double* energies) const
+        {
+            for (int i = 0; i < nfaces; i++)
+                energies[i] = stretchingEnergy(mesh, curPos, restState, faces[i], NULL, NULL);
+        }
+
+        virtual void bendingEnergies(
+            const MeshConnectivity& mesh,
+            const PositionsRef& curPos,
+            const EdgeDOFsRef& extraDOFs,
+            const RestState& restState,
+            int nfaces,
+            const int* faces,
+            double* energies,
+            const typename SFF::GeometryCache* geometryCache = NULL) const
+        {
+            for (int i = 0; i < nfaces; i++)
+                energies[i] = bendingEnergy(mesh, curPos, extraDOFs, restState, faces[i], NULL, NULL, geometryCache);
+        }
     };
 };
 
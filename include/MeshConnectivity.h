@@ -2,14 +2,51 @@
 #define MESHCONNECTIVITY_H
 
 #include <Eigen/Core>
+#include <vector>
+
+#include "types.h"
 
 namespace LibShell {
 
+    /*
+     * Partition of the faces of a mesh into colors, stored as a list of faces sorted by color: the faces of color c are
+     * faces[colorOffsets[c]] .. faces[colorOffsets[c + 1] - 1].
+     */
+    struct FaceColoring
+    {
+        std::vector<int> faces;
+        std::vector<int> colorOffsets;
+
+        int nColors() const { return colorOffsets.empty() ? 0 : (int)colorOffsets.size() - 1; }
+    };
+
+    /*
+     * Everything the stretching and bending stencils of a face read from the connectivity, packed into one cache line so
+     * that a face's stencil is resolved with a single load instead of lookups into several column-major tables. Entry j
+     * of the per-edge arrays refers to edge j of the face, the one opposite vertices[j].
+     */
+    struct alignas(64) FaceStencil
+    {
+        int vertices[3];
+        int edges[3];                       // faceEdge(face, j)
+        int oppositeVertices[3];            // vertexOppositeFaceEdge(face, j), -1 on boundary edges
+        int oppositeFaces[3];               // the other face of edge j, -1 on boundary edges
+        unsigned char edgeOrientations[3];  // faceEdgeOrientation(face, j)
+        unsigned char boundaryMask;         // bit j is set if edge j is a boundary edge
+
+        bool isBoundaryEdge(int j) const { return (boundaryMask >> j) & 1; }
+    };
+
     class MeshConnectivity
     {
     public:
         MeshConnectivity();
-        MeshConnectivity(const Eigen::MatrixXi& F);
+        /*
+         * Builds the edges and adjacency of the mesh with faces F (|F| x 3 vertex indices). Edges are numbered in lexicographic
+         * order of their (smaller, larger) vertex pairs. The per-vertex and per-face work is split over ctx.numThreads threads;
+         * the result does not depend on the thread count.
+         */
+        MeshConnectivity(const Eigen::MatrixXi& F, const ExecutionContext& ctx = ExecutionContext());
 
         int nFaces() const { return (int)F.rows(); }
         int nEdges() const { return (int)EV.rows(); }
@@ -20,10 +57,19 @@ namespace LibShell {
         int edgeVertex(int edge, int vertidx) const { return EV(edge, vertidx); }
         int edgeFace(int edge, int faceidx) const { return EF(edge, faceidx); }
         int edgeOppositeVertex(int edge, int faceidx) const { return EOpp(edge, faceidx); }
-        int vertexOppositeFaceEdge(int face, int vertidx) const;
+        int vertexOppositeFaceEdge(int face, int vertidx) const { return stencils[face].oppositeVertices[vertidx]; }
+
+        const FaceStencil& faceStencil(int face) const { return stencils[face]; }
 
         const Eigen::MatrixXi& faces() const { return F; }
 
+        /*
+         * Greedily colors the faces so that no two faces of the same color share a vertex of their bending stencils (the face
+         * vertices and the three opposite vertices). Faces of one color then touch disjoint vertex and edge DOFs, and their
+         * derivative and Hessian contributions can be accumulated concurrently without synchronization.
+         */
+        void bendingStencilColoring(FaceColoring& coloring) const;
+
         //int oppositeFace(int face, int vertidx) const;
 
     private:
@@ -40,6 +86,7 @@ namespace LibShell {
         Eigen::MatrixXi EV;
         Eigen::MatrixXi EF;
         Eigen::MatrixXi EOpp;
+        std::vector<FaceStencil> stencils;
     };
 };
 
@@ -0,0 +1,114 @@
+#ifndef MESHREORDERING_H
+#define MESHREORDERING_H
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <vector>
+
+#include "MeshConnectivity.h"
+#include "RestState.h"
+
+namespace LibShell {
+
+    // Ordering of the vertices computed by MeshReordering
+    enum class ReorderingMethod
+    {
+        kReverseCuthillMcKee, // reverse Cuthill-McKee ordering of the vertex adjacency graph: small Hessian bandwidth
+        kMorton               // vertices sorted along a Morton (Z-order) curve through their positions
+    };
+
+    /*
+     * Renumbering of the vertices, faces and edges of a mesh for memory locality. Meshes loaded from files or produced
+     * by triangulators come with arbitrary vertex and face orders, so that the faces processed one after the other by
+     * the assembly read and write positions and derivative entries scattered over the whole mesh. After reordering,
+     * neighboring faces touch nearby vertices, edges and DOFs.
+     *
+     * Vertices are ordered by the chosen method, and faces by the smallest new index of their vertices. Every face
+     * keeps its vertices in the same cyclic order, so the per-face rest state (whose fundamental forms are expressed in
+     * the barycentric coordinates of the face) only needs to be permuted. Edges are renumbered by the reordered
+     * MeshConnectivity. Edge DOFs are taken to be oriented from the smaller to the larger vertex index of their edge, as in
+     * the midedge angle formulations, and are negated on the edges whose direction the renumbering reverses.
+     *
+     * The reorder* functions map data of the original mesh to the reordered one, the restore* functions map results
+     * computed on the reordered mesh back to the original order.
+     */
+    class MeshReordering
+    {
+    public:
+        MeshReordering();
+        /*
+         * Reorders the mesh with vertex positions V (|V| x 3; only read by kMorton). Vertices not referenced by any face
+         * are kept, after the referenced ones.
+         */
+        MeshReordering(const MeshConnectivity& mesh, const Eigen::MatrixXd& V,
+            ReorderingMethod method = ReorderingMethod::kReverseCuthillMcKee);
+
+        int nVertices() const { return (int)vertexOrder.size(); }
+        int nFaces() const { return (int)faceOrder.size(); }
+        int nEdges() const { return (int)edgeOrder.size(); }
+
+        // Connectivity of the reordered mesh
+        const MeshConnectivity& reorderedMesh() const { return mesh; }
+
+        int originalVertex(int vertex) const { return vertexOrder[vertex]; }
+        int originalFace(int face) const { return faceOrder[face]; }
+        int originalEdge(int edge) const { return edgeOrder[edge]; }
+        int reorderedVertex(int vertex) const { return vertexIndex[vertex]; }
+        int reorderedFace(int face) const { return faceIndex[face]; }
+        int reorderedEdge(int edge) const { return edgeIndex[edge]; }
+        // Whether the reordered edge runs between the same two vertices in the opposite direction as the original one
+        bool isEdgeFlipped(int edge) const { return edgeFlipped[edge]; }
+
+        // Rows of per-vertex data, e.g. positions (|V| x k)
+        void reorderVertices(const Eigen::MatrixXd& values, Eigen::MatrixXd& reordered) const;
+        void restoreVertices(const Eigen::MatrixXd& reordered, Eigen::MatrixXd& values) const;
+
+        // Per-face data, e.g. the thicknesses or fundamental forms of a rest state
+        template <class T> void reorderFaces(const std::vector<T>& values, std::vector<T>& reordered) const
+        {
+            reordered.resize(values.size());
+            for (int i = 0; i < (int)faceOrder.size(); i++)
+                reordered[i] = values[faceOrder[i]];
+        }
+        template <class T> void restoreFaces(const std::vector<T>& reordered, std::vector<T>& values) const
+        {
+            values.resize(reordered.size());
+            for (int i = 0; i < (int)faceOrder.size(); i++)
+                values[faceOrder[i]] = reordered[i];
+        }
+
+        void reorderRestState(const MonolayerRestState& restState, MonolayerRestState& reordered) const;
+        void reorderRestState(const BilayerRestState& restState, BilayerRestState& reordered) const;
+
+        // Edge DOFs (numExtraDOFs per edge, |E| numExtraDOFs entries)
+        void reorderEdgeDOFs(const Eigen::VectorXd& edgeDOFs, int numExtraDOFs, Eigen::VectorXd& reordered) const;
+        void restoreEdgeDOFs(const Eigen::VectorXd& reordered, int numExtraDOFs, Eigen::VectorXd& edgeDOFs) const;
+
+        /*
+         * Full DOF vectors, laid out as in ElasticShell::elasticEnergy (3|V| vertex DOFs, then the edge DOFs), e.g. the
+         * derivative of the energy or a solver step.
+         */
+        void reorderDOFs(const Eigen::VectorXd& dofs, int numExtraDOFs, Eigen::VectorXd& reordered) const;
+        void restoreDOFs(const Eigen::VectorXd& reordered, int numExtraDOFs, Eigen::VectorXd& dofs) const;
+
+        /*
+         * Signed permutation matrix P with dofs = P * reordered for the full DOF vectors. A Hessian H computed on the
+         * reordered mesh is P H P^T in the original order (for HessianStorage::kFull; the permutation does not preserve
+         * triangles).
+         */
+        Eigen::SparseMatrix<double> dofPermutation(int numExtraDOFs) const;
+        void restoreHessian(const Eigen::SparseMatrix<double>& reordered, int numExtraDOFs, Eigen::SparseMatrix<double>& hessian) const;
+
+    private:
+        MeshConnectivity mesh;
+        std::vector<int> vertexOrder; // original index of each reordered vertex
+        std::vector<int> faceOrder;
+        std::vector<int> edgeOrder;
+        std::vector<int> vertexIndex; // reordered index of each original vertex
+        std::vector<int> faceIndex;
+        std::vector<int> edgeIndex;
+        std::vector<char> edgeFlipped;
+    };
+};
+
+#endif
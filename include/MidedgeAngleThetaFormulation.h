@@ -2,7 +2,10 @@
 #define MIDEDGEANGLETHETAFORMULATION_H
 
 #include <Eigen/Core>
+#include <array>
 #include <vector>
+#include "SecondFundamentalFormCache.h"
+#include "types.h"
 
 namespace LibShell {
 
@@ -17,19 +20,30 @@ class MidedgeAngleThetaFormulation {
 public:
     constexpr static int numExtraDOFs = 1;
 
+    // Geometry shared between neighboring faces, see SecondFundamentalFormCache.h
+    typedef EdgeThetaCache GeometryCache;
+
     static void initializeExtraDOFs(Eigen::VectorXd& extraDOFs,
                                     const MeshConnectivity& mesh,
                                     const Eigen::MatrixXd& curPos);
 
+    /*
+     * Fills cache with the shared geometry of the configuration curPos, with its derivatives (if derivatives or hessians)
+     * and Hessians (if hessians), in parallel over ctx.numThreads threads.
+     */
+    static void computeGeometryCache(const MeshConnectivity& mesh, const PositionsRef& curPos, bool derivatives, bool hessians,
+        GeometryCache& cache, const ExecutionContext& ctx = ExecutionContext());
+
     static Eigen::Matrix2d secondFundamentalForm(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const Eigen::VectorXd& extraDOFs,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
         int face,
         Eigen::Matrix<double, 4, 18 + 3 * numExtraDOFs>*
             derivative,  // F(face, i), then the three vertices opposite F(face,i), then the thetas on
                          // oppositeEdge(face,i)
-        std::vector<Eigen::Matrix<double, 18 + 3 * numExtraDOFs, 18 + 3 * numExtraDOFs>>* hessian);
+        std::array<Eigen::Matrix<double, 18 + 3 * numExtraDOFs, 18 + 3 * numExtraDOFs>, 4>* hessian,
+        const GeometryCache* cache = NULL); // if not NULL, computed by computeGeometryCache from curPos (with derivatives/Hessians as needed)
 };
 };  // namespace LibShell
 
@@ -2,7 +2,10 @@
 #define MIDEDGEAVERAGEFORMULATION_H
 
 #include <Eigen/Core>
+#include <array>
 #include <vector>
+#include "SecondFundamentalFormCache.h"
+#include "types.h"
 
 namespace LibShell {
 
@@ -13,15 +16,22 @@ namespace LibShell {
     public:
         constexpr static int numExtraDOFs = 0;
 
+        // Face normals, shared with the neighboring faces (see SecondFundamentalFormCache.h)
+        typedef FaceNormalCache GeometryCache;
+
         static void initializeExtraDOFs(Eigen::VectorXd& extraDOFs, const MeshConnectivity& mesh, const Eigen::MatrixXd& curPos);
 
+        static void computeGeometryCache(const MeshConnectivity& mesh, const PositionsRef& curPos, bool derivatives, bool hessians,
+            GeometryCache& cache, const ExecutionContext& ctx = ExecutionContext());
+
         static Eigen::Matrix2d secondFundamentalForm(
             const MeshConnectivity& mesh,
-            const Eigen::MatrixXd& curPos,
-            const Eigen::VectorXd& extraDOFs,
+            const PositionsRef& curPos,
+            const EdgeDOFsRef& extraDOFs,
             int face,
             Eigen::Matrix<double, 4, 18>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the thetas on oppositeEdge(face,i)
-            std::vector<Eigen::Matrix<double, 18, 18> >* hessian);
+            std::array<Eigen::Matrix<double, 18, 18>, 4>* hessian,
+            const GeometryCache* cache = NULL); // if not NULL, computed by computeGeometryCache from curPos (with derivatives/Hessians as needed)
     };
 };
 
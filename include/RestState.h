@@ -1,6 +1,10 @@
 #ifndef RESTSTATE_H
 #define RESTSTATE_H
 
+#include <Eigen/Core>
+#include <limits>
+#include <vector>
+
 namespace LibShell {
 
     enum class RestStateType
@@ -14,6 +18,34 @@ namespace LibShell {
     {
     public:
         virtual RestStateType type() const { return RestStateType::RST_NONE; }
+
+        /*
+         * Brings the cached per-face data derived from the rest state (if any) up to date with the current rest state
+         * data. Call it after setting up or changing the rest state, before evaluating energies on it; the energy
+         * functions never call it themselves, and only read the rest state, so that concurrent evaluations on one rest
+         * state are safe. It must not run concurrently with any evaluation on the same rest state.
+         */
+        virtual void updateCache() {}
+    };
+
+    /*
+     * Per-face quantities derived from the rest state of a monolayer, which the material models would otherwise
+     * recompute at every evaluation.
+     */
+    struct RestFaceData
+    {
+        Eigen::Matrix2d abarinv;    // inverse of abar
+        Eigen::Matrix2d abaradj;    // adjugate of abar
+        double abardet;             // det(abar)
+        double dA;                  // rest area of the face, 0.5 sqrt(det(abar))
+        double bendingCoeff;        // thickness^3 / 12
+
+        // the rest data these were computed from, to detect changes (NaN until computed, so never current)
+        Eigen::Matrix2d abar;
+        double thickness = std::numeric_limits<double>::quiet_NaN();
+
+        void compute(const Eigen::Matrix2d& restAbar, double restThickness);
+        bool isCurrent(const Eigen::Matrix2d& restAbar, double restThickness) const { return restThickness == thickness && restAbar == abar; }
     };
 
     /* Encodes the rest state information for an elastic monolayer.
@@ -22,6 +54,11 @@ namespace LibShell {
                                 If you have explicit rest geometry, you can compute these using the *FundamentalForms functions. Alternatively you
                                 can set the forms directly (zero matrices for bbar if you want a flat rest state, for instance).
      * - lameAlpha, lameBeta    |F| x 1 list of Lame parameters      
+     *
+     * The inverses, determinants, etc. of abars and the powers of the thicknesses are cached by updateCache() (see
+     * faceData()), together with the abar and thickness they were computed from, so that changes to thicknesses or abars
+     * made since the last updateCache() are always picked up, at the cost of recomputing the changed faces' data on
+     * every access.
      */
     struct MonolayerRestState : public RestState
     {
@@ -33,6 +70,24 @@ namespace LibShell {
         std::vector<Eigen::Matrix2d> bbars;
         std::vector<double> lameAlpha;
         std::vector<double> lameBeta;
+
+        virtual void updateCache();
+
+        /*
+         * Derived data of the given face: the cached entry if it is up to date with abars[face] and thicknesses[face],
+         * otherwise (no updateCache() since the rest state changed) computed on the fly, without touching the cache.
+         */
+        RestFaceData faceData(int face) const
+        {
+            if (face < (int)cache.size() && cache[face].isCurrent(abars[face], thicknesses[face]))
+                return cache[face];
+            RestFaceData data;
+            data.compute(abars[face], thicknesses[face]);
+            return data;
+        }
+
+    private:
+        std::vector<RestFaceData> cache;
     };
 
     /*
@@ -46,6 +101,8 @@ namespace LibShell {
         virtual RestStateType type() const { return RestStateType::RST_BILAYER; }
 
         MonolayerRestState layers[2];
+
+        virtual void updateCache();
     };
 };
 
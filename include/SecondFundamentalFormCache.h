@@ -0,0 +1,79 @@
+#ifndef SECONDFUNDAMENTALFORMCACHE_H
+#define SECONDFUNDAMENTALFORMCACHE_H
+
+#include <Eigen/Core>
+#include <array>
+#include <vector>
+
+namespace LibShell {
+
+    /*
+     * Geometry shared between the second fundamental forms of neighboring faces. Each SFF discretization names the
+     * type it uses as SFF::GeometryCache, and fills it for a given configuration with SFF::computeGeometryCache, so
+     * that the shared quantities are computed once per configuration rather than once per face using them.
+     */
+
+    /*
+     * Used by the MidedgeAngle formulations: the dihedral angle of every edge (zero on the boundary), and optionally
+     * its derivative and Hessian with respect to the two edge vertices, then the two vertices opposite the edge. The
+     * Hessians are symmetric, so only their upper triangles are stored, row by row.
+     */
+    struct EdgeThetaCache
+    {
+        static constexpr int kHessianEntries = 78; // upper triangle of a 12 x 12 matrix
+
+        std::vector<double> thetas;
+        std::vector<Eigen::Matrix<double, 1, 12> > derivatives;                 // empty if not requested
+        std::vector<Eigen::Matrix<double, kHessianEntries, 1> > hessians;       // empty if not requested
+
+        // Whether the derivatives (resp. Hessians) were computed along with the angles
+        bool provides(bool derivative, bool hessian) const
+        {
+            return (!derivative || derivatives.size() == thetas.size()) && (!hessian || hessians.size() == thetas.size());
+        }
+
+        void setHessian(int edge, const Eigen::Matrix<double, 12, 12>& hess)
+        {
+            int k = 0;
+            for (int i = 0; i < 12; i++)
+                for (int j = i; j < 12; j++)
+                    hessians[edge][k++] = hess(i, j);
+        }
+
+        void hessian(int edge, Eigen::Matrix<double, 12, 12>& hess) const
+        {
+            int k = 0;
+            for (int i = 0; i < 12; i++)
+            {
+                for (int j = i; j < 12; j++)
+                {
+                    hess(i, j) = hessians[edge][k];
+                    hess(j, i) = hessians[edge][k];
+                    k++;
+                }
+            }
+        }
+    };
+
+    /*
+     * Used by MidedgeAverageFormulation: the (unnormalized) normal of every face, and optionally its derivative with
+     * respect to the face vertices in their original order (startidx 0). Derivatives for other startidx are column
+     * block permutations of these. The Hessian of the normal does not depend on the face, the vertex positions, or
+     * startidx, so it is stored only once.
+     */
+    struct FaceNormalCache
+    {
+        std::vector<Eigen::Vector3d> normals;
+        std::vector<Eigen::Matrix<double, 3, 9> > derivatives;      // empty if not requested
+        std::array<Eigen::Matrix<double, 9, 9>, 3> hessian;         // only set if requested
+        bool hasHessian = false;
+
+        // Whether the derivatives (resp. Hessian) were computed along with the normals
+        bool provides(bool derivative, bool hessian) const
+        {
+            return (!derivative || derivatives.size() == normals.size()) && (!hessian || hasHessian);
+        }
+    };
+};
+
+#endif
@@ -1,12 +1,59 @@
 #pragma once
 
+#include <Eigen/Core>
+
 namespace LibShell
 {
+    struct FaceColoring;
+    class AssemblyWorkspace;
+
     // Define the type of the Hessian projection
     enum class HessianProjectType
     {
         kNone,    // no projection
         kMaxZero, // project negative eigenvalues to zero
-        kAbs      // project negative eigenvalues to their absolute values
+        kAbs,     // project negative eigenvalues to their absolute values
+        kStrainSpace // like kMaxZero, but materials that support it (StVK, NeoHookean, TensionFieldStVK) build a positive
+                     // semidefinite stretching Hessian directly, by projecting in the space of first fundamental forms;
+                     // for the others (BilayerStVK) it is the same as kMaxZero
     };
-} // namespace LibShell
\ No newline at end of file
+
+    // Which part of the (symmetric) Hessian to output
+    enum class HessianStorage
+    {
+        kFull,  // all entries
+        kLower, // only entries with row >= col, e.g. for Eigen::SimplicialLLT (which reads the lower triangle by default)
+        kUpper  // only entries with row <= col
+    };
+
+    // Controls how the per-face work of the energy assembly is executed
+    struct ExecutionContext
+    {
+        ExecutionContext(int numThreads = 1, const FaceColoring* coloring = NULL, AssemblyWorkspace* workspace = NULL)
+            : numThreads(numThreads), coloring(coloring), workspace(workspace) {}
+
+        // Number of worker threads. Values <= 0 use all hardware threads. Results are deterministic for a fixed
+        // thread count, but can differ in the last bits between different thread counts (the summation order changes).
+        int numThreads;
+
+        // Optional face coloring (see MeshConnectivity::bendingStencilColoring) of the mesh being assembled. If set, the faces are
+        // processed one color at a time, and the threads write the derivative and Hessian directly into the outputs instead of
+        // into per-thread buffers that are then summed. Triplet output still uses per-thread buffers. The coloring must be
+        // up to date with the mesh; it is ignored if its face count does not match.
+        const FaceColoring* coloring;
+
+        // Optional scratch memory (see AssemblyWorkspace.h) reused across calls instead of allocating per-thread buffers
+        // and geometry caches on every call. It may serve only one call at a time.
+        AssemblyWorkspace* workspace;
+    };
+
+    /*
+     * Read-only |V| x 3 view of the vertex positions, as taken by the per-face energy kernels. Binds without a copy both to an
+     * Eigen::MatrixXd and to positions stored interleaved (x0, y0, z0, x1, ...) in a flat vector, in which case each vertex
+     * is read from three contiguous doubles.
+     */
+    typedef Eigen::Ref<const Eigen::MatrixXd, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> > PositionsRef;
+
+    // Read-only view of the per-edge degrees of freedom; binds without a copy to a VectorXd or a segment of one
+    typedef Eigen::Ref<const Eigen::VectorXd> EdgeDOFsRef;
+} // namespace LibShell
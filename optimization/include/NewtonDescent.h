@@ -5,6 +5,8 @@
 #include <Eigen/Sparse>
 #include <iostream>
 
+#include "PCG.h"
+
 namespace OptSolver {
 ///
 /// Newton solver with line search
@@ -37,6 +39,42 @@ void NewtonSolver(
     bool display_info = false,
     bool is_swap = false);
 
+///
+/// Newton solver with line search, whose Newton systems are solved inexactly with preconditioned
+/// conjugate gradient (PCG) instead of a sparse Cholesky factorization. The hessian is only accessed
+/// through its products with vectors, so the objective can keep it in any format, e.g. a
+/// LibShell::BlockSparseMatrix, or not form it at all
+///
+/// @param[in] obj_func                 the objective function, which takes x as input and returns the
+///                                     function value, gradient, and (through the LinearOperator, whose
+///                                     callbacks must stay valid until the next call) the hessian, together
+///                                     with a boolean indicating whether the hessian should be PSD projected
+/// @param[in] find_max_step            the function to find the maximum step size, which takes x, direction,
+///                                     and returns the maximum step size
+/// @param[in] x0                       the initial guess
+/// @param[in] num_iter                 the maximum number of iterations
+/// @param[in] grad_tol                 the termination tolerance of the gradient
+/// @param[in] x_tol                    the tolerance of the solution
+/// @param[in] f_tol                    the tolerance of the function value
+/// @param[in] is_proj_hess             whether to project the hessian matrix to PSD. Without projection, PCG stops
+///                                     at directions of negative curvature (truncated Newton)
+/// @param[in] display_info             whether to display the information
+/// @param[in] cg_max_iter              the maximum number of PCG iterations per Newton step
+/// @param[in] cg_tol                   the PCG tolerance, relative to the gradient norm
+///
+void NewtonPCGSolver(
+    std::function<double(const Eigen::VectorXd &, Eigen::VectorXd *, LinearOperator *, bool)> obj_func,
+    std::function<double(const Eigen::VectorXd &, const Eigen::VectorXd &)> find_max_step,
+    Eigen::VectorXd &x0,
+    int num_iter = 1000,
+    double grad_tol = 1e-6,
+    double x_tol = 0,
+    double f_tol = 0,
+    bool is_proj_hess = true,
+    bool display_info = false,
+    int cg_max_iter = 1000,
+    double cg_tol = 1e-4);
+
 ///
 /// Test the function gradient and hessian
 ///
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <functional>
+
+namespace OptSolver {
+///
+/// Symmetric positive (semi-)definite linear operator, given through its action on vectors, so that
+/// the matrix can be stored in any format (e.g. LibShell::BlockSparseMatrix) or not stored at all
+///
+struct LinearOperator {
+    /// y = A x
+    std::function<void(const Eigen::VectorXd &, Eigen::VectorXd &)> apply;
+    /// z = M^{-1} r for a preconditioner M of A; the identity if empty
+    std::function<void(const Eigen::VectorXd &, Eigen::VectorXd &)> precondition;
+};
+
+///
+/// Preconditioned conjugate gradient for A x = b
+///
+/// @param[in] A            the (regularized by reg * I) matrix and its preconditioner
+/// @param[in] b            the right-hand side
+/// @param[in, out] x       the initial guess (resized and zeroed if its size does not match b), then the solution
+/// @param[in] max_iter     the maximum number of iterations
+/// @param[in] rel_tol      the termination tolerance, relative to the norm of b, of the residual norm
+/// @param[in] reg          the regularization added to the diagonal of A
+///
+/// @return the number of iterations, or -1 if a direction of nonpositive curvature was found (x is then the last
+///         iterate, or b if this happened in the first iteration, so that it is still a descent direction for Newton)
+///
+int PCGSolve(
+    const LinearOperator &A,
+    const Eigen::VectorXd &b,
+    Eigen::VectorXd &x,
+    int max_iter = 1000,
+    double rel_tol = 1e-6,
+    double reg = 0);
+} // namespace OptSolver
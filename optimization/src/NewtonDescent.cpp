@@ -196,6 +196,131 @@ void NewtonSolver(
     }
 }
 
+// Newton solver with line search and PCG linear solves
+void NewtonPCGSolver(
+    std::function<double(const Eigen::VectorXd &, Eigen::VectorXd *, LinearOperator *, bool)> obj_func,
+    std::function<double(const Eigen::VectorXd &, const Eigen::VectorXd &)> find_max_step,
+    Eigen::VectorXd &x0,
+    int num_iter,
+    double grad_tol,
+    double x_tol,
+    double f_tol,
+    bool is_proj_hess,
+    bool display_info,
+    int cg_max_iter,
+    double cg_tol) {
+    const int DIM = x0.rows();
+    Eigen::VectorXd grad = Eigen::VectorXd::Zero(DIM);
+    LinearOperator hessian;
+
+    Eigen::VectorXd neg_grad, delta_x;
+    double max_step_size = 1.0;
+    double reg = 1e-8;
+
+    // the line search only needs function values
+    auto line_search_func = [&](const Eigen::VectorXd &x, Eigen::VectorXd *g, Eigen::SparseMatrix<double> *, bool is_proj) {
+        return obj_func(x, g, nullptr, is_proj);
+    };
+
+    Timer<std::chrono::high_resolution_clock> total_timer;
+    double total_assembling_time = 0;
+    double total_solving_time = 0;
+    double total_linesearch_time = 0;
+    int total_cg_iters = 0;
+
+    total_timer.start();
+
+    double f = obj_func(x0, &grad, nullptr, false);
+    if (grad.norm() < grad_tol) {
+        std::cout << "initial gradient norm = " << grad.norm() << ", is smaller than the gradient tolerance: " << grad_tol << ", return" << std::endl;
+        return;
+    }
+
+    int i = 0;
+    for (; i < num_iter; i++) {
+        if (display_info) {
+            std::cout << "\niteration: " << i << std::endl;
+        }
+
+        Timer<std::chrono::high_resolution_clock> local_timer;
+        local_timer.start();
+        f = obj_func(x0, &grad, &hessian, is_proj_hess);
+        local_timer.stop();
+        total_assembling_time += local_timer.elapsed<std::chrono::milliseconds>() * 1e-3;
+
+        local_timer.start();
+        neg_grad = -grad;
+        delta_x.setZero(DIM);
+        int cg_iters = PCGSolve(hessian, neg_grad, delta_x, cg_max_iter, cg_tol, reg);
+        if (cg_iters == -1 && display_info) {
+            std::cout << "PCG hit a direction of nonpositive curvature, using the last iterate" << std::endl;
+        }
+        total_cg_iters += std::max(cg_iters, 0);
+        local_timer.stop();
+        total_solving_time += local_timer.elapsed<std::chrono::milliseconds>() * 1e-3;
+
+        if (grad.dot(delta_x) >= 0) {
+            // not a descent direction, fall back to gradient descent
+            delta_x = neg_grad;
+        }
+
+        max_step_size = find_max_step(x0, delta_x);
+
+        local_timer.start();
+        double rate = BacktrackingArmijo(x0, grad, delta_x, line_search_func, max_step_size);
+        local_timer.stop();
+        total_linesearch_time += local_timer.elapsed<std::chrono::milliseconds>() * 1e-3;
+
+        x0 = x0 + rate * delta_x;
+
+        double fnew = obj_func(x0, &grad, nullptr, is_proj_hess);
+        if (display_info) {
+            std::cout << "line search rate : " << rate << ", PCG iterations : " << cg_iters << std::endl;
+            std::cout << "f_old: " << f << ", f_new: " << fnew << ", grad norm: " << grad.norm()
+                      << ", delta x: " << rate * delta_x.norm() << ", delta_f: " << f - fnew << std::endl;
+            std::cout << "timing info (in total seconds): " << std::endl;
+            std::cout << "assembling took: " << total_assembling_time << ", PCG solver took: " << total_solving_time
+                      << ", line search took: " << total_linesearch_time << std::endl;
+        }
+
+        // Termination conditions
+        if (rate < 1e-8) {
+            std::cout << "terminate with small line search rate (<1e-8): L2-norm = " << grad.norm() << std::endl;
+            break;
+        }
+
+        if (grad.norm() < grad_tol) {
+            std::cout << "terminate with gradient L2-norm = " << grad.norm() << std::endl;
+            break;
+        }
+
+        if (rate * delta_x.norm() < x_tol) {
+            std::cout << "terminate with small variable change: L2-norm = " << grad.norm() << std::endl;
+            break;
+        }
+
+        if (f - fnew < f_tol) {
+            std::cout << "terminate with small energy change: L2-norm = " << grad.norm() << std::endl;
+            break;
+        }
+    }
+
+    if (i >= num_iter) {
+        std::cout << "terminate with reaching the maximum iteration, with gradient L2-norm = " << grad.norm() << std::endl;
+    }
+
+    f = obj_func(x0, &grad, nullptr, false);
+    std::cout << "end up with energy: " << f << ", gradient: " << grad.norm() << std::endl;
+
+    total_timer.stop();
+    if (display_info) {
+        std::cout << "total time costed (s): " << total_timer.elapsed<std::chrono::milliseconds>() * 1e-3
+                  << ", within that, assembling took: " << total_assembling_time
+                  << ", PCG solver took: " << total_solving_time << " (" << total_cg_iters << " iterations)"
+                  << ", line search took: " << total_linesearch_time << std::endl;
+    }
+}
+
 // Test the function gradient and hessian
 void TestFuncGradHessian(
     std::function<double(const Eigen::VectorXd &, Eigen::VectorXd *, Eigen::SparseMatrix<double> *, bool)> obj_Func,
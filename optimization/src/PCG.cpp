@@ -0,0 +1,70 @@
+#include "../include/PCG.h"
+
+#include <cmath>
+
+namespace OptSolver {
+// Preconditioned conjugate gradient
+int PCGSolve(
+    const LinearOperator &A,
+    const Eigen::VectorXd &b,
+    Eigen::VectorXd &x,
+    int max_iter,
+    double rel_tol,
+    double reg) {
+    const int DIM = b.rows();
+    if (x.rows() != DIM) {
+        x.setZero(DIM);
+    }
+
+    auto apply = [&](const Eigen::VectorXd &v, Eigen::VectorXd &Av) {
+        A.apply(v, Av);
+        if (reg != 0) {
+            Av += reg * v;
+        }
+    };
+    auto precondition = [&](const Eigen::VectorXd &r, Eigen::VectorXd &z) {
+        if (A.precondition) {
+            A.precondition(r, z);
+        } else {
+            z = r;
+        }
+    };
+
+    Eigen::VectorXd r, z, p, Ap;
+    apply(x, Ap);
+    r = b - Ap;
+    double tol = rel_tol * b.norm();
+    if (r.norm() <= tol) {
+        return 0;
+    }
+
+    precondition(r, z);
+    p = z;
+    double rz = r.dot(z);
+
+    for (int i = 0; i < max_iter; i++) {
+        apply(p, Ap);
+        double pAp = p.dot(Ap);
+        if (pAp <= 0) {
+            // nonpositive curvature: the system is not positive definite
+            if (i == 0) {
+                x = b;
+            }
+            return -1;
+        }
+
+        double alpha = rz / pAp;
+        x += alpha * p;
+        r -= alpha * Ap;
+        if (r.norm() <= tol) {
+            return i + 1;
+        }
+
+        precondition(r, z);
+        double rz_new = r.dot(z);
+        p = z + (rz_new / rz) * p;
+        rz = rz_new;
+    }
+    return max_iter;
+}
+} // namespace OptSolver
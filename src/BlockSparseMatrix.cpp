@@ -0,0 +1,234 @@
+#include "../include/BlockSparseMatrix.h"
+#include "../include/MeshConnectivity.h"
+
+#include "ParallelFor.h"
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <vector>
+
+namespace LibShell {
+
+    // block rows of the slots of a face's bending stencil (see faceBlockOffsets), -1 for missing ones
+    static void stencilBlocks(const MeshConnectivity& mesh, int nverts, int nedgedofs, int face, int* blocks)
+    {
+        const FaceStencil& stencil = mesh.faceStencil(face);
+        for (int j = 0; j < 3; j++)
+        {
+            blocks[j] = stencil.vertices[j];
+            blocks[3 + j] = stencil.oppositeVertices[j];
+            blocks[6 + j] = nedgedofs > 0 ? nverts + stencil.edges[j] : -1;
+        }
+    }
+
+    BlockSparseMatrix::BlockSparseMatrix() : nfaces(0), nverts(0), nedgedofs(0), ndofs(0), rowOffsets(1, 0)
+    {
+    }
+
+    BlockSparseMatrix::BlockSparseMatrix(const MeshConnectivity& mesh, int nverts, int numExtraDOFs)
+        : nfaces(mesh.nFaces()), nverts(nverts), nedgedofs(numExtraDOFs), ndofs(3 * nverts + numExtraDOFs * mesh.nEdges())
+    {
+        int nblockrows = nverts + (nedgedofs > 0 ? mesh.nEdges() : 0);
+
+        std::vector<std::vector<int> > rowBlocks(nblockrows);
+        int blocks[9];
+        for (int i = 0; i < nfaces; i++)
+        {
+            stencilBlocks(mesh, nverts, nedgedofs, i, blocks);
+            for (int j = 0; j < 9; j++)
+            {
+                if (blocks[j] == -1)
+                    continue;
+                for (int k = 0; k < 9; k++)
+                {
+                    if (blocks[k] != -1)
+                        rowBlocks[blocks[j]].push_back(blocks[k]);
+                }
+            }
+        }
+
+        rowOffsets.resize(nblockrows + 1);
+        rowOffsets[0] = 0;
+        for (int i = 0; i < nblockrows; i++)
+        {
+            std::sort(rowBlocks[i].begin(), rowBlocks[i].end());
+            rowBlocks[i].erase(std::unique(rowBlocks[i].begin(), rowBlocks[i].end()), rowBlocks[i].end());
+            rowOffsets[i + 1] = rowOffsets[i] + (int)rowBlocks[i].size();
+        }
+
+        blockCols.resize(rowOffsets[nblockrows]);
+        blockValueOffsets.resize(rowOffsets[nblockrows]);
+        diagonalBlocks.assign(nblockrows, -1);
+        int nvalues = 0;
+        for (int i = 0; i < nblockrows; i++)
+        {
+            for (int j = 0; j < (int)rowBlocks[i].size(); j++)
+            {
+                int col = rowBlocks[i][j];
+                blockCols[rowOffsets[i] + j] = col;
+                blockValueOffsets[rowOffsets[i] + j] = nvalues;
+                if (col == i)
+                    diagonalBlocks[i] = rowOffsets[i] + j;
+                nvalues += blockSize(i) * blockSize(col);
+            }
+        }
+        values.resize(nvalues, 0.0);
+
+        faceOffsets.resize((size_t)nfaces * 81);
+        for (int i = 0; i < nfaces; i++)
+        {
+            stencilBlocks(mesh, nverts, nedgedofs, i, blocks);
+            int* faceoffs = faceOffsets.data() + (size_t)i * 81;
+            for (int j = 0; j < 9; j++)
+            {
+                for (int k = 0; k < 9; k++)
+                {
+                    if (blocks[j] == -1 || blocks[k] == -1)
+                    {
+                        faceoffs[9 * j + k] = -1;
+                        continue;
+                    }
+                    const int* begin = blockCols.data() + rowOffsets[blocks[j]];
+                    const int* end = blockCols.data() + rowOffsets[blocks[j] + 1];
+                    int idx = (int)(std::lower_bound(begin, end, blocks[k]) - blockCols.data());
+                    faceoffs[9 * j + k] = blockValueOffsets[idx];
+                }
+            }
+        }
+    }
+
+    void BlockSparseMatrix::setZero()
+    {
+        std::fill(values.begin(), values.end(), 0.0);
+    }
+
+    void BlockSparseMatrix::multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y, const ExecutionContext& ctx) const
+    {
+        y.resize(ndofs);
+        int nblockrows = nBlockRows();
+        int nthreads = resolveNumThreads(ctx.numThreads, nblockrows);
+
+        // every block row writes only its own entries of y
+        parallelForChunks(nblockrows, nthreads, [&](int, int begin, int end)
+            {
+                for (int r = begin; r < end; r++)
+                {
+                    int rowsize = blockSize(r);
+                    int rowstart = blockStart(r);
+                    if (rowsize == 3)
+                    {
+                        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+                        for (int b = rowOffsets[r]; b < rowOffsets[r + 1]; b++)
+                        {
+                            int col = blockCols[b];
+                            const double* block = values.data() + blockValueOffsets[b];
+                            if (col < nverts)
+                                sum += Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor> >(block) * x.segment<3>(3 * col);
+                            else
+                                sum += Eigen::Map<const Eigen::Matrix<double, 3, Eigen::Dynamic, Eigen::RowMajor> >(block, 3, nedgedofs)
+                                * x.segment(blockStart(col), nedgedofs);
+                        }
+                        y.segment<3>(rowstart) = sum;
+                    }
+                    else
+                    {
+                        y.segment(rowstart, rowsize).setZero();
+                        for (int b = rowOffsets[r]; b < rowOffsets[r + 1]; b++)
+                        {
+                            int col = blockCols[b];
+                            int colsize = blockSize(col);
+                            const double* block = values.data() + blockValueOffsets[b];
+                            for (int i = 0; i < rowsize; i++)
+                            {
+                                for (int j = 0; j < colsize; j++)
+                                    y[rowstart + i] += block[i * colsize + j] * x[blockStart(col) + j];
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    void BlockSparseMatrix::toSparse(Eigen::SparseMatrix<double>& H) const
+    {
+        std::vector<Eigen::Triplet<double> > triplets;
+        triplets.reserve(values.size());
+        for (int r = 0; r < nBlockRows(); r++)
+        {
+            int rowsize = blockSize(r);
+            for (int b = rowOffsets[r]; b < rowOffsets[r + 1]; b++)
+            {
+                int col = blockCols[b];
+                int colsize = blockSize(col);
+                const double* block = values.data() + blockValueOffsets[b];
+                for (int i = 0; i < rowsize; i++)
+                {
+                    for (int j = 0; j < colsize; j++)
+                        triplets.push_back(Eigen::Triplet<double>(blockStart(r) + i, blockStart(col) + j, block[i * colsize + j]));
+                }
+            }
+        }
+        H.resize(ndofs, ndofs);
+        H.setFromTriplets(triplets.begin(), triplets.end());
+        H.makeCompressed();
+    }
+
+    void BlockSparseMatrix::invertDiagonalBlocks(std::vector<double>& inverses) const
+    {
+        int nblockrows = nBlockRows();
+        inverses.clear();
+        for (int r = 0; r < nblockrows; r++)
+        {
+            int size = blockSize(r);
+            Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> inverse(size, size);
+            if (diagonalBlocks[r] == -1)
+            {
+                // DOFs not touched by any face
+                inverse.setIdentity();
+                inverses.insert(inverses.end(), inverse.data(), inverse.data() + size * size);
+                continue;
+            }
+            Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > block(
+                values.data() + blockValueOffsets[diagonalBlocks[r]], size, size);
+
+            Eigen::FullPivLU<Eigen::MatrixXd> lu(block);
+            if (lu.isInvertible())
+            {
+                inverse = lu.inverse();
+            }
+            else
+            {
+                inverse.setZero();
+                for (int i = 0; i < size; i++)
+                    inverse(i, i) = block(i, i) != 0 ? 1.0 / block(i, i) : 1.0;
+            }
+            inverses.insert(inverses.end(), inverse.data(), inverse.data() + size * size);
+        }
+    }
+
+    void BlockSparseMatrix::multiplyBlockDiagonal(const std::vector<double>& blocks, const Eigen::VectorXd& x, Eigen::VectorXd& y) const
+    {
+        y.resize(ndofs);
+        const double* block = blocks.data();
+        for (int r = 0; r < nBlockRows(); r++)
+        {
+            int size = blockSize(r);
+            int start = blockStart(r);
+            if (size == 3)
+            {
+                y.segment<3>(start) = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor> >(block) * x.segment<3>(start);
+            }
+            else
+            {
+                for (int i = 0; i < size; i++)
+                {
+                    y[start + i] = 0;
+                    for (int j = 0; j < size; j++)
+                        y[start + i] += block[i * size + j] * x[start + j];
+                }
+            }
+            block += size * size;
+        }
+    }
+};
@@ -2,12 +2,17 @@
 #include "../include/MeshConnectivity.h"
 #include "../include/MaterialModel.h"
 #include "../include/RestState.h"
+#include "../include/HessianAssemblyPlan.h"
+#include "../include/BlockSparseMatrix.h"
+#include "../include/AssemblyWorkspace.h"
 #include "../include/MidedgeAngleSinFormulation.h"
 #include "../include/MidedgeAngleTanFormulation.h"
 #include "../include/MidedgeAverageFormulation.h"
 #include "../include/MidedgeAngleThetaFormulation.h"
 
 #include "GeometryDerivatives.h"
+#include "ElasticShellAssembly.h"
+#include "ParallelFor.h"
 
 #include <Eigen/Geometry>
 #include <Eigen/Dense>
@@ -20,36 +25,22 @@
 
 
 namespace LibShell {
-   template <class DerivedA>
-    void projSymMatrix(Eigen::MatrixBase<DerivedA>& A, const HessianProjectType& projType)
+    template <class SFF>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        std::vector<Eigen::Triplet<double> >* hessian,
+        const HessianProjectType projType,
+        const HessianStorage storage,
+        const ExecutionContext& ctx)
     {
-        // no projection
-        if (projType == HessianProjectType::kNone)
-        {
-            return;
-        }
-        Eigen::SelfAdjointEigenSolver<DerivedA> eigenSolver(A);
-        if (eigenSolver.eigenvalues()[0] >= 0) {
-            return;
-        }
-
-        using T = typename DerivedA::Scalar;
-        Eigen::Matrix<T, -1, 1> D = eigenSolver.eigenvalues();
-        for (int i = 0; i < A.rows(); ++i) {
-            if (D[i] < 0) {
-              if (projType == HessianProjectType::kMaxZero) {
-                D[i] = 0;
-              } else if (projType == HessianProjectType::kAbs) {
-                D[i] = -D[i];
-              } else {
-                std::cerr << "Unknown projection type, use Max(A, 0) instead!" << std::endl;
-                D[i] = 0;
-              }
-            } else {
-                break;
-            }
-        }
-        A = eigenSolver.eigenvectors() * D.asDiagonal() * eigenSolver.eigenvectors().transpose();
+        return elasticEnergy(mesh, curPos, extraDOFs, mat, restState,
+            EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
+                             derivative, hessian, projType, storage, ctx);
     }
 
     template <class SFF>
@@ -59,13 +50,67 @@ namespace LibShell {
         const Eigen::VectorXd& extraDOFs,
         const MaterialModel<SFF>& mat,
         const RestState& restState,
+        int whichTerms,
         Eigen::VectorXd* derivative, // positions, then thetas
         std::vector<Eigen::Triplet<double> >* hessian,
-        const HessianProjectType projType)
+        const HessianProjectType projType,
+        const HessianStorage storage,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyTriplets<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, hessian, projType, storage, ctx);
+    }
+
+
+    template <class SFF>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        const HessianAssemblyPlan& plan,
+        Eigen::SparseMatrix<double>* hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergy(mesh, curPos, extraDOFs, mat, restState,
+            EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
+            derivative, plan, hessian, projType, ctx);
+    }
+
+    template <class SFF>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        const HessianAssemblyPlan& plan,
+        Eigen::SparseMatrix<double>* hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyPlan<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, plan, hessian, projType, ctx);
+    }
+
+    template <class SFF>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        BlockSparseMatrix& hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
     {
         return elasticEnergy(mesh, curPos, extraDOFs, mat, restState,
             EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
-                             derivative, hessian, projType);
+            derivative, hessian, projType, ctx);
     }
 
     template <class SFF>
@@ -77,132 +122,147 @@ namespace LibShell {
         const RestState& restState,
         int whichTerms,
         Eigen::VectorXd* derivative, // positions, then thetas
+        BlockSparseMatrix& hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyBlocks<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, hessian, projType, ctx);
+    }
+
+
+    /*
+     * Number of vertices of a flat DOF vector (see the flat-DOF elasticEnergy overloads), or -1 if its size does not fit
+     * the mesh.
+     */
+    static int flatDOFsVertexCount(const MeshConnectivity& mesh, int numExtraDOFs, const Eigen::Ref<const Eigen::VectorXd>& dofs)
+    {
+        int nposdofs = (int)dofs.size() - numExtraDOFs * mesh.nEdges();
+        if (nposdofs < 0 || nposdofs % 3 != 0)
+            return -1;
+        return nposdofs / 3;
+    }
+
+    // the vertex positions at the start of a flat DOF vector, as a |V| x 3 matrix with rows 3 doubles apart
+    typedef Eigen::Map<const Eigen::MatrixXd, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> > FlatPositionsMap;
+
+    template <class SFF>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::Ref<const Eigen::VectorXd>& dofs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative,
         std::vector<Eigen::Triplet<double> >* hessian,
-        const HessianProjectType projType)
+        const HessianProjectType projType,
+        const HessianStorage storage,
+        const ExecutionContext& ctx)
     {
-        int nfaces = mesh.nFaces();
-        int nedges = mesh.nEdges();
-        int nverts = (int)curPos.rows();
+        int nverts = flatDOFsVertexCount(mesh, SFF::numExtraDOFs, dofs);
+        if (nverts == -1)
+            return std::numeric_limits<double>::infinity();
 
-        if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges)
-        {
+        PositionsRef curPos(FlatPositionsMap(dofs.data(), nverts, 3, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(1, 3)));
+        EdgeDOFsRef extraDOFs(dofs.tail(dofs.size() - 3 * nverts));
+        return elasticEnergyTriplets<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, hessian, projType, storage, ctx);
+    }
+
+    template <class SFF>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::Ref<const Eigen::VectorXd>& dofs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative,
+        const HessianAssemblyPlan& plan,
+        Eigen::SparseMatrix<double>* hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        int nverts = flatDOFsVertexCount(mesh, SFF::numExtraDOFs, dofs);
+        if (nverts == -1)
             return std::numeric_limits<double>::infinity();
-        }
 
-        if (derivative)
-        {
-            derivative->resize(3 * nverts + SFF::numExtraDOFs * nedges);
-            derivative->setZero();
-        }
-        if (hessian)
-        {
-            hessian->clear();
-        }
+        PositionsRef curPos(FlatPositionsMap(dofs.data(), nverts, 3, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(1, 3)));
+        EdgeDOFsRef extraDOFs(dofs.tail(dofs.size() - 3 * nverts));
+        return elasticEnergyPlan<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, plan, hessian, projType, ctx);
+    }
 
-        double result = 0;
+    template <class SFF>
+    double ElasticShell<SFF>::hessianVectorProduct(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        const Eigen::VectorXd& v,
+        Eigen::VectorXd& out,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return hessianVectorProduct(mesh, curPos, extraDOFs, mat, restState,
+            EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
+            v, out, projType, ctx);
+    }
 
-        // stretching terms
-        if (whichTerms & EnergyTerm::ET_STRETCHING)
-        {
-            for (int i = 0; i < nfaces; i++)
-            {
-                Eigen::Matrix<double, 1, 9> deriv;
-                Eigen::Matrix<double, 9, 9> hess;
-                result += mat.stretchingEnergy(mesh, curPos, restState, i, derivative ? &deriv : NULL, hessian ? &hess : NULL);
-                if (derivative)
-                {
-                    for (int j = 0; j < 3; j++)
-                        derivative->segment<3>(3 * mesh.faceVertex(i, j)) += deriv.segment<3>(3 * j);
-                }
-                if (hessian)
-                {
-                    projSymMatrix(hess, projType);
-                    for (int j = 0; j < 3; j++)
-                    {
-                        for (int k = 0; k < 3; k++)
-                        {
-                            for (int l = 0; l < 3; l++)
-                            {
-                                for (int m = 0; m < 3; m++)
-                                {
-                                    hessian->push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * mesh.faceVertex(i, k) + m, hess(3 * j + l, 3 * k + m)));
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    template <class SFF>
+    double ElasticShell<SFF>::hessianVectorProduct(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        int whichTerms,
+        const Eigen::VectorXd& v,
+        Eigen::VectorXd& out,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyProduct<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, v, out, projType, ctx);
+    }
 
-        // bending terms
-        if (whichTerms & EnergyTerm::ET_BENDING)
-        {
-            constexpr int nedgedofs = SFF::numExtraDOFs;
-            for (int i = 0; i < nfaces; i++)
-            {
-                Eigen::Matrix<double, 1, 18 + 3 * nedgedofs> deriv;
-                Eigen::Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> hess;
-                result += mat.bendingEnergy(mesh, curPos, extraDOFs, restState, i, derivative ? &deriv : NULL, hessian ? &hess : NULL);
-                if (derivative)
-                {
-                    for (int j = 0; j < 3; j++)
-                    {
-                        derivative->segment<3>(3 * mesh.faceVertex(i, j)) += deriv.template block<1, 3>(0, 3 * j).transpose();
-                        int oppidx = mesh.vertexOppositeFaceEdge(i, j);
-                        if (oppidx != -1)
-                            derivative->segment<3>(3 * oppidx) += deriv.template block<1, 3>(0, 9 + 3 * j).transpose();
-                        for (int k = 0; k < nedgedofs; k++)
-                        {
-                            (*derivative)[3 * nverts + nedgedofs * mesh.faceEdge(i, j) + k] += deriv(0, 18 + nedgedofs * j + k);
-                        }
-                    }
-                }
-                if (hessian)
-                {
-                    projSymMatrix(hess, projType);
-                    for (int j = 0; j < 3; j++)
-                    {
-                        for (int k = 0; k < 3; k++)
-                        {
-                            for (int l = 0; l < 3; l++)
-                            {
-                                for (int m = 0; m < 3; m++)
-                                {
-                                    hessian->push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * mesh.faceVertex(i, k) + m, hess(3 * j + l, 3 * k + m)));
-                                    int oppidxk = mesh.vertexOppositeFaceEdge(i, k);
-                                    if (oppidxk != -1)
-                                        hessian->push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * oppidxk + m, hess(3 * j + l, 9 + 3 * k + m)));
-                                    int oppidxj = mesh.vertexOppositeFaceEdge(i, j);
-                                    if (oppidxj != -1)
-                                        hessian->push_back(Eigen::Triplet<double>(3 * oppidxj + l, 3 * mesh.faceVertex(i, k) + m, hess(9 + 3 * j + l, 3 * k + m)));
-                                    if (oppidxj != -1 && oppidxk != -1)
-                                        hessian->push_back(Eigen::Triplet<double>(3 * oppidxj + l, 3 * oppidxk + m, hess(9 + 3 * j + l, 9 + 3 * k + m)));
-                                }
-                                for (int m = 0; m < nedgedofs; m++)
-                                {
-                                    hessian->push_back(Eigen::Triplet<double>(3 * mesh.faceVertex(i, j) + l, 3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, hess(3 * j + l, 18 + nedgedofs * k + m)));
-                                    hessian->push_back(Eigen::Triplet<double>(3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, 3 * mesh.faceVertex(i, j) + l, hess(18 + nedgedofs * k + m, 3 * j + l)));
-                                    int oppidxj = mesh.vertexOppositeFaceEdge(i, j);
-                                    if (oppidxj != -1)
-                                    {
-                                        hessian->push_back(Eigen::Triplet<double>(3 * oppidxj + l, 3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, hess(9 + 3 * j + l, 18 + nedgedofs * k + m)));
-                                        hessian->push_back(Eigen::Triplet<double>(3 * nverts + nedgedofs * mesh.faceEdge(i, k) + m, 3 * oppidxj + l, hess(18 + nedgedofs * k + m, 9 + 3 * j + l)));
-                                    }
-                                }
-                            }
-                            for (int m = 0; m < nedgedofs; m++)
-                            {
-                                for (int n = 0; n < nedgedofs; n++)
-                                {
-                                    hessian->push_back(Eigen::Triplet<double>(3 * nverts + nedgedofs * mesh.faceEdge(i, j) + m, 3 * nverts + nedgedofs * mesh.faceEdge(i, k) + n, hess(18 + nedgedofs * j + m, 18 + nedgedofs * k + n)));
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        return result;
+    template <class SFF>
+    double ElasticShell<SFF>::hessianDiagonalBlocks(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        std::vector<Eigen::Matrix3d>& vertexBlocks,
+        Eigen::VectorXd& edgeDOFDiagonal,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return hessianDiagonalBlocks(mesh, curPos, extraDOFs, mat, restState,
+            EnergyTerm::ET_BENDING | EnergyTerm::ET_STRETCHING,
+            vertexBlocks, edgeDOFDiagonal, projType, ctx);
+    }
+
+    template <class SFF>
+    double ElasticShell<SFF>::hessianDiagonalBlocks(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& extraDOFs,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        int whichTerms,
+        std::vector<Eigen::Matrix3d>& vertexBlocks,
+        Eigen::VectorXd& edgeDOFDiagonal,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyDiagonalBlocks<SFF, MaterialModel<SFF> >(mesh, curPos, extraDOFs, mat, restState, whichTerms, vertexBlocks, edgeDOFDiagonal,
+            projType, ctx);
+    }
+
+    template <class SFF>
+    size_t ElasticShell<SFF>::numHessianTriplets(const MeshConnectivity& mesh, int whichTerms, const HessianStorage storage)
+    {
+        // any vertex count works: the edge DOFs come after all vertex DOFs either way
+        int nverts = mesh.nFaces() == 0 ? 0 : mesh.faces().maxCoeff() + 1;
+        return countHessianTriplets(mesh, nverts, SFF::numExtraDOFs, whichTerms & EnergyTerm::ET_STRETCHING, whichTerms & EnergyTerm::ET_BENDING,
+            storage, 0, mesh.nFaces());
     }
 
     template <class SFF>
@@ -212,11 +272,11 @@ namespace LibShell {
         const Eigen::VectorXd& extraDOFs,
         const MaterialModel<SFF>& mat,
         const RestState& restState,
-        int whichTerms)
+        int whichTerms,
+        const ExecutionContext& ctx)
     {
         int nfaces = mesh.nFaces();
         int nedges = mesh.nEdges();
-        int nverts = (int)curPos.rows();
 
         if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges)
         {
@@ -225,24 +285,41 @@ namespace LibShell {
 
         std::vector<double> results(nfaces);
 
-        // stretching terms
-        if (whichTerms & EnergyTerm::ET_STRETCHING)
-        {
-            for (int i = 0; i < nfaces; i++)
-            {
-                results[i] += mat.stretchingEnergy(mesh, curPos, restState, i, NULL, NULL);
-            }
-        }
+        // bound once, rather than once per kernel call
+        PositionsRef positions(curPos);
+        EdgeDOFsRef edgeDOFs(extraDOFs);
 
-        // bending terms
+        typename SFF::GeometryCache localCache;
+        typename SFF::GeometryCache& geometryCache = ctx.workspace ? ctx.workspace->geometryCache<typename SFF::GeometryCache>() : localCache;
         if (whichTerms & EnergyTerm::ET_BENDING)
-        {
-            constexpr int nedgedofs = SFF::numExtraDOFs;
-            for (int i = 0; i < nfaces; i++)
+            SFF::computeGeometryCache(mesh, positions, false, false, geometryCache, ctx);
+
+        // every face writes only its own entry, so no reduction is needed
+        int nthreads = resolveNumThreads(ctx.numThreads, nfaces);
+        parallelForChunks(nfaces, nthreads, [&](int, int begin, int end)
             {
-                results[i] += mat.bendingEnergy(mesh, curPos, extraDOFs, restState, i, NULL, NULL);
-            }
-        }
+                // batched energy-only kernels, see MaterialModel::stretchingEnergies
+                int faces[energyBatchSize];
+                double energies[energyBatchSize];
+                for (int start = begin; start < end; start += energyBatchSize)
+                {
+                    int n = std::min(energyBatchSize, end - start);
+                    for (int j = 0; j < n; j++)
+                        faces[j] = start + j;
+                    if (whichTerms & EnergyTerm::ET_STRETCHING)
+                    {
+                        mat.stretchingEnergies(mesh, positions, restState, n, faces, energies);
+                        for (int j = 0; j < n; j++)
+                            results[start + j] += energies[j];
+                    }
+                    if (whichTerms & EnergyTerm::ET_BENDING)
+                    {
+                        mat.bendingEnergies(mesh, positions, edgeDOFs, restState, n, faces, energies, &geometryCache);
+                        for (int j = 0; j < n; j++)
+                            results[start + j] += energies[j];
+                    }
+                }
+            });
         return results;
     }
 
@@ -273,14 +350,4 @@ namespace LibShell {
     template class ElasticShell<MidedgeAngleSinFormulation>;
     template class ElasticShell<MidedgeAngleTanFormulation>;
     template class ElasticShell<MidedgeAverageFormulation>;
-
-    template void
-    projSymMatrix(Eigen::MatrixBase<Eigen::Matrix<double, 9, 9>> &symA,
-                  const HessianProjectType& projType);
-    template void
-    projSymMatrix(Eigen::MatrixBase<Eigen::Matrix<double, 18, 18>> &symA,
-                  const HessianProjectType &projType);
-    template void
-    projSymMatrix(Eigen::MatrixBase<Eigen::Matrix<double, 21, 21>> &symA,
-                  const HessianProjectType &projType);
 };
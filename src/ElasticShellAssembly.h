@@ -0,0 +1,796 @@
+#ifndef ELASTICSHELLASSEMBLY_H
+#define ELASTICSHELLASSEMBLY_H
+
+#include "../include/ElasticShell.h"
+#include "../include/MeshConnectivity.h"
+#include "../include/MaterialModel.h"
+#include "../include/RestState.h"
+#include "../include/HessianAssemblyPlan.h"
+#include "../include/BlockSparseMatrix.h"
+#include "../include/AssemblyWorkspace.h"
+
+#include "FaceBatch.h"
+#include "StencilDOFs.h"
+#include "ParallelFor.h"
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+/*
+ * The face loops behind ElasticShell::elasticEnergy, templated on the material type. They are instantiated with
+ * MaterialModel<SFF> for the virtual entry points (in ElasticShell.cpp), and with each concrete material for the
+ * statically dispatched ones (in the material's own implementation file).
+ */
+namespace LibShell {
+
+    template <int N>
+    void scatterGradient(const int* dofs, const Eigen::Matrix<double, 1, N>& deriv, Eigen::VectorXd& derivative)
+    {
+        for (int i = 0; i < N; i++)
+        {
+            if (dofs[i] != -1)
+                derivative[dofs[i]] += deriv(0, i);
+        }
+    }
+
+    /*
+     * Destination of the element Hessians: either a triplet list, the values array of a sparse matrix laid out by a
+     * HessianAssemblyPlan (plan) or of a BlockSparseMatrix (blocks), (for matrix-free products) the accumulated product H * vec, or (for preconditioners) the
+     * accumulated 3 x 3 vertex blocks and edge DOF entries of the diagonal of H.
+     */
+    struct HessianSink
+    {
+        HessianStorage storage;
+        std::vector<Eigen::Triplet<double> >* triplets;
+        const HessianAssemblyPlan* plan;
+        double* values;
+        const Eigen::VectorXd* vec;
+        Eigen::VectorXd* product;
+        std::vector<Eigen::Matrix3d>* vertexBlocks;
+        Eigen::VectorXd* edgeDiagonal;
+        const BlockSparseMatrix* blocks;
+    };
+
+    // number of entries of the values array of a plan or block sparse sink
+    inline int sinkValueCount(const HessianSink& hessian)
+    {
+        return hessian.plan ? hessian.plan->nonZeros() : hessian.blocks->nonZeros();
+    }
+
+    template <int N>
+    void scatterHessian(int face, const int* dofs, const Eigen::Matrix<double, N, N>& hess, const HessianSink& hessian)
+    {
+        if (hessian.triplets)
+        {
+            for (int i = 0; i < N; i++)
+            {
+                if (dofs[i] == -1)
+                    continue;
+                for (int j = 0; j < N; j++)
+                {
+                    if (dofs[j] != -1 && isStoredEntry(hessian.storage, dofs[i], dofs[j]))
+                        hessian.triplets->push_back(Eigen::Triplet<double>(dofs[i], dofs[j], hess(i, j)));
+                }
+            }
+            return;
+        }
+
+        if (hessian.product)
+        {
+            const Eigen::VectorXd& vec = *hessian.vec;
+            Eigen::Matrix<double, N, 1> local;
+            for (int j = 0; j < N; j++)
+                local[j] = dofs[j] == -1 ? 0.0 : vec[dofs[j]];
+            Eigen::Matrix<double, N, 1> result = hess * local;
+            for (int i = 0; i < N; i++)
+            {
+                if (dofs[i] != -1)
+                    (*hessian.product)[dofs[i]] += result[i];
+            }
+            return;
+        }
+
+        if (hessian.vertexBlocks)
+        {
+            // the stencils start with the vertex DOFs, in triples. A vertex can in principle occupy several slots (on
+            // degenerate meshes), so every pair of slots is checked.
+            constexpr int nvertslots = (N < 18 ? N : 18) / 3;
+            for (int k = 0; k < nvertslots; k++)
+            {
+                if (dofs[3 * k] == -1)
+                    continue;
+                Eigen::Matrix3d& block = (*hessian.vertexBlocks)[dofs[3 * k] / 3];
+                for (int l = 0; l < nvertslots; l++)
+                {
+                    if (dofs[3 * l] == dofs[3 * k])
+                        block += hess.template block<3, 3>(3 * k, 3 * l);
+                }
+            }
+            int nvertdofs = 3 * (int)hessian.vertexBlocks->size();
+            for (int i = 3 * nvertslots; i < N; i++)
+            {
+                if (dofs[i] != -1)
+                    (*hessian.edgeDiagonal)[dofs[i] - nvertdofs] += hess(i, i);
+            }
+            return;
+        }
+
+        if (hessian.blocks)
+        {
+            // local DOF i lies in stencil slot i / 3 for the vertices, and 6 + (i - 18) / nedgedofs for the edge DOFs
+            constexpr int nedgedofs = N > 18 ? (N - 18) / 3 : 1;
+            constexpr int nslots = N > 18 ? 9 : N / 3;
+            const int* offsets = hessian.blocks->faceBlockOffsets(face);
+            for (int a = 0; a < nslots; a++)
+            {
+                int rowbegin = a < 6 ? 3 * a : 18 + nedgedofs * (a - 6);
+                int rowsize = a < 6 ? 3 : nedgedofs;
+                for (int b = 0; b < nslots; b++)
+                {
+                    int offset = offsets[9 * a + b];
+                    if (offset == -1)
+                        continue;
+                    int colbegin = b < 6 ? 3 * b : 18 + nedgedofs * (b - 6);
+                    int colsize = b < 6 ? 3 : nedgedofs;
+                    double* block = hessian.values + offset;
+                    for (int i = 0; i < rowsize; i++)
+                    {
+                        for (int j = 0; j < colsize; j++)
+                            block[i * colsize + j] += hess(rowbegin + i, colbegin + j);
+                    }
+                }
+            }
+            return;
+        }
+
+        // the stretching stencil is the start of the bending stencil, so both index the same offset table. Entries outside the
+        // plan's storage have offset -1.
+        const int* offsets = hessian.plan->faceOffsets(face);
+        int stride = hessian.plan->localDOFs();
+        for (int i = 0; i < N; i++)
+        {
+            for (int j = 0; j < N; j++)
+            {
+                int offset = offsets[i * stride + j];
+                if (offset != -1)
+                    hessian.values[offset] += hess(i, j);
+            }
+        }
+    }
+
+    /*
+     * Calls the energy kernels of mat: directly for a concrete Material, so that they can be inlined into the assembly
+     * loops, and through the virtual interface when Material is MaterialModel<SFF> itself.
+     */
+    template <class SFF, class Material>
+    double materialStretchingEnergy(const Material& mat, const MeshConnectivity& mesh, const PositionsRef& curPos, const RestState& restState, int face,
+        Eigen::Matrix<double, 1, 9>* derivative, Eigen::Matrix<double, 9, 9>* hessian, HessianProjectType projType)
+    {
+        if constexpr (std::is_same<Material, MaterialModel<SFF> >::value)
+            return mat.stretchingEnergy(mesh, curPos, restState, face, derivative, hessian, projType);
+        else
+            return mat.Material::stretchingEnergy(mesh, curPos, restState, face, derivative, hessian, projType);
+    }
+
+    template <class SFF, class Material>
+    double materialBendingEnergy(const Material& mat, const MeshConnectivity& mesh, const PositionsRef& curPos, const EdgeDOFsRef& extraDOFs,
+        const RestState& restState, int face,
+        Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative,
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+        const typename SFF::GeometryCache* geometryCache)
+    {
+        if constexpr (std::is_same<Material, MaterialModel<SFF> >::value)
+            return mat.bendingEnergy(mesh, curPos, extraDOFs, restState, face, derivative, hessian, geometryCache);
+        else
+            return mat.Material::bendingEnergy(mesh, curPos, extraDOFs, restState, face, derivative, hessian, geometryCache);
+    }
+
+    // Like the above, for MaterialModel::stretchingAndBendingEnergy (composed here from the statically dispatched kernels if Material does not override it)
+    template <class SFF, class Material>
+    double materialStretchingAndBendingEnergy(const Material& mat, const MeshConnectivity& mesh, const PositionsRef& curPos, const EdgeDOFsRef& extraDOFs,
+        const RestState& restState, int face,
+        Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative,
+        Eigen::Matrix<double, 9, 9>* stretchingHessian,
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* bendingHessian,
+        HessianProjectType projType,
+        const typename SFF::GeometryCache* geometryCache)
+    {
+        typedef decltype(&MaterialModel<SFF>::stretchingAndBendingEnergy) BaseKernel;
+        if constexpr (std::is_same<Material, MaterialModel<SFF> >::value)
+            return mat.stretchingAndBendingEnergy(mesh, curPos, extraDOFs, restState, face, derivative, stretchingHessian, bendingHessian, projType, geometryCache);
+        else if constexpr (!std::is_same<decltype(&Material::stretchingAndBendingEnergy), BaseKernel>::value)
+            return mat.Material::stretchingAndBendingEnergy(mesh, curPos, extraDOFs, restState, face, derivative, stretchingHessian, bendingHessian, projType, geometryCache);
+        else
+        {
+            Eigen::Matrix<double, 1, 9> stretchingDerivative;
+            double result = mat.Material::stretchingEnergy(mesh, curPos, restState, face, derivative ? &stretchingDerivative : NULL, stretchingHessian, projType);
+            result += mat.Material::bendingEnergy(mesh, curPos, extraDOFs, restState, face, derivative, bendingHessian, geometryCache);
+            if (derivative)
+                derivative->template head<9>() += stretchingDerivative;
+            return result;
+        }
+    }
+
+    /*
+     * Batched energy-only kernels (see MaterialModel::stretchingEnergies). A concrete Material that does not override them
+     * gets the per-face loop here rather than the base class one, which would go through the virtual interface.
+     */
+    template <class SFF, class Material>
+    void materialStretchingEnergies(const Material& mat, const MeshConnectivity& mesh, const PositionsRef& curPos, const RestState& restState,
+        int nfaces, const int* faces, double* energies)
+    {
+        typedef decltype(&MaterialModel<SFF>::stretchingEnergies) BaseKernel;
+        if constexpr (std::is_same<Material, MaterialModel<SFF> >::value)
+            mat.stretchingEnergies(mesh, curPos, restState, nfaces, faces, energies);
+        else if constexpr (!std::is_same<decltype(&Material::stretchingEnergies), BaseKernel>::value)
+            mat.Material::stretchingEnergies(mesh, curPos, restState, nfaces, faces, energies);
+        else
+        {
+            for (int i = 0; i < nfaces; i++)
+                energies[i] = mat.Material::stretchingEnergy(mesh, curPos, restState, faces[i], NULL, NULL, HessianProjectType::kNone);
+        }
+    }
+
+    template <class SFF, class Material>
+    void materialBendingEnergies(const Material& mat, const MeshConnectivity& mesh, const PositionsRef& curPos, const EdgeDOFsRef& extraDOFs,
+        const RestState& restState, int nfaces, const int* faces, double* energies, const typename SFF::GeometryCache* geometryCache)
+    {
+        typedef decltype(&MaterialModel<SFF>::bendingEnergies) BaseKernel;
+        if constexpr (std::is_same<Material, MaterialModel<SFF> >::value)
+            mat.bendingEnergies(mesh, curPos, extraDOFs, restState, nfaces, faces, energies, geometryCache);
+        else if constexpr (!std::is_same<decltype(&Material::bendingEnergies), BaseKernel>::value)
+            mat.Material::bendingEnergies(mesh, curPos, extraDOFs, restState, nfaces, faces, energies, geometryCache);
+        else
+        {
+            for (int i = 0; i < nfaces; i++)
+                energies[i] = mat.Material::bendingEnergy(mesh, curPos, extraDOFs, restState, faces[i], NULL, NULL, geometryCache);
+        }
+    }
+
+    /*
+     * Energy of faces [faceBegin, faceEnd) (or faceList[faceBegin] .. faceList[faceEnd - 1]) through the batched
+     * energy-only kernels, summed in face order like elasticEnergyRange.
+     */
+    template <class SFF, class Material>
+    double elasticEnergyOnlyRange(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        int faceBegin, int faceEnd,
+        const typename SFF::GeometryCache* geometryCache,
+        const int* faceList = NULL)
+    {
+        int faces[energyBatchSize];
+        double energies[energyBatchSize];
+        double result = 0;
+        if (whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING)
+        {
+            for (int start = faceBegin; start < faceEnd; start += energyBatchSize)
+            {
+                int n = std::min(energyBatchSize, faceEnd - start);
+                for (int j = 0; j < n; j++)
+                    faces[j] = faceList ? faceList[start + j] : start + j;
+                materialStretchingEnergies<SFF>(mat, mesh, curPos, restState, n, faces, energies);
+                for (int j = 0; j < n; j++)
+                    result += energies[j];
+            }
+        }
+        if (whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING)
+        {
+            for (int start = faceBegin; start < faceEnd; start += energyBatchSize)
+            {
+                int n = std::min(energyBatchSize, faceEnd - start);
+                for (int j = 0; j < n; j++)
+                    faces[j] = faceList ? faceList[start + j] : start + j;
+                materialBendingEnergies<SFF>(mat, mesh, curPos, extraDOFs, restState, n, faces, energies, geometryCache);
+                for (int j = 0; j < n; j++)
+                    result += energies[j];
+            }
+        }
+        return result;
+    }
+
+    /*
+     * Adds the energy, derivative and Hessian contributions of faces [faceBegin, faceEnd) to derivative and hessian
+     * (which must already be sized) and returns their energy. If faceList is not NULL, the faces are faceList[faceBegin]
+     * .. faceList[faceEnd - 1] instead.
+     */
+    template <class SFF, class Material>
+    double elasticEnergyRange(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        int faceBegin, int faceEnd,
+        Eigen::VectorXd* derivative,
+        const HessianSink* hessian,
+        const HessianProjectType projType,
+        const typename SFF::GeometryCache* geometryCache,
+        const int* faceList = NULL)
+    {
+        if (!derivative && !hessian)
+            return elasticEnergyOnlyRange<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, faceBegin, faceEnd, geometryCache, faceList);
+
+        int nverts = (int)curPos.rows();
+        double result = 0;
+
+        // both terms in one pass: the stretching stencil is the start of the bending stencil, so each face's two element
+        // contributions (projected separately, as below) are summed and scattered once
+        if ((whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING) && (whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING))
+        {
+            constexpr int nedgedofs = SFF::numExtraDOFs;
+            bool projected = projType == HessianProjectType::kStrainSpace && mat.supportsStrainSpaceProjection();
+            for (int f = faceBegin; f < faceEnd; f++)
+            {
+                int i = faceList ? faceList[f] : f;
+                Eigen::Matrix<double, 1, 18 + 3 * nedgedofs> deriv;
+                Eigen::Matrix<double, 9, 9> stretchingHess;
+                Eigen::Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> hess;
+                result += materialStretchingAndBendingEnergy<SFF>(mat, mesh, curPos, extraDOFs, restState, i, derivative ? &deriv : NULL,
+                    hessian ? &stretchingHess : NULL, hessian ? &hess : NULL, projType, geometryCache);
+
+                int dofs[18 + 3 * nedgedofs];
+                bendingStencil(mesh, nverts, nedgedofs, i, dofs);
+                if (derivative)
+                    scatterGradient(dofs, deriv, *derivative);
+                if (hessian)
+                {
+                    if (!projected)
+                        projSymMatrix(stretchingHess, projType);
+                    projSymMatrix(hess, projType);
+                    hess.template block<9, 9>(0, 0) += stretchingHess;
+                    scatterHessian(i, dofs, hess, *hessian);
+                }
+            }
+            return result;
+        }
+
+        // stretching terms
+        if (whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING)
+        {
+            // materials supporting it return already projected Hessians
+            bool projected = projType == HessianProjectType::kStrainSpace && mat.supportsStrainSpaceProjection();
+            for (int f = faceBegin; f < faceEnd; f++)
+            {
+                int i = faceList ? faceList[f] : f;
+                Eigen::Matrix<double, 1, 9> deriv;
+                Eigen::Matrix<double, 9, 9> hess;
+                result += materialStretchingEnergy<SFF>(mat, mesh, curPos, restState, i, derivative ? &deriv : NULL, hessian ? &hess : NULL, projType);
+                if (!derivative && !hessian)
+                    continue;
+
+                int dofs[9];
+                stretchingStencil(mesh, i, dofs);
+                if (derivative)
+                    scatterGradient(dofs, deriv, *derivative);
+                if (hessian)
+                {
+                    if (!projected)
+                        projSymMatrix(hess, projType);
+                    scatterHessian(i, dofs, hess, *hessian);
+                }
+            }
+        }
+
+        // bending terms
+        if (whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING)
+        {
+            constexpr int nedgedofs = SFF::numExtraDOFs;
+            for (int f = faceBegin; f < faceEnd; f++)
+            {
+                int i = faceList ? faceList[f] : f;
+                Eigen::Matrix<double, 1, 18 + 3 * nedgedofs> deriv;
+                Eigen::Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> hess;
+                result += materialBendingEnergy<SFF>(mat, mesh, curPos, extraDOFs, restState, i, derivative ? &deriv : NULL, hessian ? &hess : NULL, geometryCache);
+                if (!derivative && !hessian)
+                    continue;
+
+                int dofs[18 + 3 * nedgedofs];
+                bendingStencil(mesh, nverts, nedgedofs, i, dofs);
+                if (derivative)
+                    scatterGradient(dofs, deriv, *derivative);
+                if (hessian)
+                {
+                    projSymMatrix(hess, projType);
+                    scatterHessian(i, dofs, hess, *hessian);
+                }
+            }
+        }
+        return result;
+    }
+
+    /*
+     * Runs elasticEnergyRange over all faces, split over ctx.numThreads threads. derivative (if not NULL) must be
+     * zeroed, and the Hessian destination (triplets or plan + values, if any) emptied/zeroed, by the caller.
+     */
+    template <class SFF, class Material>
+    double elasticEnergyThreaded(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative,
+        const HessianSink* hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        // buffers of this call, or of the caller's workspace, whose capacity then carries over between calls
+        AssemblyWorkspace localWorkspace;
+        AssemblyWorkspace& workspace = ctx.workspace ? *ctx.workspace : localWorkspace;
+
+        // per-edge quantities shared by the bending terms of both adjacent faces
+        const typename SFF::GeometryCache* cache = NULL;
+        if (whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING)
+        {
+            typename SFF::GeometryCache& geometryCache = workspace.geometryCache<typename SFF::GeometryCache>();
+            SFF::computeGeometryCache(mesh, curPos, derivative || hessian, hessian != NULL, geometryCache, ctx);
+            cache = &geometryCache;
+        }
+
+        int nfaces = mesh.nFaces();
+        int nthreads = resolveNumThreads(ctx.numThreads, nfaces);
+        if (nthreads == 1)
+        {
+            return elasticEnergyRange<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, 0, nfaces, derivative, hessian, projType, cache);
+        }
+
+        // faces of one color touch disjoint DOFs, so the threads can write straight into the shared outputs
+        const FaceColoring* coloring = ctx.coloring;
+        if (coloring && (int)coloring->faces.size() == nfaces && !(hessian && hessian->triplets))
+        {
+            double result = 0;
+            for (int c = 0; c < coloring->nColors(); c++)
+            {
+                int colorBegin = coloring->colorOffsets[c];
+                int ncolorfaces = coloring->colorOffsets[c + 1] - colorBegin;
+                int ncolorthreads = resolveNumThreads(nthreads, ncolorfaces);
+                std::vector<double>& energies = workspace.threadEnergies;
+                energies.assign(ncolorthreads, 0.0);
+                parallelForChunks(ncolorfaces, ncolorthreads, [&](int thread, int begin, int end)
+                    {
+                        energies[thread] = elasticEnergyRange<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms,
+                            colorBegin + begin, colorBegin + end, derivative, hessian, projType, cache, coloring->faces.data());
+                    });
+                for (int i = 0; i < ncolorthreads; i++)
+                    result += energies[i];
+            }
+            return result;
+        }
+
+        // thread 0 writes straight into the outputs, the other threads into their own buffers
+        // (buffers are only ever grown, and refilled with zeros rather than reallocated)
+        std::vector<double>& energies = workspace.threadEnergies;
+        energies.assign(nthreads, 0.0);
+        std::vector<AssemblyWorkspace::ThreadBuffers>& buffers = workspace.threadBuffers;
+        if ((int)buffers.size() < nthreads)
+            buffers.resize(nthreads);
+        parallelForChunks(nfaces, nthreads, [&](int thread, int begin, int end)
+            {
+                Eigen::VectorXd* localDerivative = derivative;
+                HessianSink localHessian;
+                if (hessian)
+                    localHessian = *hessian;
+                if (thread > 0)
+                {
+                    AssemblyWorkspace::ThreadBuffers& local = buffers[thread];
+                    if (derivative)
+                    {
+                        local.derivative.setZero(derivative->size());
+                        localDerivative = &local.derivative;
+                    }
+                    if (hessian && hessian->triplets)
+                    {
+                        localHessian.triplets = &local.triplets;
+                        local.triplets.clear();
+                        local.triplets.reserve(countHessianTriplets(mesh, (int)curPos.rows(), SFF::numExtraDOFs,
+                            whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING, whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING,
+                            hessian->storage, begin, end));
+                    }
+                    else if (hessian && hessian->product)
+                    {
+                        local.product.setZero(hessian->product->size());
+                        localHessian.product = &local.product;
+                    }
+                    else if (hessian && hessian->vertexBlocks)
+                    {
+                        local.vertexBlocks.assign(hessian->vertexBlocks->size(), Eigen::Matrix3d::Zero());
+                        local.edgeDiagonal.setZero(hessian->edgeDiagonal->size());
+                        localHessian.vertexBlocks = &local.vertexBlocks;
+                        localHessian.edgeDiagonal = &local.edgeDiagonal;
+                    }
+                    else if (hessian)
+                    {
+                        local.values.assign(sinkValueCount(*hessian), 0.0);
+                        localHessian.values = local.values.data();
+                    }
+                }
+                energies[thread] = elasticEnergyRange<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, begin, end,
+                    localDerivative, hessian ? &localHessian : NULL, projType, cache);
+            });
+
+        // deterministic reduction, in thread order
+        double result = 0;
+        for (int i = 0; i < nthreads; i++)
+            result += energies[i];
+        if (derivative)
+        {
+            for (int i = 1; i < nthreads; i++)
+                *derivative += buffers[i].derivative;
+        }
+        if (hessian && hessian->triplets)
+        {
+            size_t total = hessian->triplets->size();
+            for (int i = 1; i < nthreads; i++)
+                total += buffers[i].triplets.size();
+            hessian->triplets->reserve(total);
+            for (int i = 1; i < nthreads; i++)
+                hessian->triplets->insert(hessian->triplets->end(), buffers[i].triplets.begin(), buffers[i].triplets.end());
+        }
+        else if (hessian && hessian->product)
+        {
+            for (int i = 1; i < nthreads; i++)
+                *hessian->product += buffers[i].product;
+        }
+        else if (hessian && hessian->vertexBlocks)
+        {
+            for (int i = 1; i < nthreads; i++)
+            {
+                for (size_t j = 0; j < buffers[i].vertexBlocks.size(); j++)
+                    (*hessian->vertexBlocks)[j] += buffers[i].vertexBlocks[j];
+                *hessian->edgeDiagonal += buffers[i].edgeDiagonal;
+            }
+        }
+        else if (hessian)
+        {
+            int nnz = sinkValueCount(*hessian);
+            for (int i = 1; i < nthreads; i++)
+            {
+                for (int j = 0; j < nnz; j++)
+                    hessian->values[j] += buffers[i].values[j];
+            }
+        }
+        return result;
+    }
+
+    // ElasticShell::elasticEnergy, with the Hessian output as triplets
+    template <class SFF, class Material>
+    double elasticEnergyTriplets(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        std::vector<Eigen::Triplet<double> >* hessian,
+        const HessianProjectType projType,
+        const HessianStorage storage,
+        const ExecutionContext& ctx)
+    {
+        int nedges = mesh.nEdges();
+        int nverts = (int)curPos.rows();
+
+        if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        if (derivative)
+        {
+            derivative->resize(3 * nverts + SFF::numExtraDOFs * nedges);
+            derivative->setZero();
+        }
+        HessianSink sink = { storage, hessian, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+        if (hessian)
+        {
+            // exact size, so that the (possibly huge) buffer is never regrown during assembly
+            hessian->clear();
+            hessian->reserve(countHessianTriplets(mesh, nverts, SFF::numExtraDOFs, whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING,
+                whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING, storage, 0, mesh.nFaces()));
+        }
+
+        return elasticEnergyThreaded<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, hessian ? &sink : NULL, projType, ctx);
+    }
+
+    // ElasticShell::elasticEnergy, with the Hessian assembled in place through a HessianAssemblyPlan
+    template <class SFF, class Material>
+    double elasticEnergyPlan(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        const HessianAssemblyPlan& plan,
+        Eigen::SparseMatrix<double>* hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        int nedges = mesh.nEdges();
+        int nverts = (int)curPos.rows();
+        int ndofs = 3 * nverts + SFF::numExtraDOFs * nedges;
+
+        if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        if (hessian && (plan.nFaces() != mesh.nFaces() || plan.numExtraDOFs() != SFF::numExtraDOFs || plan.nDOFs() != ndofs))
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        if (derivative)
+        {
+            derivative->resize(ndofs);
+            derivative->setZero();
+        }
+        HessianSink sink = { plan.storage(), NULL, &plan, NULL, NULL, NULL, NULL, NULL, NULL };
+        if (hessian)
+        {
+            // reuse the matrix storage when it already has the plan's layout
+            if (plan.matches(*hessian))
+                hessian->coeffs().setZero();
+            else
+                plan.initializeMatrix(*hessian);
+            sink.values = hessian->valuePtr();
+        }
+
+        return elasticEnergyThreaded<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, hessian ? &sink : NULL, projType, ctx);
+    }
+
+    // ElasticShell::elasticEnergy, with the Hessian assembled in place into a BlockSparseMatrix
+    template <class SFF, class Material>
+    double elasticEnergyBlocks(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative, // positions, then thetas
+        BlockSparseMatrix& hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        int nedges = mesh.nEdges();
+        int nverts = (int)curPos.rows();
+        int ndofs = 3 * nverts + SFF::numExtraDOFs * nedges;
+
+        if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        if (hessian.nFaces() != mesh.nFaces() || hessian.numExtraDOFs() != SFF::numExtraDOFs || hessian.rows() != ndofs)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        if (derivative)
+        {
+            derivative->resize(ndofs);
+            derivative->setZero();
+        }
+        hessian.setZero();
+        HessianSink sink = { HessianStorage::kFull, NULL, NULL, hessian.valuePtr(), NULL, NULL, NULL, NULL, &hessian };
+        return elasticEnergyThreaded<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, derivative, &sink, projType, ctx);
+    }
+
+    // ElasticShell::hessianVectorProduct: the element Hessians are multiplied with v as they are computed, never assembled
+    template <class SFF, class Material>
+    double elasticEnergyProduct(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        const Eigen::VectorXd& v,
+        Eigen::VectorXd& product,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        int nedges = mesh.nEdges();
+        int nverts = (int)curPos.rows();
+        int ndofs = 3 * nverts + SFF::numExtraDOFs * nedges;
+
+        if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges || v.size() != ndofs)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        product.setZero(ndofs);
+        HessianSink sink = { HessianStorage::kFull, NULL, NULL, NULL, &v, &product, NULL, NULL, NULL };
+        return elasticEnergyThreaded<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, NULL, &sink, projType, ctx);
+    }
+
+    // ElasticShell::hessianDiagonalBlocks: only the diagonal blocks of the element Hessians are accumulated
+    template <class SFF, class Material>
+    double elasticEnergyDiagonalBlocks(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const Material& mat,
+        const RestState& restState,
+        int whichTerms,
+        std::vector<Eigen::Matrix3d>& vertexBlocks,
+        Eigen::VectorXd& edgeDOFDiagonal,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        int nedges = mesh.nEdges();
+        int nverts = (int)curPos.rows();
+
+        if (curPos.cols() != 3 || extraDOFs.size() != SFF::numExtraDOFs * nedges)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        vertexBlocks.assign(nverts, Eigen::Matrix3d::Zero());
+        edgeDOFDiagonal.setZero(SFF::numExtraDOFs * nedges);
+        HessianSink sink = { HessianStorage::kFull, NULL, NULL, NULL, NULL, NULL, &vertexBlocks, &edgeDOFDiagonal, NULL };
+        return elasticEnergyThreaded<SFF, Material>(mesh, curPos, extraDOFs, mat, restState, whichTerms, NULL, &sink, projType, ctx);
+    }
+
+    template <class SFF>
+    template <class Material>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& edgeDOFs,
+        const typename NonDeduced<Material>::type& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative,
+        std::vector<Eigen::Triplet<double> >* hessian,
+        const HessianProjectType projType,
+        const HessianStorage storage,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyTriplets<SFF, Material>(mesh, curPos, edgeDOFs, mat, restState, whichTerms, derivative, hessian, projType, storage, ctx);
+    }
+
+    template <class SFF>
+    template <class Material>
+    double ElasticShell<SFF>::elasticEnergy(
+        const MeshConnectivity& mesh,
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& edgeDOFs,
+        const typename NonDeduced<Material>::type& mat,
+        const RestState& restState,
+        int whichTerms,
+        Eigen::VectorXd* derivative,
+        const HessianAssemblyPlan& plan,
+        Eigen::SparseMatrix<double>* hessian,
+        const HessianProjectType projType,
+        const ExecutionContext& ctx)
+    {
+        return elasticEnergyPlan<SFF, Material>(mesh, curPos, edgeDOFs, mat, restState, whichTerms, derivative, plan, hessian, projType, ctx);
+    }
+
+    /*
+     * Explicitly instantiates the statically dispatched ElasticShell<SFF>::elasticEnergy for Material<SFF>. Used by the
+     * material implementation files, where the material kernels can be inlined.
+     */
+#define LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(Material, SFF) \
+    template double ElasticShell<SFF>::elasticEnergy<Material<SFF> >(const MeshConnectivity&, const Eigen::MatrixXd&, const Eigen::VectorXd&, \
+        const Material<SFF>&, const RestState&, int, Eigen::VectorXd*, std::vector<Eigen::Triplet<double> >*, const HessianProjectType, \
+        const HessianStorage, const ExecutionContext&); \
+    template double ElasticShell<SFF>::elasticEnergy<Material<SFF> >(const MeshConnectivity&, const Eigen::MatrixXd&, const Eigen::VectorXd&, \
+        const Material<SFF>&, const RestState&, int, Eigen::VectorXd*, const HessianAssemblyPlan&, Eigen::SparseMatrix<double>*, \
+        const HessianProjectType, const ExecutionContext&);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef FACEBATCH_H
+#define FACEBATCH_H
+
+#include "../include/MeshConnectivity.h"
+#include "../include/types.h"
+
+#include <Eigen/Core>
+#include <vector>
+
+/*
+ * Structure-of-arrays gathers for the batched energy-only kernels (MaterialModel::stretchingEnergies and
+ * bendingEnergies): the per-face inputs of a batch of faces are copied into one array per scalar, so that the
+ * material formulas can then be evaluated for the whole batch in loops that the compiler vectorizes.
+ */
+namespace LibShell {
+
+    // number of faces the batched energy-only kernels process at a time
+    constexpr int energyBatchSize = 64;
+
+    // 2 x 2 matrices of a batch of faces: entry k (column-major) of the matrix of the i-th face is m[k][i]
+    struct MatrixBatch
+    {
+        double m[4][energyBatchSize];
+    };
+
+    // Current first fundamental forms of faces[0] .. faces[n - 1], n <= energyBatchSize
+    inline void gatherFirstFundamentalForms(const MeshConnectivity& mesh, const PositionsRef& curPos, int n, const int* faces, MatrixBatch& a)
+    {
+        // edge vectors q1 - q0 and q2 - q0
+        double e1[3][energyBatchSize], e2[3][energyBatchSize];
+        for (int i = 0; i < n; i++)
+        {
+            const FaceStencil& stencil = mesh.faceStencil(faces[i]);
+            int v0 = stencil.vertices[0];
+            int v1 = stencil.vertices[1];
+            int v2 = stencil.vertices[2];
+            for (int k = 0; k < 3; k++)
+            {
+                e1[k][i] = curPos(v1, k) - curPos(v0, k);
+                e2[k][i] = curPos(v2, k) - curPos(v0, k);
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            double a01 = e1[0][i] * e2[0][i] + e1[1][i] * e2[1][i] + e1[2][i] * e2[2][i];
+            a.m[0][i] = e1[0][i] * e1[0][i] + e1[1][i] * e1[1][i] + e1[2][i] * e1[2][i];
+            a.m[1][i] = a01;
+            a.m[2][i] = a01;
+            a.m[3][i] = e2[0][i] * e2[0][i] + e2[1][i] * e2[1][i] + e2[2][i] * e2[2][i];
+        }
+    }
+
+    // Current second fundamental forms of faces[0] .. faces[n - 1], n <= energyBatchSize
+    template <class SFF>
+    void gatherSecondFundamentalForms(const MeshConnectivity& mesh, const PositionsRef& curPos, const EdgeDOFsRef& extraDOFs,
+        int n, const int* faces, const typename SFF::GeometryCache* geometryCache, MatrixBatch& b)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            Eigen::Matrix2d bi = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, faces[i], NULL, NULL, geometryCache);
+            for (int k = 0; k < 4; k++)
+                b.m[k][i] = bi(k);
+        }
+    }
+
+    // Per-face matrices (e.g. the rest forms abars) of faces[0] .. faces[n - 1], n <= energyBatchSize
+    inline void gatherMatrices(const std::vector<Eigen::Matrix2d>& matrices, int n, const int* faces, MatrixBatch& out)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            for (int k = 0; k < 4; k++)
+                out.m[k][i] = matrices[faces[i]](k);
+        }
+    }
+
+    // Per-face scalars (e.g. thicknesses) of faces[0] .. faces[n - 1], n <= energyBatchSize
+    inline void gatherScalars(const std::vector<double>& values, int n, const int* faces, double* out)
+    {
+        for (int i = 0; i < n; i++)
+            out[i] = values[faces[i]];
+    }
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "GeometryDerivatives.h"
 #include "../include/MeshConnectivity.h"
+#include "../include/SecondFundamentalFormCache.h"
+#include "ParallelFor.h"
 #include <iostream>
 #include <random>
 #include <Eigen/Geometry>
+#include <Eigen/Eigenvalues>
 
 namespace LibShell {
 
@@ -53,26 +56,26 @@ namespace LibShell {
     }
 
     Eigen::Vector3d faceNormal(const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face, int startidx,
         Eigen::Matrix<double, 3, 9>* derivative,
-        std::vector<Eigen::Matrix<double, 9, 9> >* hessian)
+        std::array<Eigen::Matrix<double, 9, 9>, 3>* hessian)
     {
         if (derivative)
             derivative->setZero();
 
         if (hessian)
         {
-            hessian->resize(3);
             for (int i = 0; i < 3; i++) (*hessian)[i].setZero();
         }
 
         int v0 = startidx % 3;
         int v1 = (startidx + 1) % 3;
         int v2 = (startidx + 2) % 3;
-        Eigen::Vector3d qi0 = curPos.row(mesh.faceVertex(face, v0)).transpose();
-        Eigen::Vector3d qi1 = curPos.row(mesh.faceVertex(face, v1)).transpose();
-        Eigen::Vector3d qi2 = curPos.row(mesh.faceVertex(face, v2)).transpose();
+        const FaceStencil& stencil = mesh.faceStencil(face);
+        Eigen::Vector3d qi0 = curPos.row(stencil.vertices[v0]).transpose();
+        Eigen::Vector3d qi1 = curPos.row(stencil.vertices[v1]).transpose();
+        Eigen::Vector3d qi2 = curPos.row(stencil.vertices[v2]).transpose();
         Eigen::Vector3d n = (qi1 - qi0).cross(qi2 - qi0);
 
         if (derivative)
@@ -102,7 +105,7 @@ namespace LibShell {
     }
 
     double triangleAltitude(const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face,
         int edgeidx,
         Eigen::Matrix<double, 1, 9>* derivative,
@@ -114,13 +117,14 @@ namespace LibShell {
             hessian->setZero();
 
         Eigen::Matrix<double, 3, 9> nderiv;
-        std::vector<Eigen::Matrix<double, 9, 9> > nhess;
+        std::array<Eigen::Matrix<double, 9, 9>, 3> nhess;
         Eigen::Vector3d n = faceNormal(mesh, curPos, face, edgeidx, (derivative || hessian ? &nderiv : NULL), hessian ? &nhess : NULL);
 
         int v2 = (edgeidx + 2) % 3;
         int v1 = (edgeidx + 1) % 3;
-        Eigen::Vector3d q2 = curPos.row(mesh.faceVertex(face, v2)).transpose();
-        Eigen::Vector3d q1 = curPos.row(mesh.faceVertex(face, v1)).transpose();
+        const FaceStencil& stencil = mesh.faceStencil(face);
+        Eigen::Vector3d q2 = curPos.row(stencil.vertices[v2]).transpose();
+        Eigen::Vector3d q1 = curPos.row(stencil.vertices[v1]).transpose();
 
         Eigen::Vector3d e = q2 - q1;
         double nnorm = n.norm();
@@ -165,14 +169,15 @@ namespace LibShell {
 
     Eigen::Matrix2d firstFundamentalForm(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face,
         Eigen::Matrix<double, 4, 9>* derivative, // F(face, i)
-        std::vector <Eigen::Matrix<double, 9, 9> >* hessian)
+        std::array<Eigen::Matrix<double, 9, 9>, 4>* hessian)
     {
-        Eigen::Vector3d q0 = curPos.row(mesh.faceVertex(face, 0));
-        Eigen::Vector3d q1 = curPos.row(mesh.faceVertex(face, 1));
-        Eigen::Vector3d q2 = curPos.row(mesh.faceVertex(face, 2));
+        const FaceStencil& stencil = mesh.faceStencil(face);
+        Eigen::Vector3d q0 = curPos.row(stencil.vertices[0]);
+        Eigen::Vector3d q1 = curPos.row(stencil.vertices[1]);
+        Eigen::Vector3d q2 = curPos.row(stencil.vertices[2]);
         Eigen::Matrix2d result;
         result << (q1 - q0).dot(q1 - q0), (q1 - q0).dot(q2 - q0),
             (q2 - q0).dot(q1 - q0), (q2 - q0).dot(q2 - q0);
@@ -194,40 +199,230 @@ namespace LibShell {
 
         if (hessian)
         {
-            hessian->resize(4);
             for (int i = 0; i < 4; i++)
             {
                 (*hessian)[i].setZero();
+                for (int j = 0; j < 3; j++)
+                {
+                    for (int k = 0; k < 3; k++)
+                        (*hessian)[i].block<3, 3>(3 * j, 3 * k).diagonal().setConstant(firstFundamentalFormHessianStencils[i][j][k]);
+                }
             }
-            Eigen::Matrix3d I = Eigen::Matrix3d::Identity();
-            (*hessian)[0].block<3, 3>(0, 0) += 2.0 * I;
-            (*hessian)[0].block<3, 3>(3, 3) += 2.0 * I;
-            (*hessian)[0].block<3, 3>(0, 3) -= 2.0 * I;
-            (*hessian)[0].block<3, 3>(3, 0) -= 2.0 * I;
-
-            (*hessian)[1].block<3, 3>(3, 6) += I;
-            (*hessian)[1].block<3, 3>(6, 3) += I;
-            (*hessian)[1].block<3, 3>(0, 3) -= I;
-            (*hessian)[1].block<3, 3>(0, 6) -= I;
-            (*hessian)[1].block<3, 3>(3, 0) -= I;
-            (*hessian)[1].block<3, 3>(6, 0) -= I;
-            (*hessian)[1].block<3, 3>(0, 0) += 2.0 * I;
-
-            (*hessian)[2].block<3, 3>(3, 6) += I;
-            (*hessian)[2].block<3, 3>(6, 3) += I;
-            (*hessian)[2].block<3, 3>(0, 3) -= I;
-            (*hessian)[2].block<3, 3>(0, 6) -= I;
-            (*hessian)[2].block<3, 3>(3, 0) -= I;
-            (*hessian)[2].block<3, 3>(6, 0) -= I;
-            (*hessian)[2].block<3, 3>(0, 0) += 2.0 * I;
-
-            (*hessian)[3].block<3, 3>(0, 0) += 2.0 * I;
-            (*hessian)[3].block<3, 3>(6, 6) += 2.0 * I;
-            (*hessian)[3].block<3, 3>(0, 6) -= 2.0 * I;
-            (*hessian)[3].block<3, 3>(6, 0) -= 2.0 * I;
         }
 
         return result;
     }
 
+    double edgeTheta(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        int edge,
+        Eigen::Matrix<double, 1, 12>* derivative, // edgeVertex, then edgeOppositeVertex
+        Eigen::Matrix<double, 12, 12>* hessian)
+    {
+        if (derivative)
+            derivative->setZero();
+        if (hessian)
+            hessian->setZero();
+        int v0 = mesh.edgeVertex(edge, 0);
+        int v1 = mesh.edgeVertex(edge, 1);
+        int v2 = mesh.edgeOppositeVertex(edge, 0);
+        int v3 = mesh.edgeOppositeVertex(edge, 1);
+        if (v2 == -1 || v3 == -1)
+            return 0; // boundary edge
+
+        Eigen::Vector3d q0 = curPos.row(v0);
+        Eigen::Vector3d q1 = curPos.row(v1);
+        Eigen::Vector3d q2 = curPos.row(v2);
+        Eigen::Vector3d q3 = curPos.row(v3);
+
+        Eigen::Vector3d n0 = (q0 - q2).cross(q1 - q2);
+        Eigen::Vector3d n1 = (q1 - q3).cross(q0 - q3);
+        Eigen::Vector3d axis = q1 - q0;
+        Eigen::Matrix<double, 1, 9> angderiv;
+        Eigen::Matrix<double, 9, 9> anghess;
+
+        double theta = angle(n0, n1, axis, (derivative || hessian) ? &angderiv : NULL, hessian ? &anghess : NULL);
+
+        if (derivative)
+        {
+            derivative->block<1, 3>(0, 0) += angderiv.block<1, 3>(0, 0) * crossMatrix(q2 - q1);
+            derivative->block<1, 3>(0, 3) += angderiv.block<1, 3>(0, 0) * crossMatrix(q0 - q2);
+            derivative->block<1, 3>(0, 6) += angderiv.block<1, 3>(0, 0) * crossMatrix(q1 - q0);
+
+            derivative->block<1, 3>(0, 0) += angderiv.block<1, 3>(0, 3) * crossMatrix(q1 - q3);
+            derivative->block<1, 3>(0, 3) += angderiv.block<1, 3>(0, 3) * crossMatrix(q3 - q0);
+            derivative->block<1, 3>(0, 9) += angderiv.block<1, 3>(0, 3) * crossMatrix(q0 - q1);
+        }
+
+        if (hessian)
+        {
+            Eigen::Matrix3d vqm[3];
+            vqm[0] = crossMatrix(q0 - q2);
+            vqm[1] = crossMatrix(q1 - q0);
+            vqm[2] = crossMatrix(q2 - q1);
+            Eigen::Matrix3d wqm[3];
+            wqm[0] = crossMatrix(q0 - q1);
+            wqm[1] = crossMatrix(q1 - q3);
+            wqm[2] = crossMatrix(q3 - q0);
+
+            int vindices[3] = { 3, 6, 0 };
+            int windices[3] = { 9, 0, 3 };
+
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    hessian->block<3, 3>(vindices[i], vindices[j]) += vqm[i].transpose() * anghess.block<3, 3>(0, 0) * vqm[j];
+                    hessian->block<3, 3>(vindices[i], windices[j]) += vqm[i].transpose() * anghess.block<3, 3>(0, 3) * wqm[j];
+                    hessian->block<3, 3>(windices[i], vindices[j]) += wqm[i].transpose() * anghess.block<3, 3>(3, 0) * vqm[j];
+                    hessian->block<3, 3>(windices[i], windices[j]) += wqm[i].transpose() * anghess.block<3, 3>(3, 3) * wqm[j];
+                }
+
+                hessian->block<3, 3>(vindices[i], 3) += vqm[i].transpose() * anghess.block<3, 3>(0, 6);
+                hessian->block<3, 3>(3, vindices[i]) += anghess.block<3, 3>(6, 0) * vqm[i];
+                hessian->block<3, 3>(vindices[i], 0) += -vqm[i].transpose() * anghess.block<3, 3>(0, 6);
+                hessian->block<3, 3>(0, vindices[i]) += -anghess.block<3, 3>(6, 0) * vqm[i];
+
+                hessian->block<3, 3>(windices[i], 3) += wqm[i].transpose() * anghess.block<3, 3>(3, 6);
+                hessian->block<3, 3>(3, windices[i]) += anghess.block<3, 3>(6, 3) * wqm[i];
+                hessian->block<3, 3>(windices[i], 0) += -wqm[i].transpose() * anghess.block<3, 3>(3, 6);
+                hessian->block<3, 3>(0, windices[i]) += -anghess.block<3, 3>(6, 3) * wqm[i];
+
+            }
+
+            Eigen::Vector3d dang1 = angderiv.block<1, 3>(0, 0).transpose();
+            Eigen::Vector3d dang2 = angderiv.block<1, 3>(0, 3).transpose();
+
+            Eigen::Matrix3d dang1mat = crossMatrix(dang1);
+            Eigen::Matrix3d dang2mat = crossMatrix(dang2);
+
+            hessian->block<3, 3>(6, 3) += dang1mat;
+            hessian->block<3, 3>(0, 3) -= dang1mat;
+            hessian->block<3, 3>(0, 6) += dang1mat;
+            hessian->block<3, 3>(3, 0) += dang1mat;
+            hessian->block<3, 3>(3, 6) -= dang1mat;
+            hessian->block<3, 3>(6, 0) -= dang1mat;
+
+            hessian->block<3, 3>(9, 0) += dang2mat;
+            hessian->block<3, 3>(3, 0) -= dang2mat;
+            hessian->block<3, 3>(3, 9) += dang2mat;
+            hessian->block<3, 3>(0, 3) += dang2mat;
+            hessian->block<3, 3>(0, 9) -= dang2mat;
+            hessian->block<3, 3>(9, 3) -= dang2mat;
+        }
+
+        return theta;
+    }
+
+    Eigen::Matrix<double, 9, 9> projectedFirstFundamentalFormHessian(
+        const Eigen::Matrix<double, 4, 9>& aderiv,
+        const Eigen::Matrix2d& dWda,
+        const Eigen::Matrix4d& d2Wda2)
+    {
+        // a is symmetric, so rows 1 and 2 of aderiv agree: aderiv = S sderiv, with sderiv the derivative of (a00, a01, a11)
+        Eigen::Matrix<double, 4, 3> S;
+        S << 1, 0, 0,
+            0, 1, 0,
+            0, 1, 0,
+            0, 0, 1;
+        Eigen::Matrix<double, 3, 9> sderiv;
+        sderiv << aderiv.row(0), aderiv.row(1), aderiv.row(3);
+
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver(S.transpose() * d2Wda2 * S);
+        Eigen::Matrix<double, 3, 9> V = eigensolver.eigenvectors().transpose() * sderiv;
+        Eigen::Matrix<double, 9, 9> result = V.transpose() * eigensolver.eigenvalues().cwiseMax(0.0).asDiagonal() * V;
+
+        // sum_i dWda(i) ahess[i] = (2 D W D^T) (x) I_3, where W is the symmetric part of dWda and the columns of D are
+        // the derivatives of the edge vectors q1 - q0 and q2 - q0 with respect to the vertices
+        double p = dWda(0, 0);
+        double q = 0.5 * (dWda(0, 1) + dWda(1, 0));
+        double r = dWda(1, 1);
+        Eigen::Matrix2d W;
+        W << p, q,
+            q, r;
+        double mean = 0.5 * (p + r);
+        double radius = std::sqrt(0.25 * (p - r) * (p - r) + q * q);
+        double lambdamin = mean - radius;
+        double lambdamax = mean + radius;
+        if (lambdamax <= 0)
+        {
+            W.setZero();
+        }
+        else if (lambdamin < 0)
+        {
+            // remove the negative eigenpair; lambdamin < lambdamax, so at least one of these eigenvectors is nonzero
+            Eigen::Vector2d v1(q, lambdamin - p);
+            Eigen::Vector2d v2(lambdamin - r, q);
+            Eigen::Vector2d v = v1.squaredNorm() > v2.squaredNorm() ? v1 : v2;
+            W -= lambdamin / v.squaredNorm() * v * v.transpose();
+        }
+
+        Eigen::Matrix<double, 3, 2> D;
+        D << -1, -1,
+            1, 0,
+            0, 1;
+        Eigen::Matrix3d K = 2.0 * D * W * D.transpose();
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+                result.block<3, 3>(3 * i, 3 * j).diagonal().array() += K(i, j);
+        }
+        return result;
+    }
+
+    void computeEdgeThetas(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        bool derivatives,
+        bool hessians,
+        EdgeThetaCache& cache,
+        const ExecutionContext& ctx)
+    {
+        int nedges = mesh.nEdges();
+        cache.thetas.resize(nedges);
+        cache.derivatives.resize((derivatives || hessians) ? nedges : 0);
+        cache.hessians.resize(hessians ? nedges : 0);
+
+        parallelForChunks(nedges, resolveNumThreads(ctx.numThreads, nedges), [&](int, int begin, int end)
+            {
+                Eigen::Matrix<double, 12, 12> hess;
+                for (int i = begin; i < end; i++)
+                {
+                    cache.thetas[i] = edgeTheta(mesh, curPos, i,
+                        (derivatives || hessians) ? &cache.derivatives[i] : NULL,
+                        hessians ? &hess : NULL);
+                    if (hessians)
+                        cache.setHessian(i, hess);
+                }
+            });
+    }
+
+    void computeFaceNormals(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        bool derivatives,
+        bool hessians,
+        FaceNormalCache& cache,
+        const ExecutionContext& ctx)
+    {
+        int nfaces = mesh.nFaces();
+        cache.normals.resize(nfaces);
+        cache.derivatives.resize((derivatives || hessians) ? nfaces : 0);
+        cache.hasHessian = hessians && nfaces > 0;
+        if (cache.hasHessian)
+        {
+            // constant, so any face will do
+            faceNormal(mesh, curPos, 0, 0, NULL, &cache.hessian);
+        }
+
+        parallelForChunks(nfaces, resolveNumThreads(ctx.numThreads, nfaces), [&](int, int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    cache.normals[i] = faceNormal(mesh, curPos, i, 0, (derivatives || hessians) ? &cache.derivatives[i] : NULL, NULL);
+                }
+            });
+    }
+
 };
\ No newline at end of file
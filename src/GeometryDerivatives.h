@@ -2,11 +2,15 @@
 #define GEOMETRYDERIVATIVES_H
 
 #include <Eigen/Core>
+#include <array>
 #include <vector>
+#include "../include/types.h"
 
 namespace LibShell {
 
     class MeshConnectivity;
+    struct EdgeThetaCache;
+    struct FaceNormalCache;
 
     Eigen::Matrix3d crossMatrix(Eigen::Vector3d v);
     Eigen::Matrix2d adjugate(Eigen::Matrix2d M);
@@ -27,17 +31,17 @@ namespace LibShell {
     * Derivatives are with respect to vertices (startidx, startidx+1, startidx+2) of the face (modulo 3)
     */
     Eigen::Vector3d faceNormal(const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face, int startidx,
         Eigen::Matrix<double, 3, 9>* derivative,
-        std::vector<Eigen::Matrix<double, 9, 9> >* hessian);
+        std::array<Eigen::Matrix<double, 9, 9>, 3>* hessian);
 
     /*
     * Altitude to edge edgeidx.
     * Derivatives are with respect to vertices (edgeidx, edgeidx+1, edgeidx+2) of the face (modulo 3)
     */
     double triangleAltitude(const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face,
         int edgeidx,
         Eigen::Matrix<double, 1, 9>* derivative,
@@ -45,14 +49,96 @@ namespace LibShell {
 
     /*
      * With respect to the barycentric basis on face.
-     * Derivatives are with respect to vertices (0, 1, 2) of the face.
+     * Derivatives are with respect to vertices (0, 1, 2) of the face. The Hessians are constant (see
+     * firstFundamentalFormHessianStencils); prefer addFirstFundamentalFormHessian to contracting them.
      */
     Eigen::Matrix2d firstFundamentalForm(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face,
         Eigen::Matrix<double, 4, 9>* derivative, // F(face, i)
-        std::vector <Eigen::Matrix<double, 9, 9> >* hessian);
+        std::array<Eigen::Matrix<double, 9, 9>, 4>* hessian);
+
+    /*
+     * The first fundamental form is quadratic in the face vertices, so its Hessians are constant: the Hessian of entry i
+     * of a (indexed like the rows of the derivative of firstFundamentalForm) is K_i (x) I_3, for the 3 x 3 matrices
+     * K_i = firstFundamentalFormHessianStencils[i] acting on vertices (0, 1, 2) of the face.
+     */
+    constexpr double firstFundamentalFormHessianStencils[4][3][3] =
+    {
+        { { 2, -2, 0 }, { -2, 2, 0 }, { 0, 0, 0 } },
+        { { 2, -1, -1 }, { -1, 0, 1 }, { -1, 1, 0 } },
+        { { 2, -1, -1 }, { -1, 0, 1 }, { -1, 1, 0 } },
+        { { 2, 0, -2 }, { 0, 0, 0 }, { -2, 0, 2 } }
+    };
+
+    /*
+     * Adds sum_i w(i) ahess[i] (ahess the Hessians of the first fundamental form, w indexed like them) to the top-left 9 x 9
+     * block of hessian, without forming ahess: only the 27 nonzero entries of (sum_i w(i) K_i) (x) I_3 are touched.
+     */
+    template <class Derived>
+    void addFirstFundamentalFormHessian(const Eigen::Matrix2d& w, Eigen::MatrixBase<Derived>& hessian)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                double entry = 0;
+                for (int i = 0; i < 4; i++)
+                    entry += w(i) * firstFundamentalFormHessianStencils[i][j][k];
+                for (int l = 0; l < 3; l++)
+                    hessian(3 * j + l, 3 * k + l) += entry;
+            }
+        }
+    }
+
+    /*
+    * Dihedral angle across an edge (zero for boundary edges).
+    * Derivatives are with respect to edgeVertex(edge, 0), edgeVertex(edge, 1), then edgeOppositeVertex(edge, 0) and
+    * edgeOppositeVertex(edge, 1).
+    */
+    double edgeTheta(const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        int edge,
+        Eigen::Matrix<double, 1, 12>* derivative,
+        Eigen::Matrix<double, 12, 12>* hessian);
+
+    /*
+    * Fills cache with the dihedral angles of all mesh edges, and their derivatives (if derivatives or hessians) and
+    * Hessians (if hessians), in parallel over ctx.numThreads threads.
+    */
+    void computeEdgeThetas(const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        bool derivatives,
+        bool hessians,
+        EdgeThetaCache& cache,
+        const ExecutionContext& ctx);
+
+    /*
+    * Fills cache with the normals of all mesh faces, and their derivatives (if derivatives or hessians) and Hessian
+    * (if hessians), in parallel over ctx.numThreads threads.
+    */
+    void computeFaceNormals(const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        bool derivatives,
+        bool hessians,
+        FaceNormalCache& cache,
+        const ExecutionContext& ctx);
+
+    /*
+     * Positive semidefinite approximation of the Hessian of a function W(a) of the first fundamental form of a face.
+     * Takes the derivative aderiv of a (as computed by firstFundamentalForm), and the first (dWda) and second (d2Wda2)
+     * derivatives of W with respect to the entries of a, indexed like the rows of aderiv, so that the exact Hessian is
+     * aderiv^T d2Wda2 aderiv + sum_i dWda(i) ahess[i].
+     * The two terms are projected separately, which is much cheaper than an eigendecomposition of the 9 x 9 Hessian:
+     * d2Wda2 is projected in the three-dimensional space of symmetric first fundamental forms, and the second term,
+     * which is (D (dWda + dWda^T) D^T) (x) I_3 for a constant 3 x 2 matrix D, by clamping the eigenvalues of the
+     * symmetric part of dWda (in closed form).
+     */
+    Eigen::Matrix<double, 9, 9> projectedFirstFundamentalFormHessian(
+        const Eigen::Matrix<double, 4, 9>& aderiv,
+        const Eigen::Matrix2d& dWda,
+        const Eigen::Matrix4d& d2Wda2);
 
 };
 
@@ -0,0 +1,82 @@
+#include "../include/HessianAssemblyPlan.h"
+#include "../include/MeshConnectivity.h"
+
+#include "StencilDOFs.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace LibShell {
+
+    HessianAssemblyPlan::HessianAssemblyPlan() : nfaces(0), nedgedofs(0), nlocal(18), storagetype(HessianStorage::kFull)
+    {
+    }
+
+    HessianAssemblyPlan::HessianAssemblyPlan(const MeshConnectivity& mesh, int nverts, int numExtraDOFs, HessianStorage storage)
+        : nfaces(mesh.nFaces()), nedgedofs(numExtraDOFs), nlocal(18 + 3 * numExtraDOFs), storagetype(storage)
+    {
+        int ndofs = 3 * nverts + nedgedofs * mesh.nEdges();
+        std::vector<int> dofs(nlocal);
+
+        // every face's bending stencil covers its stretching stencil, so the bending blocks alone give the pattern
+        std::vector<Eigen::Triplet<double> > entries;
+        entries.reserve(countHessianTriplets(mesh, nverts, nedgedofs, false, true, storage, 0, nfaces));
+        for (int i = 0; i < nfaces; i++)
+        {
+            bendingStencil(mesh, nverts, nedgedofs, i, dofs.data());
+            for (int j = 0; j < nlocal; j++)
+            {
+                if (dofs[j] == -1)
+                    continue;
+                for (int k = 0; k < nlocal; k++)
+                {
+                    if (dofs[k] != -1 && isStoredEntry(storage, dofs[j], dofs[k]))
+                        entries.push_back(Eigen::Triplet<double>(dofs[j], dofs[k], 0.0));
+                }
+            }
+        }
+        pattern.resize(ndofs, ndofs);
+        pattern.setFromTriplets(entries.begin(), entries.end());
+        pattern.makeCompressed();
+        entries.clear();
+        entries.shrink_to_fit();
+
+        const int* outer = pattern.outerIndexPtr();
+        const int* inner = pattern.innerIndexPtr();
+        offsets.resize((size_t)nfaces * nlocal * nlocal);
+        for (int i = 0; i < nfaces; i++)
+        {
+            bendingStencil(mesh, nverts, nedgedofs, i, dofs.data());
+            int* faceoffs = offsets.data() + (size_t)i * nlocal * nlocal;
+            for (int j = 0; j < nlocal; j++)
+            {
+                for (int k = 0; k < nlocal; k++)
+                {
+                    if (dofs[j] == -1 || dofs[k] == -1 || !isStoredEntry(storage, dofs[j], dofs[k]))
+                    {
+                        faceoffs[j * nlocal + k] = -1;
+                        continue;
+                    }
+                    // column-major: entry (row, col) lives in the inner index range of column col
+                    const int* begin = inner + outer[dofs[k]];
+                    const int* end = inner + outer[dofs[k] + 1];
+                    faceoffs[j * nlocal + k] = (int)(std::lower_bound(begin, end, dofs[j]) - inner);
+                }
+            }
+        }
+    }
+
+    void HessianAssemblyPlan::initializeMatrix(Eigen::SparseMatrix<double>& H) const
+    {
+        H = pattern;
+    }
+
+    bool HessianAssemblyPlan::matches(const Eigen::SparseMatrix<double>& H) const
+    {
+        if (H.rows() != pattern.rows() || H.cols() != pattern.cols() || H.nonZeros() != pattern.nonZeros() || !H.isCompressed())
+            return false;
+        // the offsets are only valid for exactly the plan's pattern, not just any pattern with as many nonzeros
+        return std::equal(H.outerIndexPtr(), H.outerIndexPtr() + H.outerSize() + 1, pattern.outerIndexPtr())
+            && std::equal(H.innerIndexPtr(), H.innerIndexPtr() + H.nonZeros(), pattern.innerIndexPtr());
+    }
+};
@@ -0,0 +1,275 @@
+#include "../include/IncrementalElasticEnergy.h"
+#include "../include/MeshConnectivity.h"
+#include "../include/RestState.h"
+#include "../include/AssemblyWorkspace.h"
+#include "../include/MidedgeAngleSinFormulation.h"
+#include "../include/MidedgeAngleTanFormulation.h"
+#include "../include/MidedgeAverageFormulation.h"
+#include "../include/MidedgeAngleThetaFormulation.h"
+
+#include "ElasticShellAssembly.h"
+#include "StencilDOFs.h"
+#include "ParallelFor.h"
+
+#include <limits>
+#include <vector>
+
+namespace LibShell {
+
+    // Compressed face lists of the given per-face vertex lists: faces of vertex v are faces[offsets[v] .. offsets[v + 1])
+    static void buildVertexFaceLists(int nverts, const std::vector<std::vector<int> >& faceVertices, std::vector<int>& offsets, std::vector<int>& faces)
+    {
+        offsets.assign(nverts + 1, 0);
+        for (auto& verts : faceVertices)
+        {
+            for (int v : verts)
+                offsets[v + 1]++;
+        }
+        for (int i = 0; i < nverts; i++)
+            offsets[i + 1] += offsets[i];
+
+        faces.resize(offsets[nverts]);
+        std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for (int i = 0; i < (int)faceVertices.size(); i++)
+        {
+            for (int v : faceVertices[i])
+                faces[fill[v]++] = i;
+        }
+    }
+
+    template <class SFF>
+    IncrementalElasticEnergy<SFF>::IncrementalElasticEnergy(
+        const MeshConnectivity& mesh,
+        const MaterialModel<SFF>& mat,
+        const RestState& restState,
+        int nverts,
+        int whichTerms,
+        const HessianProjectType projType,
+        const HessianStorage storage)
+        : mesh(mesh), mat(mat), restState(restState), nverts(nverts), whichTerms(whichTerms), projType(projType),
+        assemblyPlan(mesh, nverts, SFF::numExtraDOFs, storage), evaluated(false), nupdated(0), totalEnergy(0), markStamp(0)
+    {
+        int nfaces = mesh.nFaces();
+        std::vector<std::vector<int> > stretchingVertices(nfaces), bendingVertices(nfaces);
+        for (int i = 0; i < nfaces; i++)
+        {
+            const FaceStencil& stencil = mesh.faceStencil(i);
+            for (int j = 0; j < 3; j++)
+            {
+                stretchingVertices[i].push_back(stencil.vertices[j]);
+                bendingVertices[i].push_back(stencil.vertices[j]);
+            }
+            for (int j = 0; j < 3; j++)
+            {
+                int opp = stencil.oppositeVertices[j];
+                if (opp != -1)
+                    bendingVertices[i].push_back(opp);
+            }
+        }
+        buildVertexFaceLists(nverts, stretchingVertices, vertexStretchingOffsets, vertexStretchingFaces);
+        buildVertexFaceLists(nverts, bendingVertices, vertexBendingOffsets, vertexBendingFaces);
+
+        stretchingEnergies.assign(nfaces, 0.0);
+        bendingEnergies.assign(nfaces, 0.0);
+        stretchingDerivatives.resize(nfaces);
+        stretchingHessians.resize(nfaces);
+        bendingDerivatives.resize(nfaces);
+        bendingHessians.resize(nfaces);
+        stretchingMarks.assign(nfaces, 0);
+        bendingMarks.assign(nfaces, 0);
+    }
+
+    template <class SFF>
+    bool IncrementalElasticEnergy<SFF>::sizesMatch(const Eigen::MatrixXd& curPos, const Eigen::VectorXd& edgeDOFs) const
+    {
+        return curPos.rows() == nverts && curPos.cols() == 3 && edgeDOFs.size() == SFF::numExtraDOFs * mesh.nEdges();
+    }
+
+    template <class SFF>
+    void IncrementalElasticEnergy<SFF>::computeStretching(const PositionsRef& curPos, int face)
+    {
+        stretchingEnergies[face] = mat.stretchingEnergy(mesh, curPos, restState, face, &stretchingDerivatives[face], &stretchingHessians[face], projType);
+        // materials supporting it return already projected Hessians
+        if (!(projType == HessianProjectType::kStrainSpace && mat.supportsStrainSpaceProjection()))
+            projSymMatrix(stretchingHessians[face], projType);
+    }
+
+    template <class SFF>
+    void IncrementalElasticEnergy<SFF>::computeBending(const PositionsRef& curPos, const EdgeDOFsRef& edgeDOFs, int face, const typename SFF::GeometryCache* cache)
+    {
+        bendingEnergies[face] = mat.bendingEnergy(mesh, curPos, edgeDOFs, restState, face, &bendingDerivatives[face], &bendingHessians[face], cache);
+        projSymMatrix(bendingHessians[face], projType);
+    }
+
+    template <class SFF>
+    void IncrementalElasticEnergy<SFF>::scatterStretching(int face, double sign)
+    {
+        int dofs[9];
+        stretchingStencil(mesh, face, dofs);
+        HessianSink sink = { assemblyPlan.storage(), NULL, &assemblyPlan, H.valuePtr(), NULL, NULL, NULL, NULL, NULL };
+        StretchingDerivative deriv = sign * stretchingDerivatives[face];
+        StretchingHessian hess = sign * stretchingHessians[face];
+        totalEnergy += sign * stretchingEnergies[face];
+        scatterGradient(dofs, deriv, gradient);
+        scatterHessian(face, dofs, hess, sink);
+    }
+
+    template <class SFF>
+    void IncrementalElasticEnergy<SFF>::scatterBending(int face, double sign)
+    {
+        int dofs[nbend];
+        bendingStencil(mesh, nverts, SFF::numExtraDOFs, face, dofs);
+        HessianSink sink = { assemblyPlan.storage(), NULL, &assemblyPlan, H.valuePtr(), NULL, NULL, NULL, NULL, NULL };
+        BendingDerivative deriv = sign * bendingDerivatives[face];
+        BendingHessian hess = sign * bendingHessians[face];
+        totalEnergy += sign * bendingEnergies[face];
+        scatterGradient(dofs, deriv, gradient);
+        scatterHessian(face, dofs, hess, sink);
+    }
+
+    template <class SFF>
+    double IncrementalElasticEnergy<SFF>::evaluate(const Eigen::MatrixXd& curPos, const Eigen::VectorXd& edgeDOFs, const ExecutionContext& ctx)
+    {
+        if (!sizesMatch(curPos, edgeDOFs))
+            return std::numeric_limits<double>::infinity();
+
+        PositionsRef positions(curPos);
+        EdgeDOFsRef extraDOFs(edgeDOFs);
+        bool stretching = whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING;
+        bool bending = whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING;
+
+        typename SFF::GeometryCache localCache;
+        typename SFF::GeometryCache& geometryCache = ctx.workspace ? ctx.workspace->geometryCache<typename SFF::GeometryCache>() : localCache;
+        if (bending)
+            SFF::computeGeometryCache(mesh, positions, true, true, geometryCache, ctx);
+
+        // every face writes only its own contributions
+        int nfaces = mesh.nFaces();
+        int nthreads = resolveNumThreads(ctx.numThreads, nfaces);
+        parallelForChunks(nfaces, nthreads, [&](int, int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    if (stretching)
+                        computeStretching(positions, i);
+                    if (bending)
+                        computeBending(positions, extraDOFs, i, &geometryCache);
+                }
+            });
+
+        totalEnergy = 0;
+        gradient.setZero(assemblyPlan.nDOFs());
+        if (assemblyPlan.matches(H))
+            H.coeffs().setZero();
+        else
+            assemblyPlan.initializeMatrix(H);
+        for (int i = 0; i < nfaces; i++)
+        {
+            if (stretching)
+                scatterStretching(i, 1.0);
+            if (bending)
+                scatterBending(i, 1.0);
+        }
+
+        evaluated = true;
+        nupdated = nfaces;
+        return totalEnergy;
+    }
+
+    template <class SFF>
+    double IncrementalElasticEnergy<SFF>::update(
+        const Eigen::MatrixXd& curPos,
+        const Eigen::VectorXd& edgeDOFs,
+        const std::vector<int>& dirtyVertices,
+        const std::vector<int>& dirtyEdges,
+        const ExecutionContext& ctx)
+    {
+        if (!evaluated || !sizesMatch(curPos, edgeDOFs))
+            return std::numeric_limits<double>::infinity();
+
+        PositionsRef positions(curPos);
+        EdgeDOFsRef extraDOFs(edgeDOFs);
+        bool stretching = whichTerms & ElasticShell<SFF>::EnergyTerm::ET_STRETCHING;
+        bool bending = whichTerms & ElasticShell<SFF>::EnergyTerm::ET_BENDING;
+
+        // affected faces, each listed once
+        markStamp++;
+        std::vector<int> stretchingFaces, bendingFaces;
+        for (int v : dirtyVertices)
+        {
+            if (stretching)
+            {
+                for (int j = vertexStretchingOffsets[v]; j < vertexStretchingOffsets[v + 1]; j++)
+                {
+                    int face = vertexStretchingFaces[j];
+                    if (stretchingMarks[face] != markStamp)
+                    {
+                        stretchingMarks[face] = markStamp;
+                        stretchingFaces.push_back(face);
+                    }
+                }
+            }
+            if (bending)
+            {
+                for (int j = vertexBendingOffsets[v]; j < vertexBendingOffsets[v + 1]; j++)
+                {
+                    int face = vertexBendingFaces[j];
+                    if (bendingMarks[face] != markStamp)
+                    {
+                        bendingMarks[face] = markStamp;
+                        bendingFaces.push_back(face);
+                    }
+                }
+            }
+        }
+        if (bending && SFF::numExtraDOFs > 0)
+        {
+            for (int e : dirtyEdges)
+            {
+                for (int j = 0; j < 2; j++)
+                {
+                    int face = mesh.edgeFace(e, j);
+                    if (face != -1 && bendingMarks[face] != markStamp)
+                    {
+                        bendingMarks[face] = markStamp;
+                        bendingFaces.push_back(face);
+                    }
+                }
+            }
+        }
+
+        for (int face : stretchingFaces)
+            scatterStretching(face, -1.0);
+        for (int face : bendingFaces)
+            scatterBending(face, -1.0);
+
+        // the per-edge geometry cache would cost a pass over the whole mesh, so the few affected faces compute it themselves
+        int nstretching = (int)stretchingFaces.size();
+        int nitems = nstretching + (int)bendingFaces.size();
+        int nthreads = resolveNumThreads(ctx.numThreads, nitems);
+        parallelForChunks(nitems, nthreads, [&](int, int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    if (i < nstretching)
+                        computeStretching(positions, stretchingFaces[i]);
+                    else
+                        computeBending(positions, extraDOFs, bendingFaces[i - nstretching], NULL);
+                }
+            });
+
+        for (int face : stretchingFaces)
+            scatterStretching(face, 1.0);
+        for (int face : bendingFaces)
+            scatterBending(face, 1.0);
+
+        nupdated = (int)(stretchingFaces.size() > bendingFaces.size() ? stretchingFaces.size() : bendingFaces.size());
+        return totalEnergy;
+    }
+
+    // instantions
+    template class IncrementalElasticEnergy<MidedgeAngleThetaFormulation>;
+    template class IncrementalElasticEnergy<MidedgeAngleSinFormulation>;
+    template class IncrementalElasticEnergy<MidedgeAngleTanFormulation>;
+    template class IncrementalElasticEnergy<MidedgeAverageFormulation>;
+};
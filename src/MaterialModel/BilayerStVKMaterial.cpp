@@ -1,7 +1,9 @@
 #include "../../include/BilayerStVKMaterial.h"
 #include "../../include/MeshConnectivity.h"
+#include <array>
 #include <vector>
 #include "../GeometryDerivatives.h"
+#include "../ElasticShellAssembly.h"
 #include <Eigen/Dense>
 #include "../../include/MidedgeAngleSinFormulation.h"
 #include "../../include/MidedgeAngleTanFormulation.h"
@@ -15,11 +17,12 @@ namespace LibShell {
     template <class SFF>
     double BilayerStVKMaterial<SFF>::stretchingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         const RestState& restState,
         int face,
         Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
-        Eigen::Matrix<double, 9, 9>* hessian) const
+        Eigen::Matrix<double, 9, 9>* hessian,
+        HessianProjectType /*projType*/) const
     {
         using namespace Eigen;
 
@@ -27,20 +30,21 @@ namespace LibShell {
         const BilayerRestState& rs = (const BilayerRestState&)restState;
 
         Matrix<double, 4, 9> aderiv;
-        std::vector<Matrix<double, 9, 9> > ahess;
-        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, hessian ? &ahess : NULL);
+        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, NULL);
 
+        const RestFaceData& restData1 = rs.layers[0].faceData(face);
         double coeff1 = rs.layers[0].thicknesses[face] / 8.0;
-        Matrix2d abar1inv = rs.layers[0].abars[face].inverse();
+        Matrix2d abar1inv = restData1.abarinv;
         Matrix2d M1 = abar1inv * (a - rs.layers[0].abars[face]);
-        double dA1 = 0.5 * sqrt(rs.layers[0].abars[face].determinant());
+        double dA1 = restData1.dA;
         double lameAlpha1 = rs.layers[0].lameAlpha[face];
         double lameBeta1 = rs.layers[0].lameBeta[face];
 
+        const RestFaceData& restData2 = rs.layers[1].faceData(face);
         double coeff2 = rs.layers[1].thicknesses[face] / 8.0;
-        Matrix2d abar2inv = rs.layers[1].abars[face].inverse();
+        Matrix2d abar2inv = restData2.abarinv;
         Matrix2d M2 = abar2inv * (a - rs.layers[1].abars[face]);
-        double dA2 = 0.5 * sqrt(rs.layers[1].abars[face].determinant());
+        double dA2 = restData2.dA;
         double lameAlpha2 = rs.layers[1].lameAlpha[face];
         double lameBeta2 = rs.layers[1].lameBeta[face];
 
@@ -65,11 +69,8 @@ namespace LibShell {
 
             Matrix2d Mainv1 = M1 * abar1inv;
             Matrix2d Mainv2 = M2 * abar2inv;
-            for (int i = 0; i < 4; ++i) // iterate over Mainv and abarinv as if they were vectors
-            {
-                *hessian += coeff1 * dA1 * (lameAlpha1 * M1.trace() * abar1inv(i) + 2 * lameBeta1 * Mainv1(i)) * ahess[i];
-                *hessian += coeff2 * dA2 * (lameAlpha2 * M2.trace() * abar2inv(i) + 2 * lameBeta2 * Mainv2(i)) * ahess[i];
-            }
+            addFirstFundamentalFormHessian(coeff1 * dA1 * (lameAlpha1 * M1.trace() * abar1inv + 2 * lameBeta1 * Mainv1)
+                + coeff2 * dA2 * (lameAlpha2 * M2.trace() * abar2inv + 2 * lameBeta2 * Mainv2), *hessian);
 
             Matrix<double, 1, 9> inner001 = abar1inv(0, 0) * aderiv.row(0) + abar1inv(0, 1) * aderiv.row(2);
             Matrix<double, 1, 9> inner011 = abar1inv(0, 0) * aderiv.row(1) + abar1inv(0, 1) * aderiv.row(3);
@@ -94,12 +95,13 @@ namespace LibShell {
     template <class SFF>
     double BilayerStVKMaterial<SFF>::bendingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const Eigen::VectorXd& extraDOFs,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
         const RestState& restState,
         int face,
         Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
-        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian) const
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+        const typename SFF::GeometryCache* geometryCache) const
     {
         using namespace Eigen;
 
@@ -108,20 +110,22 @@ namespace LibShell {
 
         constexpr int nedgedofs = SFF::numExtraDOFs;
         Matrix<double, 4, 18 + 3 * nedgedofs> bderiv;
-        std::vector<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> > bhess;
-        Matrix2d b = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, face, (derivative || hessian) ? &bderiv : NULL, hessian ? &bhess : NULL);
+        std::array<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs>, 4> bhess;
+        Matrix2d b = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, face, (derivative || hessian) ? &bderiv : NULL, hessian ? &bhess : NULL, geometryCache);
 
-        double coeff1 = pow(rs.layers[0].thicknesses[face], 3) / 24;
-        Matrix2d abarinv1 = rs.layers[0].abars[face].inverse();
+        const RestFaceData& restData1 = rs.layers[0].faceData(face);
+        double coeff1 = restData1.bendingCoeff / 2;
+        Matrix2d abarinv1 = restData1.abarinv;
         Matrix2d M1 = abarinv1 * (b - rs.layers[0].bbars[face]);
-        double dA1 = 0.5 * sqrt(rs.layers[0].abars[face].determinant());
+        double dA1 = restData1.dA;
         double lameAlpha1 = rs.layers[0].lameAlpha[face];
         double lameBeta1 = rs.layers[0].lameBeta[face];
 
-        double coeff2 = pow(rs.layers[1].thicknesses[face], 3) / 24;
-        Matrix2d abarinv2 = rs.layers[1].abars[face].inverse();
+        const RestFaceData& restData2 = rs.layers[1].faceData(face);
+        double coeff2 = restData2.bendingCoeff / 2;
+        Matrix2d abarinv2 = restData2.abarinv;
         Matrix2d M2 = abarinv2 * (b - rs.layers[1].bbars[face]);
-        double dA2 = 0.5 * sqrt(rs.layers[1].abars[face].determinant());
+        double dA2 = restData2.dA;
         double lameAlpha2 = rs.layers[1].lameAlpha[face];
         double lameBeta2 = rs.layers[1].lameBeta[face];
 
@@ -131,18 +135,7 @@ namespace LibShell {
         double result = coeff1 * dA1 * StVK1 + coeff2 * dA2 * StVK2;
 
         Matrix<double, 4, 9> aderiv;
-        std::vector<Matrix<double, 9, 9> > ahess;
-        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, hessian ? &ahess : NULL);
-
-        std::vector<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> > augahess(4);
-        if (hessian)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                augahess[i].setZero();
-                augahess[i].template block<9, 9>(0, 0) = ahess[i];
-            }
-        }
+        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, NULL);
 
         double crossTermCoeff1 = std::pow(rs.layers[0].thicknesses[face], 2) / 8.0;
         Matrix2d sigma1 = abarinv1 * (a - rs.layers[0].abars[face]);
@@ -203,11 +196,12 @@ namespace LibShell {
                 *hessian += coeff1 * dA1 * (lameAlpha1 * M1.trace() * abarinv1(i) + 2 * lameBeta1 * Mainv1(i)) * bhess[i];
                 *hessian += coeff2 * dA2 * (lameAlpha2 * M2.trace() * abarinv2(i) + 2 * lameBeta2 * Mainv2(i)) * bhess[i];
 
-                *hessian += crossTermCoeff1 * dA1 * (0.5 * lameAlpha1 * M1.trace() * abarinv1(i) + lameBeta1 * Mainv1(i)) * augahess[i];
-                *hessian += crossTermCoeff2 * dA2 * (0.5 * lameAlpha2 * M2.trace() * abarinv2(i) + lameBeta2 * Mainv2(i)) * augahess[i];
                 *hessian += crossTermCoeff1 * dA1 * (0.5 * lameAlpha1 * sigma1.trace() * abarinv1(i) + lameBeta1 * Sainv1(i)) * bhess[i];
                 *hessian += crossTermCoeff2 * dA2 * (0.5 * lameAlpha2 * sigma2.trace() * abarinv2(i) + lameBeta2 * Sainv2(i)) * bhess[i];
             }
+            // the first fundamental form only depends on the face vertices, the top-left 9 x 9 block
+            addFirstFundamentalFormHessian(crossTermCoeff1 * dA1 * (0.5 * lameAlpha1 * M1.trace() * abarinv1 + lameBeta1 * Mainv1)
+                + crossTermCoeff2 * dA2 * (0.5 * lameAlpha2 * M2.trace() * abarinv2 + lameBeta2 * Mainv2), *hessian);
 
             Matrix<double, 1, 18 + 3 * nedgedofs> inner001 = abarinv1(0, 0) * bderiv.row(0) + abarinv1(0, 1) * bderiv.row(2);
             Matrix<double, 1, 18 + 3 * nedgedofs> inner011 = abarinv1(0, 0) * bderiv.row(1) + abarinv1(0, 1) * bderiv.row(3);
@@ -274,4 +268,11 @@ namespace LibShell {
     template class BilayerStVKMaterial<MidedgeAngleTanFormulation>;
     template class BilayerStVKMaterial<MidedgeAverageFormulation>;
     template class BilayerStVKMaterial<MidedgeAngleThetaFormulation>;
+
+    // statically dispatched assembly (ElasticShell::elasticEnergy<BilayerStVKMaterial<SFF> >), instantiated here so that the kernels above
+    // can be inlined into it
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(BilayerStVKMaterial, MidedgeAngleSinFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(BilayerStVKMaterial, MidedgeAngleTanFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(BilayerStVKMaterial, MidedgeAverageFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(BilayerStVKMaterial, MidedgeAngleThetaFormulation)
 };
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "../../include/NeoHookeanMaterial.h"
 #include "../../include/MeshConnectivity.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <vector>
 #include "../GeometryDerivatives.h"
+#include "../ElasticShellAssembly.h"
+#include "../FaceBatch.h"
 #include <Eigen/Dense>
 #include <iostream>
 #include "../../include/MidedgeAngleSinFormulation.h"
@@ -12,33 +17,28 @@
 
 namespace LibShell {
 
-    template <class SFF>
-    double NeoHookeanMaterial<SFF>::stretchingEnergy(
-        const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const RestState& restState,
+    // Stretching energy of face, given its first fundamental form a and (if derivative or hessian) the derivative aderiv of a
+    static double neoHookeanStretchingEnergy(
+        const MonolayerRestState& rs,
         int face,
-        Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
-        Eigen::Matrix<double, 9, 9>* hessian) const
+        const Eigen::Matrix2d& a,
+        const Eigen::Matrix<double, 4, 9>& aderiv,
+        Eigen::Matrix<double, 1, 9>* derivative,
+        Eigen::Matrix<double, 9, 9>* hessian,
+        HessianProjectType projType)
     {
         using namespace Eigen;
 
-        assert(restState.type() == RestStateType::RST_MONOLAYER);
-        const MonolayerRestState& rs = (const MonolayerRestState&)restState;
-
-        Matrix<double, 4, 9> aderiv;
-        std::vector<Matrix<double, 9, 9> > ahess;
-        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, hessian ? &ahess : NULL);
-
+        const RestFaceData& restData = rs.faceData(face);
         double deta = a.determinant();
-        double detabar = rs.abars[face].determinant();
+        double detabar = restData.abardet;
         double lnJ = std::log(deta / detabar) / 2;
-        Matrix2d abarinv = adjugate(rs.abars[face]) / detabar;
+        Matrix2d abarinv = restData.abarinv;
         double lameAlpha = rs.lameAlpha[face];
         double lameBeta = rs.lameBeta[face];
 
         double result = lameBeta * ((abarinv * a).trace() - 2 - 2 * lnJ) + lameAlpha * pow(lnJ, 2);
-        double coeff = rs.thicknesses[face] * std::sqrt(detabar) / 4;
+        double coeff = rs.thicknesses[face] * restData.dA / 2;
         result *= coeff;
 
         if (derivative)
@@ -51,7 +51,26 @@ namespace LibShell {
             *derivative *= coeff;
         }
 
-        if (hessian)
+        if (hessian && projType == HessianProjectType::kStrainSpace)
+        {
+            // the terms below, with aderiv replaced by the identity
+            Matrix2d ainv = adjugate(a) / deta;
+            double term1 = -lameBeta + lameAlpha * lnJ;
+
+            Matrix2d dWda = term1 * ainv + lameBeta * abarinv;
+            Vector4d ainvda = Map<Vector4d>(ainv.data());
+            Matrix4d d2Wda2 = (-term1 + lameAlpha / 2) * ainvda * ainvda.transpose();
+
+            Matrix4d adjda;
+            adjda << 0, 0, 0, 1,
+                0, -1, 0, 0,
+                0, 0, -1, 0,
+                1, 0, 0, 0;
+            d2Wda2 += term1 / deta * adjda;
+
+            *hessian = coeff * projectedFirstFundamentalFormHessian(aderiv, dWda, d2Wda2);
+        }
+        else if (hessian)
         {
             hessian->setZero();
 
@@ -66,8 +85,7 @@ namespace LibShell {
 
             *hessian += term1 / deta * aderivadj.transpose() * aderiv;
 
-            for (int i = 0; i < 4; ++i)
-                *hessian += (term1 * ainv(i) + lameBeta * abarinv(i)) * ahess[i];
+            addFirstFundamentalFormHessian(term1 * ainv + lameBeta * abarinv, *hessian);
 
             *hessian *= coeff;
         }
@@ -75,56 +93,67 @@ namespace LibShell {
         return result;
     }
 
+
     template <class SFF>
-    double NeoHookeanMaterial<SFF>::bendingEnergy(
+    double NeoHookeanMaterial<SFF>::stretchingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const Eigen::VectorXd& extraDOFs,
+        const PositionsRef& curPos,
         const RestState& restState,
         int face,
-        Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
-        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian) const
+        Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
+        Eigen::Matrix<double, 9, 9>* hessian,
+        HessianProjectType projType) const
     {
-        using namespace Eigen;
-
         assert(restState.type() == RestStateType::RST_MONOLAYER);
         const MonolayerRestState& rs = (const MonolayerRestState&)restState;
 
+        Eigen::Matrix<double, 4, 9> aderiv;
+        Eigen::Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, NULL);
+        return neoHookeanStretchingEnergy(rs, face, a, aderiv, derivative, hessian, projType);
+    }
+
+    /*
+     * Bending energy of face, given its first fundamental form a and (if derivative or hessian) the derivative aderivsmall
+     * of a with respect to the face vertices
+     */
+    template <class SFF>
+    static double neoHookeanBendingEnergy(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const MonolayerRestState& rs,
+        int face,
+        const Eigen::Matrix2d& a,
+        const Eigen::Matrix<double, 4, 9>& aderivsmall,
+        Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative,
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+        const typename SFF::GeometryCache* geometryCache)
+    {
+        using namespace Eigen;
+
+        const RestFaceData& restData = rs.faceData(face);
         constexpr int nedgedofs = SFF::numExtraDOFs;
-        Matrix2d abarinv = rs.abars[face].inverse();
         Matrix<double, 4, 18 + 3 * nedgedofs> bderiv;
-        std::vector<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> > bhess;
-        Matrix2d b = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, face, (derivative || hessian) ? &bderiv : NULL, hessian ? &bhess : NULL);
+        std::array<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs>, 4> bhess;
+        Matrix2d b = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, face, (derivative || hessian) ? &bderiv : NULL, hessian ? &bhess : NULL, geometryCache);
 
-        Matrix<double, 4, 9> aderivsmall;
-        std::vector<Matrix<double, 9, 9> > ahesssmall;
-        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderivsmall : NULL, hessian ? &ahesssmall : NULL);
         Matrix<double, 4, 18 + 3 * nedgedofs> aderiv;
         if (derivative || hessian)
         {
             aderiv.setZero();
             aderiv.block(0, 0, 4, 9) = aderivsmall;
         }
-        std::vector<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> > ahess = bhess;
-        if (hessian)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                ahess[i].setZero();
-                ahess[i].block(0, 0, 9, 9) = ahesssmall[i];
-            }
-        }
 
-        Matrix2d abaradj = adjugate(rs.abars[face]);
+        Matrix2d abaradj = restData.abaradj;
         Matrix2d bbaradj = adjugate(rs.bbars[face]);
         Matrix2d aadj = adjugate(a);
         Matrix2d badj = adjugate(b);
         double deta = a.determinant();
-        double detabar = rs.abars[face].determinant();
+        double detabar = restData.abardet;
         double lameAlpha = rs.lameAlpha[face];
         double lameBeta = rs.lameBeta[face];
 
-        double coeff = std::sqrt(detabar) * pow(rs.thicknesses[face], 3) / 24;
+        double coeff = restData.dA * restData.bendingCoeff;
 
         Matrix2d M = aadj * b / deta - abaradj * rs.bbars[face] / detabar;
         double result = coeff * (lameBeta * (M * M).trace() + 0.5 * lameAlpha * pow(M.trace(), 2));
@@ -236,10 +265,7 @@ namespace LibShell {
 
             double term3 = lameBeta * 2.0 / pow(deta, 2);
             Matrix2d m5 = badj * a * badj;
-            *hessian += term3 * m5(0, 0) * ahess[0];
-            *hessian += term3 * m5(0, 1) * ahess[1];
-            *hessian += term3 * m5(1, 0) * ahess[2];
-            *hessian += term3 * m5(1, 1) * ahess[3];
+            addFirstFundamentalFormHessian(term3 * m5, *hessian);
 
             Matrix2d m6 = badj * a;
             *hessian += term3 * (m6(0, 0) * bderiv.row(3).transpose() + m6(0, 1) * -bderiv.row(2).transpose()) * aderiv.row(0);
@@ -267,10 +293,7 @@ namespace LibShell {
             *hessian += term4 * aadjda.transpose() * m8da;
 
             double term5 = lameBeta * -2.0 / pow(deta, 3) * (aadj * b * aadj * b).trace();
-            *hessian += term5 * aadj(0, 0) * ahess[0];
-            *hessian += term5 * aadj(0, 1) * ahess[1];
-            *hessian += term5 * aadj(1, 0) * ahess[2];
-            *hessian += term5 * aadj(1, 1) * ahess[3];
+            addFirstFundamentalFormHessian(term5 * aadj, *hessian);
 
             *hessian += term5 * aderiv.row(3).transpose() * aderiv.row(0);
             *hessian += term5 * -aderiv.row(1).transpose() * aderiv.row(1);
@@ -325,10 +348,7 @@ namespace LibShell {
             *hessian += term10 * (m14(0, 0) * bderiv.row(0).transpose() + m14(0, 1) * bderiv.row(2).transpose()) * aderiv.row(3);
 
             Matrix2d m15 = badj * rs.abars[face] * bbaradj / detabar;
-            *hessian += term10 * m15(0, 0) * ahess[0];
-            *hessian += term10 * m15(0, 1) * ahess[1];
-            *hessian += term10 * m15(1, 0) * ahess[2];
-            *hessian += term10 * m15(1, 1) * ahess[3];
+            addFirstFundamentalFormHessian(term10 * m15, *hessian);
 
             double term11 = lameBeta * 2.0 / pow(deta, 2);
             Matrix2d m16 = badj * rs.abars[face] * bbaradj / detabar;
@@ -347,10 +367,7 @@ namespace LibShell {
             *hessian += term12 * -aderiv.row(1).transpose() * aderiv.row(1);
             *hessian += term12 * -aderiv.row(2).transpose() * aderiv.row(2);
             *hessian += term12 * aderiv.row(0).transpose() * aderiv.row(3);
-            *hessian += term12 * aadj(0, 0) * ahess[0];
-            *hessian += term12 * aadj(0, 1) * ahess[1];
-            *hessian += term12 * aadj(1, 0) * ahess[2];
-            *hessian += term12 * aadj(1, 1) * ahess[3];
+            addFirstFundamentalFormHessian(term12 * aadj, *hessian);
 
             double term13 = lameBeta * -4.0 / pow(deta, 2) / deta * (aadj * b * abaradj * rs.bbars[face]).trace() / detabar;
             *hessian += term13 * aadjda.transpose() * aadjda;
@@ -362,10 +379,7 @@ namespace LibShell {
             *hessian += term14 * -bderiv.row(1).transpose() * aderiv.row(1);
             *hessian += term14 * -bderiv.row(2).transpose() * aderiv.row(2);
             *hessian += term14 * bderiv.row(0).transpose() * aderiv.row(3);
-            *hessian += term14 * badj(0, 0) * ahess[0];
-            *hessian += term14 * badj(0, 1) * ahess[1];
-            *hessian += term14 * badj(1, 0) * ahess[2];
-            *hessian += term14 * badj(1, 1) * ahess[3];
+            addFirstFundamentalFormHessian(term14 * badj, *hessian);
             *hessian += term14 * aderiv.row(3).transpose() * bderiv.row(0);
             *hessian += term14 * -aderiv.row(1).transpose() * bderiv.row(1);
             *hessian += term14 * -aderiv.row(2).transpose() * bderiv.row(2);
@@ -388,10 +402,7 @@ namespace LibShell {
             *hessian += term15 * aadjda.transpose() * aadjdb;
 
             double term16 = lameAlpha * 1.0 * (abaradj * rs.bbars[face] / detabar - aadj * b / deta).trace() / pow(deta, 2) * (aadj * b).trace();
-            *hessian += term16 * aadj(0, 0) * ahess[0];
-            *hessian += term16 * aadj(1, 0) * ahess[1];
-            *hessian += term16 * aadj(0, 1) * ahess[2];
-            *hessian += term16 * aadj(1, 1) * ahess[3];
+            addFirstFundamentalFormHessian(term16 * aadj, *hessian);
             *hessian += term16 * aderiv.row(3).transpose() * aderiv.row(0);
             *hessian += term16 * -aderiv.row(1).transpose() * aderiv.row(1);
             *hessian += term16 * -aderiv.row(2).transpose() * aderiv.row(2);
@@ -425,9 +436,169 @@ namespace LibShell {
         return result;
     }
 
+    template <class SFF>
+    double NeoHookeanMaterial<SFF>::bendingEnergy(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const RestState& restState,
+        int face,
+        Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+        const typename SFF::GeometryCache* geometryCache) const
+    {
+        assert(restState.type() == RestStateType::RST_MONOLAYER);
+        const MonolayerRestState& rs = (const MonolayerRestState&)restState;
+
+        Eigen::Matrix<double, 4, 9> aderiv;
+        Eigen::Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, NULL);
+        return neoHookeanBendingEnergy<SFF>(mesh, curPos, extraDOFs, rs, face, a, aderiv, derivative, hessian, geometryCache);
+    }
+
+    template <class SFF>
+    double NeoHookeanMaterial<SFF>::stretchingAndBendingEnergy(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const RestState& restState,
+        int face,
+        Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative,
+        Eigen::Matrix<double, 9, 9>* stretchingHessian,
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* bendingHessian,
+        HessianProjectType projType,
+        const typename SFF::GeometryCache* geometryCache) const
+    {
+        assert(restState.type() == RestStateType::RST_MONOLAYER);
+        const MonolayerRestState& rs = (const MonolayerRestState&)restState;
+
+        // shared by both terms
+        Eigen::Matrix<double, 4, 9> aderiv;
+        Eigen::Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || stretchingHessian || bendingHessian) ? &aderiv : NULL, NULL);
+
+        Eigen::Matrix<double, 1, 9> stretchingDerivative;
+        double result = neoHookeanStretchingEnergy(rs, face, a, aderiv, derivative ? &stretchingDerivative : NULL, stretchingHessian, projType);
+        result += neoHookeanBendingEnergy<SFF>(mesh, curPos, extraDOFs, rs, face, a, aderiv, derivative, bendingHessian, geometryCache);
+        if (derivative)
+            derivative->template head<9>() += stretchingDerivative;
+        return result;
+    }
+
+    static void neoHookeanStretchingEnergies(const MeshConnectivity& mesh, const PositionsRef& curPos, const MonolayerRestState& rs,
+        int nfaces, const int* faces, double* energies)
+    {
+        MatrixBatch a, abarinv;
+        double detabar[energyBatchSize], coeffs[energyBatchSize], lameAlpha[energyBatchSize], lameBeta[energyBatchSize];
+        for (int start = 0; start < nfaces; start += energyBatchSize)
+        {
+            int n = std::min(energyBatchSize, nfaces - start);
+            const int* batch = faces + start;
+            gatherFirstFundamentalForms(mesh, curPos, n, batch, a);
+            for (int i = 0; i < n; i++)
+            {
+                const RestFaceData& restData = rs.faceData(batch[i]);
+                for (int k = 0; k < 4; k++)
+                    abarinv.m[k][i] = restData.abarinv(k);
+                detabar[i] = restData.abardet;
+                coeffs[i] = rs.thicknesses[batch[i]] * restData.dA / 2;
+            }
+            gatherScalars(rs.lameAlpha, n, batch, lameAlpha);
+            gatherScalars(rs.lameBeta, n, batch, lameBeta);
+
+            for (int i = 0; i < n; i++)
+            {
+                double deta = a.m[0][i] * a.m[3][i] - a.m[1][i] * a.m[2][i];
+                double lnJ = std::log(deta / detabar[i]) / 2;
+                double tr = abarinv.m[0][i] * a.m[0][i] + abarinv.m[2][i] * a.m[1][i] + abarinv.m[1][i] * a.m[2][i] + abarinv.m[3][i] * a.m[3][i];
+                energies[start + i] = coeffs[i] * (lameBeta[i] * (tr - 2 - 2 * lnJ) + lameAlpha[i] * (lnJ * lnJ));
+            }
+        }
+    }
+
+    template <class SFF>
+    static void neoHookeanBendingEnergies(const MeshConnectivity& mesh, const PositionsRef& curPos, const EdgeDOFsRef& extraDOFs,
+        const MonolayerRestState& rs, int nfaces, const int* faces, double* energies, const typename SFF::GeometryCache* geometryCache)
+    {
+        MatrixBatch a, b, bbar, abaradj;
+        double detabar[energyBatchSize], coeffs[energyBatchSize], lameAlpha[energyBatchSize], lameBeta[energyBatchSize];
+        for (int start = 0; start < nfaces; start += energyBatchSize)
+        {
+            int n = std::min(energyBatchSize, nfaces - start);
+            const int* batch = faces + start;
+            gatherFirstFundamentalForms(mesh, curPos, n, batch, a);
+            gatherSecondFundamentalForms<SFF>(mesh, curPos, extraDOFs, n, batch, geometryCache, b);
+            gatherMatrices(rs.bbars, n, batch, bbar);
+            for (int i = 0; i < n; i++)
+            {
+                const RestFaceData& restData = rs.faceData(batch[i]);
+                for (int k = 0; k < 4; k++)
+                    abaradj.m[k][i] = restData.abaradj(k);
+                detabar[i] = restData.abardet;
+                coeffs[i] = restData.dA * restData.bendingCoeff;
+            }
+            gatherScalars(rs.lameAlpha, n, batch, lameAlpha);
+            gatherScalars(rs.lameBeta, n, batch, lameBeta);
+
+            // M = adj(a) b / det(a) - adj(abar) bbar / det(abar)
+            for (int i = 0; i < n; i++)
+            {
+                double deta = a.m[0][i] * a.m[3][i] - a.m[1][i] * a.m[2][i];
+                double m00 = (a.m[3][i] * b.m[0][i] - a.m[2][i] * b.m[1][i]) / deta
+                    - (abaradj.m[0][i] * bbar.m[0][i] + abaradj.m[2][i] * bbar.m[1][i]) / detabar[i];
+                double m10 = (-a.m[1][i] * b.m[0][i] + a.m[0][i] * b.m[1][i]) / deta
+                    - (abaradj.m[1][i] * bbar.m[0][i] + abaradj.m[3][i] * bbar.m[1][i]) / detabar[i];
+                double m01 = (a.m[3][i] * b.m[2][i] - a.m[2][i] * b.m[3][i]) / deta
+                    - (abaradj.m[0][i] * bbar.m[2][i] + abaradj.m[2][i] * bbar.m[3][i]) / detabar[i];
+                double m11 = (-a.m[1][i] * b.m[2][i] + a.m[0][i] * b.m[3][i]) / deta
+                    - (abaradj.m[1][i] * bbar.m[2][i] + abaradj.m[3][i] * bbar.m[3][i]) / detabar[i];
+                double tr = m00 + m11;
+                double trsq = m00 * m00 + 2 * m01 * m10 + m11 * m11;
+                energies[start + i] = coeffs[i] * (lameBeta[i] * trsq + 0.5 * lameAlpha[i] * (tr * tr));
+            }
+        }
+    }
+
+    template <class SFF>
+    void NeoHookeanMaterial<SFF>::stretchingEnergies(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const RestState& restState,
+        int nfaces,
+        const int* faces,
+        double* energies) const
+    {
+        assert(restState.type() == RestStateType::RST_MONOLAYER);
+        const MonolayerRestState& rs = (const MonolayerRestState&)restState;
+
+        neoHookeanStretchingEnergies(mesh, curPos, rs, nfaces, faces, energies);
+    }
+
+    template <class SFF>
+    void NeoHookeanMaterial<SFF>::bendingEnergies(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const RestState& restState,
+        int nfaces,
+        const int* faces,
+        double* energies,
+        const typename SFF::GeometryCache* geometryCache) const
+    {
+        assert(restState.type() == RestStateType::RST_MONOLAYER);
+        const MonolayerRestState& rs = (const MonolayerRestState&)restState;
+
+        neoHookeanBendingEnergies<SFF>(mesh, curPos, extraDOFs, rs, nfaces, faces, energies, geometryCache);
+    }
+
     // instantiations
     template class NeoHookeanMaterial<MidedgeAngleSinFormulation>;
     template class NeoHookeanMaterial<MidedgeAngleTanFormulation>;
     template class NeoHookeanMaterial<MidedgeAverageFormulation>;
     template class NeoHookeanMaterial<MidedgeAngleThetaFormulation>;
+
+    // statically dispatched assembly (ElasticShell::elasticEnergy<NeoHookeanMaterial<SFF> >), instantiated here so that the kernels above
+    // can be inlined into it
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(NeoHookeanMaterial, MidedgeAngleSinFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(NeoHookeanMaterial, MidedgeAngleTanFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(NeoHookeanMaterial, MidedgeAverageFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(NeoHookeanMaterial, MidedgeAngleThetaFormulation)
 };
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include "../../include/StVKMaterial.h"
 #include "../../include/MeshConnectivity.h"
+#include <algorithm>
+#include <array>
 #include <vector>
 #include "../GeometryDerivatives.h"
+#include "../ElasticShellAssembly.h"
+#include "../FaceBatch.h"
 #include <Eigen/Dense>
 #include "../../include/MidedgeAngleSinFormulation.h"
 #include "../../include/MidedgeAngleTanFormulation.h"
@@ -14,24 +18,25 @@ namespace LibShell {
     template <class SFF>
     double StVKMaterial<SFF>::stretchingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         const RestState& restState,
         int face,
         Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
-        Eigen::Matrix<double, 9, 9>* hessian) const
+        Eigen::Matrix<double, 9, 9>* hessian,
+        HessianProjectType projType) const
     {
         using namespace Eigen;
 
         assert(restState.type() == RestStateType::RST_MONOLAYER);
         const MonolayerRestState& rs = (const MonolayerRestState&)restState;
 
+        const RestFaceData& restData = rs.faceData(face);
         double coeff = rs.thicknesses[face] / 4.0;
-        Matrix2d abarinv = rs.abars[face].inverse();
+        Matrix2d abarinv = restData.abarinv;
         Matrix<double, 4, 9> aderiv;
-        std::vector<Matrix<double, 9, 9> > ahess;
-        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, hessian ? &ahess : NULL);
+        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, NULL);
         Matrix2d M = abarinv * (a - rs.abars[face]);
-        double dA = 0.5 * sqrt(rs.abars[face].determinant());
+        double dA = restData.dA;
         double lameAlpha = rs.lameAlpha[face];
         double lameBeta = rs.lameBeta[face];
 
@@ -44,14 +49,29 @@ namespace LibShell {
             *derivative = coeff * dA * aderiv.transpose() * Map<Vector4d>(temp.data());
         }
 
-        if (hessian)
+        if (hessian && projType == HessianProjectType::kStrainSpace)
+        {
+            // the terms below, with aderiv replaced by the identity
+            Matrix2d dWda = lameAlpha * M.trace() * abarinv + 2 * lameBeta * M * abarinv;
+            Vector4d inner = Map<Vector4d>(abarinv.data());
+            Matrix4d d2Wda2 = lameAlpha * inner * inner.transpose();
+            Vector4d inner00(abarinv(0, 0), 0, abarinv(0, 1), 0);
+            Vector4d inner01(0, abarinv(0, 0), 0, abarinv(0, 1));
+            Vector4d inner10(abarinv(1, 0), 0, abarinv(1, 1), 0);
+            Vector4d inner11(0, abarinv(1, 0), 0, abarinv(1, 1));
+            d2Wda2 += 2 * lameBeta * inner00 * inner00.transpose();
+            d2Wda2 += 2 * lameBeta * (inner01 * inner10.transpose() + inner10 * inner01.transpose());
+            d2Wda2 += 2 * lameBeta * inner11 * inner11.transpose();
+
+            *hessian = coeff * dA * projectedFirstFundamentalFormHessian(aderiv, dWda, d2Wda2);
+        }
+        else if (hessian)
         {
             Matrix<double, 1, 9> inner = aderiv.transpose() * Map<Vector4d>(abarinv.data());
             *hessian = lameAlpha * inner.transpose() * inner;
 
             Matrix2d Mainv = M * abarinv;
-            for (int i = 0; i < 4; ++i) // iterate over Mainv and abarinv as if they were vectors
-                *hessian += (lameAlpha * M.trace() * abarinv(i) + 2 * lameBeta * Mainv(i)) * ahess[i];
+            addFirstFundamentalFormHessian(lameAlpha * M.trace() * abarinv + 2 * lameBeta * Mainv, *hessian);
 
             Matrix<double, 1, 9> inner00 = abarinv(0, 0) * aderiv.row(0) + abarinv(0, 1) * aderiv.row(2);
             Matrix<double, 1, 9> inner01 = abarinv(0, 0) * aderiv.row(1) + abarinv(0, 1) * aderiv.row(3);
@@ -70,26 +90,28 @@ namespace LibShell {
     template <class SFF>
     double StVKMaterial<SFF>::bendingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const Eigen::VectorXd& extraDOFs,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
         const RestState& restState,
         int face,
         Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
-        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian) const
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+        const typename SFF::GeometryCache* geometryCache) const
     {
         using namespace Eigen;
 
         assert(restState.type() == RestStateType::RST_MONOLAYER);
         const MonolayerRestState& rs = (const MonolayerRestState&)restState;
 
-        double coeff = pow(rs.thicknesses[face], 3) / 12;
+        const RestFaceData& restData = rs.faceData(face);
+        double coeff = restData.bendingCoeff;
         constexpr int nedgedofs = SFF::numExtraDOFs;
-        Matrix2d abarinv = rs.abars[face].inverse();
+        Matrix2d abarinv = restData.abarinv;
         Matrix<double, 4, 18 + 3 * nedgedofs> bderiv;
-        std::vector<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs> > bhess;
-        Matrix2d b = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, face, (derivative || hessian) ? &bderiv : NULL, hessian ? &bhess : NULL);
+        std::array<Matrix<double, 18 + 3 * nedgedofs, 18 + 3 * nedgedofs>, 4> bhess;
+        Matrix2d b = SFF::secondFundamentalForm(mesh, curPos, extraDOFs, face, (derivative || hessian) ? &bderiv : NULL, hessian ? &bhess : NULL, geometryCache);
         Matrix2d M = abarinv * (b - rs.bbars[face]);
-        double dA = 0.5 * sqrt(rs.abars[face].determinant());
+        double dA = restData.dA;
         double lameAlpha = rs.lameAlpha[face];
         double lameBeta = rs.lameBeta[face];
 
@@ -125,9 +147,88 @@ namespace LibShell {
         return result;
     }
 
+    /*
+     * energies[i] = scales[i] * (alpha/2 tr(M)^2 + beta tr(M^2)), for M = abarinv (a - abar), over a batch of n faces (the
+     * bending density, with a and abar the current and rest second fundamental forms)
+     */
+    static void stvkEnergies(int n, const MatrixBatch& abarinv, const MatrixBatch& a, const MatrixBatch& abar,
+        const double* lameAlpha, const double* lameBeta, const double* scales, double* energies)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            double d00 = a.m[0][i] - abar.m[0][i];
+            double d10 = a.m[1][i] - abar.m[1][i];
+            double d01 = a.m[2][i] - abar.m[2][i];
+            double d11 = a.m[3][i] - abar.m[3][i];
+            double m00 = abarinv.m[0][i] * d00 + abarinv.m[2][i] * d10;
+            double m10 = abarinv.m[1][i] * d00 + abarinv.m[3][i] * d10;
+            double m01 = abarinv.m[0][i] * d01 + abarinv.m[2][i] * d11;
+            double m11 = abarinv.m[1][i] * d01 + abarinv.m[3][i] * d11;
+            double tr = m00 + m11;
+            double trsq = m00 * m00 + 2 * m01 * m10 + m11 * m11;
+            energies[i] = scales[i] * (0.5 * lameAlpha[i] * (tr * tr) + lameBeta[i] * trsq);
+        }
+    }
+
+    // abarinv and the given per-face scale of faces[0] .. faces[n - 1]
+    template <class Scale>
+    static void gatherRestData(const MonolayerRestState& rs, int n, const int* faces, MatrixBatch& abarinv, double* scales, const Scale& scale)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            const RestFaceData& restData = rs.faceData(faces[i]);
+            for (int k = 0; k < 4; k++)
+                abarinv.m[k][i] = restData.abarinv(k);
+            scales[i] = scale(faces[i], restData);
+        }
+    }
+
+    template <class SFF>
+    static void stvkBendingEnergies(const MeshConnectivity& mesh, const PositionsRef& curPos, const EdgeDOFsRef& extraDOFs,
+        const MonolayerRestState& rs, int nfaces, const int* faces, double* energies, const typename SFF::GeometryCache* geometryCache)
+    {
+        MatrixBatch b, bbar, abarinv;
+        double lameAlpha[energyBatchSize], lameBeta[energyBatchSize], scales[energyBatchSize];
+        for (int start = 0; start < nfaces; start += energyBatchSize)
+        {
+            int n = std::min(energyBatchSize, nfaces - start);
+            const int* batch = faces + start;
+            gatherSecondFundamentalForms<SFF>(mesh, curPos, extraDOFs, n, batch, geometryCache, b);
+            gatherMatrices(rs.bbars, n, batch, bbar);
+            gatherRestData(rs, n, batch, abarinv, scales, [](int, const RestFaceData& restData) { return restData.bendingCoeff * restData.dA; });
+            gatherScalars(rs.lameAlpha, n, batch, lameAlpha);
+            gatherScalars(rs.lameBeta, n, batch, lameBeta);
+            stvkEnergies(n, abarinv, b, bbar, lameAlpha, lameBeta, scales, energies + start);
+        }
+    }
+
+    template <class SFF>
+    void StVKMaterial<SFF>::bendingEnergies(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
+        const RestState& restState,
+        int nfaces,
+        const int* faces,
+        double* energies,
+        const typename SFF::GeometryCache* geometryCache) const
+    {
+        assert(restState.type() == RestStateType::RST_MONOLAYER);
+        const MonolayerRestState& rs = (const MonolayerRestState&)restState;
+
+        stvkBendingEnergies<SFF>(mesh, curPos, extraDOFs, rs, nfaces, faces, energies, geometryCache);
+    }
+
     // instantiations
     template class StVKMaterial<MidedgeAngleSinFormulation>;
     template class StVKMaterial<MidedgeAngleTanFormulation>;
     template class StVKMaterial<MidedgeAverageFormulation>;
     template class StVKMaterial<MidedgeAngleThetaFormulation>;
+
+    // statically dispatched assembly (ElasticShell::elasticEnergy<StVKMaterial<SFF> >), instantiated here so that the kernels above
+    // can be inlined into it
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(StVKMaterial, MidedgeAngleSinFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(StVKMaterial, MidedgeAngleTanFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(StVKMaterial, MidedgeAverageFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(StVKMaterial, MidedgeAngleThetaFormulation)
 };
\ No newline at end of file
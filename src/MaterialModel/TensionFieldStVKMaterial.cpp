@@ -1,7 +1,9 @@
 #include "../../include/TensionFieldStVKMaterial.h"
 #include "../../include/MeshConnectivity.h"
+#include <array>
 #include <vector>
 #include "../GeometryDerivatives.h"
+#include "../ElasticShellAssembly.h"
 #include <Eigen/Dense>
 #include "../../include/MidedgeAngleSinFormulation.h"
 #include "../../include/MidedgeAngleTanFormulation.h"
@@ -14,24 +16,25 @@ namespace LibShell {
     template <class SFF>
     double TensionFieldStVKMaterial<SFF>::stretchingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         const RestState& restState,
         int face,
         Eigen::Matrix<double, 1, 9>* derivative, // F(face, i)
-        Eigen::Matrix<double, 9, 9>* hessian) const
+        Eigen::Matrix<double, 9, 9>* hessian,
+        HessianProjectType projType) const
     {
         using namespace Eigen;
 
         assert(restState.type() == RestStateType::RST_MONOLAYER);
         const MonolayerRestState& rs = (const MonolayerRestState&)restState;
 
+        const RestFaceData& restData = rs.faceData(face);
         double coeff = rs.thicknesses[face] / 4.0;
-        Matrix2d abarinv = rs.abars[face].inverse();
+        Matrix2d abarinv = restData.abarinv;
         Matrix<double, 4, 9> aderiv;
-        std::vector<Matrix<double, 9, 9> > ahess;
-        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, hessian ? &ahess : NULL);
+        Matrix2d a = firstFundamentalForm(mesh, curPos, face, (derivative || hessian) ? &aderiv : NULL, NULL);
         Matrix2d M = abarinv * (a - rs.abars[face]);
-        double dA = 0.5 * sqrt(rs.abars[face].determinant());
+        double dA = restData.dA;
         double lameAlpha = rs.lameAlpha[face];
         double lameBeta = rs.lameBeta[face];
 
@@ -74,14 +77,29 @@ namespace LibShell {
                 *derivative = coeff * dA * aderiv.transpose() * Map<Vector4d>(temp.data());
             }
 
-            if (hessian)
+            if (hessian && projType == HessianProjectType::kStrainSpace)
+            {
+                // the terms below, with aderiv replaced by the identity
+                Matrix2d dWda = lameAlpha * M.trace() * abarinv + 2 * lameBeta * M * abarinv;
+                Vector4d inner = Map<Vector4d>(abarinv.data());
+                Matrix4d d2Wda2 = lameAlpha * inner * inner.transpose();
+                Vector4d inner00(abarinv(0, 0), 0, abarinv(0, 1), 0);
+                Vector4d inner01(0, abarinv(0, 0), 0, abarinv(0, 1));
+                Vector4d inner10(abarinv(1, 0), 0, abarinv(1, 1), 0);
+                Vector4d inner11(0, abarinv(1, 0), 0, abarinv(1, 1));
+                d2Wda2 += 2 * lameBeta * inner00 * inner00.transpose();
+                d2Wda2 += 2 * lameBeta * (inner01 * inner10.transpose() + inner10 * inner01.transpose());
+                d2Wda2 += 2 * lameBeta * inner11 * inner11.transpose();
+
+                *hessian = coeff * dA * projectedFirstFundamentalFormHessian(aderiv, dWda, d2Wda2);
+            }
+            else if (hessian)
             {
                 Matrix<double, 1, 9> inner = aderiv.transpose() * Map<Vector4d>(abarinv.data());
                 *hessian = lameAlpha * inner.transpose() * inner;
 
                 Matrix2d Mainv = M * abarinv;
-                for (int i = 0; i < 4; ++i) // iterate over Mainv and abarinv as if they were vectors
-                    *hessian += (lameAlpha * M.trace() * abarinv(i) + 2 * lameBeta * Mainv(i)) * ahess[i];
+                addFirstFundamentalFormHessian(lameAlpha * M.trace() * abarinv + 2 * lameBeta * Mainv, *hessian);
 
                 Matrix<double, 1, 9> inner00 = abarinv(0, 0) * aderiv.row(0) + abarinv(0, 1) * aderiv.row(2);
                 Matrix<double, 1, 9> inner01 = abarinv(0, 0) * aderiv.row(1) + abarinv(0, 1) * aderiv.row(3);
@@ -130,7 +148,30 @@ namespace LibShell {
                     (*derivative) += 2.0 * kstretching * dA * lambda * mat(1, 1) * aderiv.row(3);
                 }
 
-                if (hessian)
+                if (hessian && projType == HessianProjectType::kStrainSpace)
+                {
+                    // the terms below, with aderiv replaced by the identity
+                    Eigen::Matrix2d dWda = 2.0 * kstretching * dA * lambda * mat;
+                    Eigen::Vector4d rankone(mat(0, 0), mat(0, 1), mat(1, 0), mat(1, 1));
+                    Eigen::Matrix4d d2Wda2 = 2.0 * kstretching * dA * rankone * rankone.transpose();
+
+                    Eigen::Matrix4d adjda;
+                    adjda << 0, 0, 0, 1,
+                        0, 0, -1, 0,
+                        0, -1, 0, 0,
+                        1, 0, 0, 0;
+                    d2Wda2 += 2.0 * kstretching * dA * sign * lambda / denom * (-1.0 / 2.0 * detAbarinv) * adjda;
+
+                    Eigen::Vector4d abarinvterm(abarinv(0, 0), abarinv(0, 1), abarinv(1, 0), abarinv(1, 1));
+                    d2Wda2 += 2.0 * kstretching * dA * sign * lambda / denom / 4.0 * abarinvterm * abarinvterm.transpose();
+
+                    Eigen::Matrix2d inner = T / 4.0 * abarinv - 1.0 / 2.0 * detAbarinv * adjstrain;
+                    Eigen::Vector4d innerVec(inner(0, 0), inner(0, 1), inner(1, 0), inner(1, 1));
+                    d2Wda2 += 2.0 * kstretching * -dA * sign * lambda / denom / denom / denom * innerVec * innerVec.transpose();
+
+                    *hessian = projectedFirstFundamentalFormHessian(aderiv, dWda, d2Wda2);
+                }
+                else if (hessian)
                 {
                     hessian->setZero();
 
@@ -143,10 +184,7 @@ namespace LibShell {
 
                     (*hessian) += 2.0 * kstretching * dA * rankone.transpose() * rankone;
 
-                    (*hessian) += 2.0 * kstretching * dA * lambda * mat(0, 0) * ahess[0];
-                    (*hessian) += 2.0 * kstretching * dA * lambda * mat(0, 1) * ahess[1];
-                    (*hessian) += 2.0 * kstretching * dA * lambda * mat(1, 0) * ahess[2];
-                    (*hessian) += 2.0 * kstretching * dA * lambda * mat(1, 1) * ahess[3];
+                    addFirstFundamentalFormHessian(2.0 * kstretching * dA * lambda * mat, *hessian);
 
                     //(*hessian) += dA * sign * lambda / denom * (-1.0 / 2.0 / abar.determinant()) * aderiv.row(3).transpose() * aderiv.row(0);
                     (*hessian) += 2.0 * kstretching * dA * sign * lambda / denom * (-1.0 / 2.0 * detAbarinv) * aderiv.row(3).transpose() * aderiv.row(0);
@@ -181,12 +219,13 @@ namespace LibShell {
     template <class SFF>
     double TensionFieldStVKMaterial<SFF>::bendingEnergy(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const Eigen::VectorXd& extraDOFs,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
         const RestState& restState,
         int face,
         Eigen::Matrix<double, 1, 18 + 3 * SFF::numExtraDOFs>* derivative, // F(face, i), then the three vertices opposite F(face,i), then the extra DOFs on oppositeEdge(face,i)
-        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian) const
+        Eigen::Matrix<double, 18 + 3 * SFF::numExtraDOFs, 18 + 3 * SFF::numExtraDOFs>* hessian,
+        const typename SFF::GeometryCache* /*geometryCache*/) const
     {
         if (derivative)
             derivative->setZero();
@@ -200,4 +239,11 @@ namespace LibShell {
     template class TensionFieldStVKMaterial<MidedgeAngleTanFormulation>;
     template class TensionFieldStVKMaterial<MidedgeAverageFormulation>;
     template class TensionFieldStVKMaterial<MidedgeAngleThetaFormulation>;
+
+    // statically dispatched assembly (ElasticShell::elasticEnergy<TensionFieldStVKMaterial<SFF> >), instantiated here so that the kernels above
+    // can be inlined into it
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(TensionFieldStVKMaterial, MidedgeAngleSinFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(TensionFieldStVKMaterial, MidedgeAngleTanFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(TensionFieldStVKMaterial, MidedgeAverageFormulation)
+    LIBSHELL_INSTANTIATE_STATIC_ELASTIC_ENERGY(TensionFieldStVKMaterial, MidedgeAngleThetaFormulation)
 };
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "../include/MeshConnectivity.h"
+#include "ParallelFor.h"
 
 #include <vector>
-#include <map>
+#include <algorithm>
 
 namespace LibShell {
 
@@ -15,86 +16,157 @@ namespace LibShell {
         EOpp.resize(0, 2);
     }
 
-    MeshConnectivity::MeshConnectivity(const Eigen::MatrixXi& F) : F(F)
+    MeshConnectivity::MeshConnectivity(const Eigen::MatrixXi& F, const ExecutionContext& ctx) : F(F)
     {
-        std::map<std::pair<int, int>, Eigen::Vector2i > edgeFaces;
         int nfaces = (int)F.rows();
+        int nverts = nfaces == 0 ? 0 : F.maxCoeff() + 1;
+
+        // face edges (edge j of face i, opposite F(i, j), is number 3 * i + j), bucketed by their smaller vertex in
+        // increasing order
+        std::vector<int> vertexOffsets(nverts + 1, 0);
+        for (int i = 0; i < nfaces; i++)
+        {
+            for (int j = 0; j < 3; j++)
+                vertexOffsets[std::min(F(i, (j + 1) % 3), F(i, (j + 2) % 3)) + 1]++;
+        }
+        for (int v = 0; v < nverts; v++)
+            vertexOffsets[v + 1] += vertexOffsets[v];
+        std::vector<int> faceEdges(3 * nfaces);
+        std::vector<int> fill(vertexOffsets.begin(), vertexOffsets.end() - 1);
         for (int i = 0; i < nfaces; i++)
         {
             for (int j = 0; j < 3; j++)
+                faceEdges[fill[std::min(F(i, (j + 1) % 3), F(i, (j + 2) % 3))]++] = 3 * i + j;
+        }
+        std::vector<int>().swap(fill);
+
+        auto largerVertex = [&F](int faceEdge)
+        {
+            int i = faceEdge / 3;
+            int j = faceEdge % 3;
+            return std::max(F(i, (j + 1) % 3), F(i, (j + 2) % 3));
+        };
+
+        // within each bucket, stably sort by the larger vertex, so that the edges come out in lexicographic order of their
+        // vertices and the face edges of each edge in face order; then count the distinct edges starting at each vertex
+        int nthreads = resolveNumThreads(ctx.numThreads, nverts);
+        std::vector<int> edgeOffsets(nverts + 1, 0);
+        parallelForChunks(nverts, nthreads, [&](int, int begin, int end)
             {
-                int v0 = F(i, (j + 1) % 3);
-                int v1 = F(i, (j + 2) % 3);
-                int idx = 0;
-                if (v0 > v1)
+                for (int v = begin; v < end; v++)
                 {
-                    std::swap(v0, v1);
-                    idx = 1;
-                }
+                    int* first = faceEdges.data() + vertexOffsets[v];
+                    int* last = faceEdges.data() + vertexOffsets[v + 1];
+                    if (last - first <= 32)
+                    {
+                        for (int* it = first + 1; it < last; it++)
+                        {
+                            int faceEdge = *it;
+                            int key = largerVertex(faceEdge);
+                            int* hole = it;
+                            for (; hole > first && largerVertex(hole[-1]) > key; hole--)
+                                *hole = hole[-1];
+                            *hole = faceEdge;
+                        }
+                    }
+                    else
+                    {
+                        std::stable_sort(first, last, [&](int e1, int e2) { return largerVertex(e1) < largerVertex(e2); });
+                    }
 
-                std::pair<int, int> p(v0, v1);
-                auto it = edgeFaces.find(p);
-                if (it == edgeFaces.end())
-                {
-                    edgeFaces[p][idx] = i;
-                    edgeFaces[p][1 - idx] = -1;
-                }
-                else
-                {
-                    edgeFaces[p][idx] = i;
+                    int count = 0;
+                    for (int* it = first; it < last; it++)
+                    {
+                        if (it == first || largerVertex(*it) != largerVertex(it[-1]))
+                            count++;
+                    }
+                    edgeOffsets[v + 1] = count;
                 }
-            }
-        }
+            });
+        for (int v = 0; v < nverts; v++)
+            edgeOffsets[v + 1] += edgeOffsets[v];
 
-        int nedges = (int)edgeFaces.size();
+        int nedges = edgeOffsets[nverts];
         FE.resize(nfaces, 3);
         FEorient.resize(nfaces, 3);
         EV.resize(nedges, 2);
         EF.resize(nedges, 2);
         EOpp.resize(nedges, 2);
-        std::map<std::pair<int, int>, int> edgeIndices;
 
-        int idx = 0;
-        for (auto it : edgeFaces)
-        {
-            edgeIndices[it.first] = idx;
-            EV(idx, 0) = it.first.first;
-            EV(idx, 1) = it.first.second;
-            EF(idx, 0) = it.second[0];
-            EF(idx, 1) = it.second[1];
-            idx++;
-        }
+        // EF(edge, 0) is the face in which the edge runs from its smaller to its larger vertex, EF(edge, 1) the other one (or
+        // -1 if there is none). On nonmanifold meshes, the last such face wins.
+        parallelForChunks(nverts, nthreads, [&](int, int begin, int end)
+            {
+                for (int v = begin; v < end; v++)
+                {
+                    int edge = edgeOffsets[v] - 1;
+                    for (int k = vertexOffsets[v]; k < vertexOffsets[v + 1]; k++)
+                    {
+                        int faceEdge = faceEdges[k];
+                        int w = largerVertex(faceEdge);
+                        if (k == vertexOffsets[v] || w != EV(edge, 1))
+                        {
+                            edge++;
+                            EV(edge, 0) = v;
+                            EV(edge, 1) = w;
+                            EF(edge, 0) = -1;
+                            EF(edge, 1) = -1;
+                        }
+                        int i = faceEdge / 3;
+                        int j = faceEdge % 3;
+                        EF(edge, F(i, (j + 1) % 3) > F(i, (j + 2) % 3) ? 1 : 0) = i;
+                        FE(i, j) = edge;
+                    }
+                }
+            });
 
-        for (int i = 0; i < nfaces; i++)
-        {
-            for (int j = 0; j < 3; j++)
+        parallelForChunks(nedges, resolveNumThreads(ctx.numThreads, nedges), [&](int, int begin, int end)
             {
-                int v0 = F(i, (j + 1) % 3);
-                int v1 = F(i, (j + 2) % 3);
-                if (v0 > v1) std::swap(v0, v1);
-                FE(i, j) = edgeIndices[std::pair<int, int>(v0, v1)];
-            }
-        }
+                for (int i = begin; i < end; i++)
+                {
+                    for (int j = 0; j < 2; j++)
+                    {
+                        EOpp(i, j) = oppositeVertex(i, j);
+                    }
+                }
+            });
 
-        for (int i = 0; i < nedges; i++)
-        {
-            for (int j = 0; j < 2; j++)
+        parallelForChunks(nfaces, resolveNumThreads(ctx.numThreads, nfaces), [&](int, int begin, int end)
             {
-                EOpp(i, j) = oppositeVertex(i, j);
-            }
-        }
+                for (int i = begin; i < end; i++)
+                {
+                    for (int j = 0; j < 3; j++)
+                    {
+                        int edge = faceEdge(i, j);
+                        if (edgeFace(edge, 0) == i)
+                            FEorient(i, j) = 0;
+                        else
+                            FEorient(i, j) = 1;
+                    }
+                }
+            });
 
-        for (int i = 0; i < nfaces; i++)
-        {
-            for (int j = 0; j < 3; j++)
+        stencils.resize(nfaces);
+        parallelForChunks(nfaces, resolveNumThreads(ctx.numThreads, nfaces), [&](int, int begin, int end)
             {
-                int edge = faceEdge(i, j);
-                if (edgeFace(edge, 0) == i)
-                    FEorient(i, j) = 0;
-                else
-                    FEorient(i, j) = 1;
-            }
-        }
+                for (int i = begin; i < end; i++)
+                {
+                    FaceStencil& stencil = stencils[i];
+                    stencil.boundaryMask = 0;
+                    for (int j = 0; j < 3; j++)
+                    {
+                        int edge = FE(i, j);
+                        int orient = FEorient(i, j);
+                        stencil.vertices[j] = F(i, j);
+                        stencil.edges[j] = edge;
+                        stencil.oppositeVertices[j] = EOpp(edge, 1 - orient);
+                        stencil.oppositeFaces[j] = EF(edge, 1 - orient);
+                        stencil.edgeOrientations[j] = (unsigned char)orient;
+                        if (stencil.oppositeFaces[j] == -1)
+                            stencil.boundaryMask |= 1 << j;
+                    }
+                }
+            });
     }
 
     int MeshConnectivity::oppositeVertexIndex(int edge, int faceidx) const
@@ -122,11 +194,78 @@ namespace LibShell {
         return F(face, idx);
     }
 
-    int MeshConnectivity::vertexOppositeFaceEdge(int face, int vertidx) const
+    void MeshConnectivity::bendingStencilColoring(FaceColoring& coloring) const
     {
-        int edge = faceEdge(face, vertidx);
-        int edgeorient = faceEdgeOrientation(face, vertidx);
-        return edgeOppositeVertex(edge, 1 - edgeorient);
+        int nfaces = nFaces();
+        int nverts = nfaces == 0 ? 0 : F.maxCoeff() + 1;
+
+        // bending stencil vertices of every face, and the faces whose stencils contain every vertex
+        std::vector<int> stencilVertices(6 * nfaces);
+        std::vector<int> vertexOffsets(nverts + 1, 0);
+        for (int i = 0; i < nfaces; i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                stencilVertices[6 * i + j] = stencils[i].vertices[j];
+                stencilVertices[6 * i + 3 + j] = stencils[i].oppositeVertices[j];
+            }
+            for (int j = 0; j < 6; j++)
+            {
+                if (stencilVertices[6 * i + j] != -1)
+                    vertexOffsets[stencilVertices[6 * i + j] + 1]++;
+            }
+        }
+        for (int i = 0; i < nverts; i++)
+            vertexOffsets[i + 1] += vertexOffsets[i];
+        std::vector<int> vertexFaces(vertexOffsets[nverts]);
+        std::vector<int> fill(vertexOffsets.begin(), vertexOffsets.end() - 1);
+        for (int i = 0; i < nfaces; i++)
+        {
+            for (int j = 0; j < 6; j++)
+            {
+                if (stencilVertices[6 * i + j] != -1)
+                    vertexFaces[fill[stencilVertices[6 * i + j]]++] = i;
+            }
+        }
+
+        // smallest color not used by any already colored face sharing a stencil vertex
+        std::vector<int> colors(nfaces, -1);
+        std::vector<int> forbidden;
+        int ncolors = 0;
+        for (int i = 0; i < nfaces; i++)
+        {
+            for (int j = 0; j < 6; j++)
+            {
+                int v = stencilVertices[6 * i + j];
+                if (v == -1)
+                    continue;
+                for (int k = vertexOffsets[v]; k < vertexOffsets[v + 1]; k++)
+                {
+                    int c = colors[vertexFaces[k]];
+                    if (c != -1)
+                        forbidden[c] = i;
+                }
+            }
+            int c = 0;
+            while (c < ncolors && forbidden[c] == i)
+                c++;
+            if (c == ncolors)
+            {
+                ncolors++;
+                forbidden.push_back(-1);
+            }
+            colors[i] = c;
+        }
+
+        coloring.colorOffsets.assign(ncolors + 1, 0);
+        for (int i = 0; i < nfaces; i++)
+            coloring.colorOffsets[colors[i] + 1]++;
+        for (int i = 0; i < ncolors; i++)
+            coloring.colorOffsets[i + 1] += coloring.colorOffsets[i];
+        coloring.faces.resize(nfaces);
+        std::vector<int> next(coloring.colorOffsets.begin(), coloring.colorOffsets.end() - 1);
+        for (int i = 0; i < nfaces; i++)
+            coloring.faces[next[colors[i]]++] = i;
     }
 
 };
\ No newline at end of file
@@ -0,0 +1,366 @@
+#include "../include/MeshReordering.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace LibShell {
+
+    // vertex adjacency of the mesh edges, in compressed rows: the neighbors of v are adjacency[offsets[v]] .. adjacency[offsets[v + 1] - 1]
+    static void vertexAdjacency(const MeshConnectivity& mesh, int nverts, std::vector<int>& offsets, std::vector<int>& adjacency)
+    {
+        int nedges = mesh.nEdges();
+        offsets.assign(nverts + 1, 0);
+        for (int i = 0; i < nedges; i++)
+        {
+            offsets[mesh.edgeVertex(i, 0) + 1]++;
+            offsets[mesh.edgeVertex(i, 1) + 1]++;
+        }
+        for (int v = 0; v < nverts; v++)
+            offsets[v + 1] += offsets[v];
+        adjacency.resize(offsets[nverts]);
+        std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for (int i = 0; i < nedges; i++)
+        {
+            int v0 = mesh.edgeVertex(i, 0);
+            int v1 = mesh.edgeVertex(i, 1);
+            adjacency[fill[v0]++] = v1;
+            adjacency[fill[v1]++] = v0;
+        }
+    }
+
+    /*
+     * Reverse Cuthill-McKee ordering of the vertices with at least one neighbor: breadth-first search from a
+     * pseudo-peripheral vertex of each connected component, visiting the neighbors of every vertex by increasing degree,
+     * then reversed.
+     */
+    static void reverseCuthillMcKee(const std::vector<int>& offsets, const std::vector<int>& adjacency, std::vector<int>& order)
+    {
+        int nverts = (int)offsets.size() - 1;
+        auto degree = [&](int v) { return offsets[v + 1] - offsets[v]; };
+        auto byDegree = [&](int v1, int v2) { return degree(v1) < degree(v2) || (degree(v1) == degree(v2) && v1 < v2); };
+
+        // breadth-first search from root over the unvisited vertices, appending them to queue; returns the start of the last level
+        std::vector<int> mark(nverts, -1);
+        int stamp = 0;
+        auto levels = [&](int root, std::vector<int>& queue, int& depth)
+        {
+            stamp++;
+            queue.clear();
+            queue.push_back(root);
+            mark[root] = stamp;
+            depth = 0;
+            int levelBegin = 0;
+            while (true)
+            {
+                int levelEnd = (int)queue.size();
+                for (int k = levelBegin; k < levelEnd; k++)
+                {
+                    int v = queue[k];
+                    for (int l = offsets[v]; l < offsets[v + 1]; l++)
+                    {
+                        int w = adjacency[l];
+                        if (mark[w] != stamp && mark[w] != -2)
+                        {
+                            mark[w] = stamp;
+                            queue.push_back(w);
+                        }
+                    }
+                }
+                if ((int)queue.size() == levelEnd)
+                    return levelBegin;
+                levelBegin = levelEnd;
+                depth++;
+            }
+        };
+
+        std::vector<int> candidates;
+        for (int v = 0; v < nverts; v++)
+        {
+            if (degree(v) > 0)
+                candidates.push_back(v);
+        }
+        std::sort(candidates.begin(), candidates.end(), byDegree);
+
+        order.clear();
+        std::vector<int> queue, neighbors;
+        for (int start : candidates)
+        {
+            if (mark[start] == -2)
+                continue;
+
+            // pseudo-peripheral root: move to a lowest-degree vertex of the last level while the depth increases
+            int root = start;
+            int depth;
+            int last = levels(root, queue, depth);
+            while (true)
+            {
+                int next = *std::min_element(queue.begin() + last, queue.end(), byDegree);
+                int nextDepth;
+                int nextLast = levels(next, queue, nextDepth);
+                if (nextDepth <= depth)
+                    break;
+                root = next;
+                depth = nextDepth;
+                last = nextLast;
+            }
+
+            // -2 marks the vertices already ordered
+            int begin = (int)order.size();
+            order.push_back(root);
+            mark[root] = -2;
+            for (int k = begin; k < (int)order.size(); k++)
+            {
+                int v = order[k];
+                neighbors.clear();
+                for (int l = offsets[v]; l < offsets[v + 1]; l++)
+                {
+                    if (mark[adjacency[l]] != -2)
+                        neighbors.push_back(adjacency[l]);
+                }
+                std::sort(neighbors.begin(), neighbors.end(), byDegree);
+                for (int w : neighbors)
+                {
+                    mark[w] = -2;
+                    order.push_back(w);
+                }
+            }
+        }
+        std::reverse(order.begin(), order.end());
+    }
+
+    // spreads the lower 21 bits of x to every third bit
+    static uint64_t spreadBits(uint64_t x)
+    {
+        x &= 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffULL;
+        x = (x | x << 16) & 0x1f0000ff0000ffULL;
+        x = (x | x << 8) & 0x100f00f00f00f00fULL;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+        x = (x | x << 2) & 0x1249249249249249ULL;
+        return x;
+    }
+
+    // the given vertices sorted by their Morton codes, on a 2^21 grid over the bounding box of their positions
+    static void mortonOrder(const Eigen::MatrixXd& V, std::vector<int>& order)
+    {
+        if (order.empty())
+            return;
+        Eigen::RowVector3d minCorner = V.row(order[0]);
+        Eigen::RowVector3d maxCorner = V.row(order[0]);
+        for (int v : order)
+        {
+            minCorner = minCorner.cwiseMin(V.row(v));
+            maxCorner = maxCorner.cwiseMax(V.row(v));
+        }
+        double extent = (maxCorner - minCorner).maxCoeff();
+        double scale = extent > 0 ? double((1 << 21) - 1) / extent : 0.0;
+
+        std::vector<std::pair<uint64_t, int> > keys(order.size());
+        for (int i = 0; i < (int)order.size(); i++)
+        {
+            uint64_t code = 0;
+            for (int k = 0; k < 3; k++)
+                code |= spreadBits(uint64_t((V(order[i], k) - minCorner[k]) * scale)) << k;
+            keys[i] = std::pair<uint64_t, int>(code, order[i]);
+        }
+        std::sort(keys.begin(), keys.end());
+        for (int i = 0; i < (int)order.size(); i++)
+            order[i] = keys[i].second;
+    }
+
+    MeshReordering::MeshReordering()
+    {
+    }
+
+    MeshReordering::MeshReordering(const MeshConnectivity& mesh, const Eigen::MatrixXd& V, ReorderingMethod method)
+    {
+        int nverts = (int)V.rows();
+        int nfaces = mesh.nFaces();
+        int nedges = mesh.nEdges();
+
+        std::vector<int> offsets, adjacency;
+        vertexAdjacency(mesh, nverts, offsets, adjacency);
+        switch (method)
+        {
+        case ReorderingMethod::kMorton:
+            for (int v = 0; v < nverts; v++)
+            {
+                if (offsets[v + 1] > offsets[v])
+                    vertexOrder.push_back(v);
+            }
+            mortonOrder(V, vertexOrder);
+            break;
+        default:
+            reverseCuthillMcKee(offsets, adjacency, vertexOrder);
+            break;
+        }
+        // unreferenced vertices last, in their original order
+        for (int v = 0; v < nverts; v++)
+        {
+            if (offsets[v + 1] == offsets[v])
+                vertexOrder.push_back(v);
+        }
+        vertexIndex.resize(nverts);
+        for (int i = 0; i < nverts; i++)
+            vertexIndex[vertexOrder[i]] = i;
+
+        // faces by their smallest reordered vertex (a counting sort, so ties keep the original order)
+        std::vector<int> faceOffsets(nverts + 1, 0);
+        std::vector<int> faceKeys(nfaces);
+        for (int i = 0; i < nfaces; i++)
+        {
+            faceKeys[i] = std::min(vertexIndex[mesh.faceVertex(i, 0)], std::min(vertexIndex[mesh.faceVertex(i, 1)], vertexIndex[mesh.faceVertex(i, 2)]));
+            faceOffsets[faceKeys[i] + 1]++;
+        }
+        for (int v = 0; v < nverts; v++)
+            faceOffsets[v + 1] += faceOffsets[v];
+        faceOrder.resize(nfaces);
+        for (int i = 0; i < nfaces; i++)
+            faceOrder[faceOffsets[faceKeys[i]]++] = i;
+        faceIndex.resize(nfaces);
+        for (int i = 0; i < nfaces; i++)
+            faceIndex[faceOrder[i]] = i;
+
+        Eigen::MatrixXi F(nfaces, 3);
+        for (int i = 0; i < nfaces; i++)
+        {
+            for (int j = 0; j < 3; j++)
+                F(i, j) = vertexIndex[mesh.faceVertex(faceOrder[i], j)];
+        }
+        this->mesh = MeshConnectivity(F);
+        assert(this->mesh.nEdges() == nedges);
+
+        // edge j of a reordered face is edge j of the original one
+        edgeOrder.resize(nedges);
+        edgeFlipped.resize(nedges);
+        for (int i = 0; i < nfaces; i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                int edge = this->mesh.faceEdge(i, j);
+                int origEdge = mesh.faceEdge(faceOrder[i], j);
+                edgeOrder[edge] = origEdge;
+                edgeFlipped[edge] = vertexOrder[this->mesh.edgeVertex(edge, 0)] != mesh.edgeVertex(origEdge, 0);
+            }
+        }
+        edgeIndex.resize(nedges);
+        for (int i = 0; i < nedges; i++)
+            edgeIndex[edgeOrder[i]] = i;
+    }
+
+    void MeshReordering::reorderVertices(const Eigen::MatrixXd& values, Eigen::MatrixXd& reordered) const
+    {
+        int nverts = nVertices();
+        reordered.resize(nverts, values.cols());
+        for (int i = 0; i < nverts; i++)
+            reordered.row(i) = values.row(vertexOrder[i]);
+    }
+
+    void MeshReordering::restoreVertices(const Eigen::MatrixXd& reordered, Eigen::MatrixXd& values) const
+    {
+        int nverts = nVertices();
+        values.resize(nverts, reordered.cols());
+        for (int i = 0; i < nverts; i++)
+            values.row(vertexOrder[i]) = reordered.row(i);
+    }
+
+    void MeshReordering::reorderRestState(const MonolayerRestState& restState, MonolayerRestState& reordered) const
+    {
+        reorderFaces(restState.thicknesses, reordered.thicknesses);
+        reorderFaces(restState.abars, reordered.abars);
+        reorderFaces(restState.bbars, reordered.bbars);
+        reorderFaces(restState.lameAlpha, reordered.lameAlpha);
+        reorderFaces(restState.lameBeta, reordered.lameBeta);
+    }
+
+    void MeshReordering::reorderRestState(const BilayerRestState& restState, BilayerRestState& reordered) const
+    {
+        for (int i = 0; i < 2; i++)
+            reorderRestState(restState.layers[i], reordered.layers[i]);
+    }
+
+    void MeshReordering::reorderEdgeDOFs(const Eigen::VectorXd& edgeDOFs, int numExtraDOFs, Eigen::VectorXd& reordered) const
+    {
+        int nedges = nEdges();
+        reordered.resize(numExtraDOFs * nedges);
+        for (int i = 0; i < nedges; i++)
+        {
+            double sign = edgeFlipped[i] ? -1.0 : 1.0;
+            for (int k = 0; k < numExtraDOFs; k++)
+                reordered[numExtraDOFs * i + k] = sign * edgeDOFs[numExtraDOFs * edgeOrder[i] + k];
+        }
+    }
+
+    void MeshReordering::restoreEdgeDOFs(const Eigen::VectorXd& reordered, int numExtraDOFs, Eigen::VectorXd& edgeDOFs) const
+    {
+        int nedges = nEdges();
+        edgeDOFs.resize(numExtraDOFs * nedges);
+        for (int i = 0; i < nedges; i++)
+        {
+            double sign = edgeFlipped[i] ? -1.0 : 1.0;
+            for (int k = 0; k < numExtraDOFs; k++)
+                edgeDOFs[numExtraDOFs * edgeOrder[i] + k] = sign * reordered[numExtraDOFs * i + k];
+        }
+    }
+
+    void MeshReordering::reorderDOFs(const Eigen::VectorXd& dofs, int numExtraDOFs, Eigen::VectorXd& reordered) const
+    {
+        int nverts = nVertices();
+        int nedges = nEdges();
+        reordered.resize(3 * nverts + numExtraDOFs * nedges);
+        for (int i = 0; i < nverts; i++)
+            reordered.segment<3>(3 * i) = dofs.segment<3>(3 * vertexOrder[i]);
+        for (int i = 0; i < nedges; i++)
+        {
+            double sign = edgeFlipped[i] ? -1.0 : 1.0;
+            for (int k = 0; k < numExtraDOFs; k++)
+                reordered[3 * nverts + numExtraDOFs * i + k] = sign * dofs[3 * nverts + numExtraDOFs * edgeOrder[i] + k];
+        }
+    }
+
+    void MeshReordering::restoreDOFs(const Eigen::VectorXd& reordered, int numExtraDOFs, Eigen::VectorXd& dofs) const
+    {
+        int nverts = nVertices();
+        int nedges = nEdges();
+        dofs.resize(3 * nverts + numExtraDOFs * nedges);
+        for (int i = 0; i < nverts; i++)
+            dofs.segment<3>(3 * vertexOrder[i]) = reordered.segment<3>(3 * i);
+        for (int i = 0; i < nedges; i++)
+        {
+            double sign = edgeFlipped[i] ? -1.0 : 1.0;
+            for (int k = 0; k < numExtraDOFs; k++)
+                dofs[3 * nverts + numExtraDOFs * edgeOrder[i] + k] = sign * reordered[3 * nverts + numExtraDOFs * i + k];
+        }
+    }
+
+    Eigen::SparseMatrix<double> MeshReordering::dofPermutation(int numExtraDOFs) const
+    {
+        int nverts = nVertices();
+        int nedges = nEdges();
+        int ndofs = 3 * nverts + numExtraDOFs * nedges;
+        std::vector<Eigen::Triplet<double> > entries;
+        entries.reserve(ndofs);
+        for (int i = 0; i < nverts; i++)
+        {
+            for (int k = 0; k < 3; k++)
+                entries.push_back(Eigen::Triplet<double>(3 * vertexOrder[i] + k, 3 * i + k, 1.0));
+        }
+        for (int i = 0; i < nedges; i++)
+        {
+            double sign = edgeFlipped[i] ? -1.0 : 1.0;
+            for (int k = 0; k < numExtraDOFs; k++)
+                entries.push_back(Eigen::Triplet<double>(3 * nverts + numExtraDOFs * edgeOrder[i] + k, 3 * nverts + numExtraDOFs * i + k, sign));
+        }
+        Eigen::SparseMatrix<double> P(ndofs, ndofs);
+        P.setFromTriplets(entries.begin(), entries.end());
+        return P;
+    }
+
+    void MeshReordering::restoreHessian(const Eigen::SparseMatrix<double>& reordered, int numExtraDOFs, Eigen::SparseMatrix<double>& hessian) const
+    {
+        Eigen::SparseMatrix<double> P = dofPermutation(numExtraDOFs);
+        hessian = P * reordered * P.transpose();
+    }
+};
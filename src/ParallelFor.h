@@ -0,0 +1,49 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace LibShell {
+
+    /*
+     * Number of threads to actually use for numItems independent work items when the user requested numThreads
+     * (<= 0 meaning all hardware threads).
+     */
+    inline int resolveNumThreads(int numThreads, int numItems)
+    {
+        if (numThreads <= 0)
+            numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+        return std::max(1, std::min(numThreads, numItems));
+    }
+
+    /*
+     * Splits [0, numItems) into numChunks contiguous ranges and calls f(chunk, begin, end) for each of them, each chunk
+     * on its own thread (chunk 0 runs on the calling thread). The ranges only depend on numItems and numChunks, so
+     * reducing per-chunk results in chunk order gives reproducible output.
+     */
+    template <class Func>
+    void parallelForChunks(int numItems, int numChunks, const Func& f)
+    {
+        if (numChunks <= 1)
+        {
+            f(0, 0, numItems);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        workers.reserve(numChunks - 1);
+        for (int i = 1; i < numChunks; i++)
+        {
+            int begin = (int)((long long)numItems * i / numChunks);
+            int end = (int)((long long)numItems * (i + 1) / numChunks);
+            workers.emplace_back([&f, i, begin, end]() { f(i, begin, end); });
+        }
+        f(0, 0, (int)((long long)numItems / numChunks));
+        for (auto& w : workers)
+            w.join();
+    }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "../include/ElasticShell.h"
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <iostream>
+
+namespace LibShell {
+
+    /*
+     * Cheap definiteness test: an LDL^T factorization of a positive semidefinite matrix succeeds with a nonnegative D.
+     * Pivots that are negative only at round-off level (the zero modes of the element Hessians, e.g. rigid motions of
+     * a stretched triangle) are accepted too, as long as L is small enough that the smallest eigenvalue of L D L^T,
+     * which is at least min(D) |L|^2, is negligible: projecting such a matrix would not change it in any meaningful way.
+     */
+    template <class DerivedA>
+    static bool isPositiveSemiDefinite(const Eigen::MatrixBase<DerivedA>& A)
+    {
+        Eigen::LDLT<typename DerivedA::PlainObject> ldlt(A);
+        if (ldlt.info() != Eigen::Success)
+            return false;
+        const auto& D = ldlt.vectorD();
+        double dneg = std::max(0.0, -D.minCoeff());
+        if (dneg == 0)
+            return true;
+        typename DerivedA::PlainObject L = ldlt.matrixL();
+        return dneg * L.squaredNorm() <= 1e-12 * D.cwiseAbs().maxCoeff();
+    }
+
+    template <class DerivedA>
+    void projSymMatrix(Eigen::MatrixBase<DerivedA>& A, const HessianProjectType& projType)
+    {
+        // no projection
+        if (projType == HessianProjectType::kNone)
+        {
+            return;
+        }
+        if (isPositiveSemiDefinite(A))
+        {
+            return;
+        }
+        Eigen::SelfAdjointEigenSolver<typename DerivedA::PlainObject> eigenSolver(A);
+        if (eigenSolver.eigenvalues()[0] >= 0) {
+            return;
+        }
+
+        // the negative eigenvalues come first; correct A along their eigenvectors only, which is much cheaper than
+        // rebuilding V D V^T when (as is typical) only a few eigenvalues are negative
+        using T = typename DerivedA::Scalar;
+        const auto& V = eigenSolver.eigenvectors();
+        bool useAbs = projType == HessianProjectType::kAbs;
+        if (!useAbs && projType != HessianProjectType::kMaxZero && projType != HessianProjectType::kStrainSpace) {
+            std::cerr << "Unknown projection type, use Max(A, 0) instead!" << std::endl;
+        }
+        for (int i = 0; i < A.rows(); ++i) {
+            T d = eigenSolver.eigenvalues()[i];
+            if (d >= 0) {
+                break;
+            }
+            T target = useAbs ? -d : 0;
+            A += (target - d) * V.col(i) * V.col(i).transpose();
+        }
+    }
+
+    // instantiations
+    template void
+    projSymMatrix(Eigen::MatrixBase<Eigen::Matrix<double, 9, 9>> &symA,
+                  const HessianProjectType& projType);
+    template void
+    projSymMatrix(Eigen::MatrixBase<Eigen::Matrix<double, 18, 18>> &symA,
+                  const HessianProjectType &projType);
+    template void
+    projSymMatrix(Eigen::MatrixBase<Eigen::Matrix<double, 21, 21>> &symA,
+                  const HessianProjectType &projType);
+};
@@ -0,0 +1,39 @@
+#include "../include/RestState.h"
+#include "GeometryDerivatives.h"
+
+#include <Eigen/Dense>
+#include <cassert>
+#include <cmath>
+
+namespace LibShell {
+
+    void RestFaceData::compute(const Eigen::Matrix2d& restAbar, double restThickness)
+    {
+        abarinv = restAbar.inverse();
+        abaradj = adjugate(restAbar);
+        abardet = restAbar.determinant();
+        dA = 0.5 * std::sqrt(abardet);
+        bendingCoeff = std::pow(restThickness, 3) / 12;
+        abar = restAbar;
+        thickness = restThickness;
+    }
+
+    void MonolayerRestState::updateCache()
+    {
+        int nfaces = (int)abars.size();
+        assert(thicknesses.size() == abars.size());
+        if (cache.size() != abars.size())
+            cache.resize(nfaces);
+        for (int i = 0; i < nfaces; i++)
+        {
+            if (!cache[i].isCurrent(abars[i], thicknesses[i]))
+                cache[i].compute(abars[i], thicknesses[i]);
+        }
+    }
+
+    void BilayerRestState::updateCache()
+    {
+        layers[0].updateCache();
+        layers[1].updateCache();
+    }
+};
@@ -8,52 +8,86 @@ namespace LibShell {
 
     static Eigen::Vector3d secondFundamentalFormEntries(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
+        const PositionsRef& curPos,
         int face,
         Eigen::Matrix<double, 3, 18>* derivative,
-        std::vector<Eigen::Matrix<double, 18, 18> >* hessian)
+        std::array<Eigen::Matrix<double, 18, 18>, 3>* hessian,
+        const FaceNormalCache* cache)
     {
         if (derivative)
             derivative->setZero();
         if (hessian)
         {
-            hessian->resize(3);
             for (int i = 0; i < 3; i++)
                 (*hessian)[i].setZero();
         }
 
+        // a cache filled without the derivatives needed here is ignored, and the normals recomputed
+        if (cache && !cache->provides(derivative || hessian, hessian != NULL))
+            cache = NULL;
+
+        const FaceStencil& stencil = mesh.faceStencil(face);
         Eigen::Vector3d II;
 
         Eigen::Vector3d oppNormals[3];
         Eigen::Matrix<double, 3, 9> dn[3];
-        std::vector<Eigen::Matrix<double, 9, 9> > hn[3];
+        std::array<Eigen::Matrix<double, 9, 9>, 3> hn[3];
 
         Eigen::Matrix<double, 3, 9> dcn;
-        std::vector<Eigen::Matrix<double, 9, 9> > hcn;
-        Eigen::Vector3d cNormal = faceNormal(mesh, curPos, face, 0, (derivative || hessian) ? &dcn : NULL, hessian ? &hcn : NULL);
+        std::array<Eigen::Matrix<double, 9, 9>, 3> hcn;
+        Eigen::Vector3d cNormal;
+        if (cache)
+        {
+            cNormal = cache->normals[face];
+            if (derivative || hessian)
+                dcn = cache->derivatives[face];
+        }
+        else
+        {
+            cNormal = faceNormal(mesh, curPos, face, 0, (derivative || hessian) ? &dcn : NULL, hessian ? &hcn : NULL);
+        }
+        // the normal Hessians are constant, so the cached one serves every face
+        const std::array<Eigen::Matrix<double, 9, 9>, 3>& cnhess = cache && hessian ? cache->hessian : hcn;
+        const std::array<Eigen::Matrix<double, 9, 9>, 3>* nhess[3];
 
         for (int i = 0; i < 3; i++)
         {
-            int oppidx = mesh.vertexOppositeFaceEdge(face, i);
-            int edge = mesh.faceEdge(face, i);
-            int oppface = mesh.edgeFace(edge, 1 - mesh.faceEdgeOrientation(face, i));
+            int oppidx = stencil.oppositeVertices[i];
+            int oppface = stencil.oppositeFaces[i];
+            nhess[i] = &hn[i];
             if (oppface == -1)
             {
                 oppNormals[i].setZero();
                 dn[i].setZero();
-                hn[i].resize(3);
-                for (int j = 0; j < 3; j++)
-                    hn[i][j].setZero();
+                if (hessian)
+                {
+                    for (int j = 0; j < 3; j++)
+                        hn[i][j].setZero();
+                }
             }
             else
             {
                 int idx = 0;
                 for (int j = 0; j < 3; j++)
                 {
-                    if (mesh.faceVertex(oppface, j) == oppidx)
+                    if (mesh.faceStencil(oppface).vertices[j] == oppidx)
                         idx = j;
                 }
-                oppNormals[i] = faceNormal(mesh, curPos, oppface, idx, (derivative || hessian) ? &dn[i] : NULL, hessian ? &hn[i] : NULL);
+                if (cache)
+                {
+                    // the derivative with respect to the vertices starting at idx is a rotation of the cached one
+                    oppNormals[i] = cache->normals[oppface];
+                    if (derivative || hessian)
+                    {
+                        for (int j = 0; j < 3; j++)
+                            dn[i].block<3, 3>(0, 3 * j) = cache->derivatives[oppface].block<3, 3>(0, 3 * ((idx + j) % 3));
+                    }
+                    nhess[i] = &cnhess;
+                }
+                else
+                {
+                    oppNormals[i] = faceNormal(mesh, curPos, oppface, idx, (derivative || hessian) ? &dn[i] : NULL, hessian ? &hn[i] : NULL);
+                }
             }
         }
 
@@ -63,7 +97,7 @@ namespace LibShell {
         double mnorms[3];
         for (int i = 0; i < 3; i++)
         {
-            qs[i] = curPos.row(mesh.faceVertex(face, i)).transpose();
+            qs[i] = curPos.row(stencil.vertices[i]).transpose();
             mvec[i] = oppNormals[i] + cNormal;
             mnorms[i] = mvec[i].norm();
         }
@@ -176,9 +210,9 @@ namespace LibShell {
 
                         for (int l = 0; l < 3; l++)
                         {
-                            (*hessian)[i].block<3, 3>(miidx[j], miidx[k]) += (-1.0 / mnorms[i] / mnorms[i] / mnorms[i]) * qdoto * mvec[i][l] * hn[i][l].block<3, 3>(3 * j, 3 * k);
-                            (*hessian)[i].block<3, 3>(3 * j, 3 * k) += (-1.0 / mnorms[i] / mnorms[i] / mnorms[i]) * qdoto * mvec[i][l] * hcn[l].block<3, 3>(3 * j, 3 * k);
-                            (*hessian)[i].block<3, 3>(miidx[j], miidx[k]) += (1.0 / mnorms[i]) * qvec[i][l] * hn[i][l].block<3, 3>(3 * j, 3 * k);
+                            (*hessian)[i].block<3, 3>(miidx[j], miidx[k]) += (-1.0 / mnorms[i] / mnorms[i] / mnorms[i]) * qdoto * mvec[i][l] * (*nhess[i])[l].block<3, 3>(3 * j, 3 * k);
+                            (*hessian)[i].block<3, 3>(3 * j, 3 * k) += (-1.0 / mnorms[i] / mnorms[i] / mnorms[i]) * qdoto * mvec[i][l] * cnhess[l].block<3, 3>(3 * j, 3 * k);
+                            (*hessian)[i].block<3, 3>(miidx[j], miidx[k]) += (1.0 / mnorms[i]) * qvec[i][l] * (*nhess[i])[l].block<3, 3>(3 * j, 3 * k);
                         }
                     }
                 }
@@ -191,11 +225,12 @@ namespace LibShell {
 
     Eigen::Matrix2d MidedgeAverageFormulation::secondFundamentalForm(
         const MeshConnectivity& mesh,
-        const Eigen::MatrixXd& curPos,
-        const Eigen::VectorXd& extraDOFs,
+        const PositionsRef& curPos,
+        const EdgeDOFsRef& extraDOFs,
         int face,
         Eigen::Matrix<double, 4, 18>* derivative,
-        std::vector<Eigen::Matrix<double, 18, 18> >* hessian)
+        std::array<Eigen::Matrix<double, 18, 18>, 4>* hessian,
+        const GeometryCache* cache)
     {
         if (derivative)
         {
@@ -204,19 +239,17 @@ namespace LibShell {
         }
         if (hessian)
         {
-            hessian->resize(4);
             for (int i = 0; i < 4; i++)
             {
-                (*hessian)[i].resize(18, 18);
                 (*hessian)[i].setZero();
             }
         }
 
 
         Eigen::Matrix<double, 3, 18> IIderiv;
-        std::vector < Eigen::Matrix<double, 18, 18> > IIhess;
+        std::array<Eigen::Matrix<double, 18, 18>, 3> IIhess;
 
-        Eigen::Vector3d II = secondFundamentalFormEntries(mesh, curPos, face, derivative ? &IIderiv : NULL, hessian ? &IIhess : NULL);
+        Eigen::Vector3d II = secondFundamentalFormEntries(mesh, curPos, face, derivative ? &IIderiv : NULL, hessian ? &IIhess : NULL, cache);
 
         Eigen::Matrix2d result;
         result << II[0] + II[1], II[0], II[0], II[0] + II[2];
@@ -249,6 +282,17 @@ namespace LibShell {
 
     constexpr int MidedgeAverageFormulation::numExtraDOFs;
 
+    void MidedgeAverageFormulation::computeGeometryCache(
+        const MeshConnectivity& mesh,
+        const PositionsRef& curPos,
+        bool derivatives,
+        bool hessians,
+        GeometryCache& cache,
+        const ExecutionContext& ctx)
+    {
+        computeFaceNormals(mesh, curPos, derivatives, hessians, cache, ctx);
+    }
+
     void MidedgeAverageFormulation::initializeExtraDOFs(Eigen::VectorXd& extraDOFs, const MeshConnectivity& mesh, const Eigen::MatrixXd& curPos)
     {
         extraDOFs.resize(0);
@@ -0,0 +1,106 @@
+#ifndef STENCILDOFS_H
+#define STENCILDOFS_H
+
+#include "../include/MeshConnectivity.h"
+#include "../include/types.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace LibShell {
+
+    /*
+     * Global indices of the degrees of freedom the stretching energy of a face depends on, in the order used by
+     * MaterialModel::stretchingEnergy: the three vertices of the face.
+     */
+    inline void stretchingStencil(const MeshConnectivity& mesh, int face, int* dofs)
+    {
+        const FaceStencil& stencil = mesh.faceStencil(face);
+        for (int j = 0; j < 3; j++)
+        {
+            for (int k = 0; k < 3; k++)
+                dofs[3 * j + k] = 3 * stencil.vertices[j] + k;
+        }
+    }
+
+    /*
+     * Global indices of the degrees of freedom the bending energy of a face depends on, in the order used by
+     * MaterialModel::bendingEnergy: the face vertices, the three opposite vertices, then the extra DOFs on the face
+     * edges. Entries of missing opposite vertices (boundary edges) are set to -1.
+     * Note that the first nine entries are the stretching stencil of the face.
+     */
+    inline void bendingStencil(const MeshConnectivity& mesh, int nverts, int nedgedofs, int face, int* dofs)
+    {
+        const FaceStencil& stencil = mesh.faceStencil(face);
+        for (int j = 0; j < 3; j++)
+        {
+            int oppidx = stencil.oppositeVertices[j];
+            for (int k = 0; k < 3; k++)
+            {
+                dofs[3 * j + k] = 3 * stencil.vertices[j] + k;
+                dofs[9 + 3 * j + k] = oppidx == -1 ? -1 : 3 * oppidx + k;
+            }
+            for (int k = 0; k < nedgedofs; k++)
+                dofs[18 + nedgedofs * j + k] = 3 * nverts + nedgedofs * stencil.edges[j] + k;
+        }
+    }
+
+    // Whether Hessian entry (row, col) is part of the given storage
+    inline bool isStoredEntry(HessianStorage storage, int row, int col)
+    {
+        switch (storage)
+        {
+        case HessianStorage::kLower:
+            return row >= col;
+        case HessianStorage::kUpper:
+            return row <= col;
+        default:
+            return true;
+        }
+    }
+
+    /*
+     * Exact number of Hessian triplets the assembly emits for faces [faceBegin, faceEnd): one per stored pair of valid
+     * stencil DOFs, for the stretching and/or bending stencils.
+     */
+    inline size_t countHessianTriplets(const MeshConnectivity& mesh, int nverts, int nedgedofs, bool stretching, bool bending,
+        HessianStorage storage, int faceBegin, int faceEnd)
+    {
+        size_t count = 0;
+        int nlocal = 18 + 3 * nedgedofs;
+        // on the stack for the shipped formulations (at most one extra DOF per edge), so that counting does not allocate
+        int stackDofs[21];
+        std::vector<int> heapDofs;
+        int* dofs = stackDofs;
+        if (nlocal > 21)
+        {
+            heapDofs.resize(nlocal);
+            dofs = heapDofs.data();
+        }
+        for (int i = faceBegin; i < faceEnd; i++)
+        {
+            bendingStencil(mesh, nverts, nedgedofs, i, dofs);
+            // the stretching stencil is the first 9 entries of the bending stencil. With both terms, the assembly sums the
+            // two element Hessians before emitting them, so the stretching entries are not counted separately.
+            for (int pass = 0; pass < 2; pass++)
+            {
+                if ((pass == 0 && (!stretching || bending)) || (pass == 1 && !bending))
+                    continue;
+                int n = pass == 0 ? 9 : nlocal;
+                for (int j = 0; j < n; j++)
+                {
+                    if (dofs[j] == -1)
+                        continue;
+                    for (int k = 0; k < n; k++)
+                    {
+                        if (dofs[k] != -1 && isStoredEntry(storage, dofs[j], dofs[k]))
+                            count++;
+                    }
+                }
+            }
+        }
+        return count;
+    }
+};
+
+#endif
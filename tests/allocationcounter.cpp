@@ -0,0 +1,33 @@
+#include "allocationcounter.h"
+#include <cstdlib>
+#include <new>
+
+/*
+ * Replacements of the global operator new and delete that count the allocations. They live in their own translation
+ * unit so that they are not inlined into the tests, where the compiler would otherwise pair the inlined malloc of one
+ * with the free of another and report mismatched allocation functions.
+ */
+
+std::atomic<long> numAllocations(0);
+
+void* operator new(std::size_t size)
+{
+    numAllocations++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    numAllocations++;
+    std::size_t alignment = (std::size_t)align;
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
@@ -0,0 +1,9 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <atomic>
+
+// Number of calls to the global operator new so far, for checking that the per-face kernels do not allocate
+extern std::atomic<long> numAllocations;
+
+#endif
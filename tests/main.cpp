@@ -1,4 +1,5 @@
 #include <Eigen/Core>
+#include <Eigen/Dense>
 #include <iostream>
 #include <map>
 #include <cmath>
@@ -13,11 +14,24 @@
 #include "../include/TensionFieldStVKMaterial.h"
 #include "../include/NeoHookeanMaterial.h"
 #include "../include/RestState.h"
+#include "../include/HessianAssemblyPlan.h"
+#include "../include/IncrementalElasticEnergy.h"
+#include "../include/BlockSparseMatrix.h"
+#include "../include/AssemblyWorkspace.h"
+#include "../include/MeshReordering.h"
 #include "findiff.h"
+#include "allocationcounter.h"
 #include <random>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <thread>
 
 std::default_random_engine rng;
 
+// number of failed checks that must hold exactly (rather than up to round-off); nonzero fails the program
+int numFailures = 0;
+
 const int nummats = 4;
 const int numsff = 4;    
 
@@ -78,6 +92,25 @@ void makeSquareMesh(int dim, Eigen::MatrixXd &V, Eigen::MatrixXi &F)
     }
 }
 
+// Monolayer rest state with the given thicknesses and uniform Lame parameters, whose rest fundamental forms are those of
+// restPos and edgeDOFs
+template<class SFF>
+void makeMonolayerRestState(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& edgeDOFs,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta,
+    LibShell::MonolayerRestState& restState)
+{
+    restState.thicknesses.resize(mesh.nFaces());
+    for (int i = 0; i < mesh.nFaces(); i++)
+        restState.thicknesses[i] = thicknesses[i];
+    restState.lameAlpha.assign(mesh.nFaces(), lameAlpha);
+    restState.lameBeta.assign(mesh.nFaces(), lameBeta);
+    LibShell::ElasticShell<SFF>::firstFundamentalForms(mesh, restPos, restState.abars);
+    LibShell::ElasticShell<SFF>::secondFundamentalForms(mesh, restPos, edgeDOFs, restState.bbars);
+}
+
 void printDiffLog(const std::map<int, double> &difflog)
 {
     for (auto it : difflog)
@@ -332,6 +365,181 @@ double bilayerTest(const LibShell::MeshConnectivity& mesh,
     return std::fabs(energy1 - energy2);
 }
 
+template<class SFF> 
+double threadingTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta,
+    int numThreads)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    int ndofs = 3 * (int)curPos.rows() + (int)edgeDOFs.size();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
+
+    LibShell::StVKMaterial<SFF> mat;
+
+    Eigen::VectorXd deriv1, deriv2;
+    std::vector<Eigen::Triplet<double> > hessian1, hessian2;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, &deriv1, &hessian1,
+        LibShell::HessianProjectType::kNone, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(1));
+    double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, &deriv2, &hessian2,
+        LibShell::HessianProjectType::kNone, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(numThreads));
+
+    Eigen::SparseMatrix<double> H1(ndofs, ndofs), H2(ndofs, ndofs);
+    H1.setFromTriplets(hessian1.begin(), hessian1.end());
+    H2.setFromTriplets(hessian2.begin(), hessian2.end());
+
+    // relative differences, since the magnitudes vary wildly with the random configuration
+    return std::fabs(energy1 - energy2) / std::fabs(energy1) + (deriv1 - deriv2).norm() / deriv1.norm() + (H1 - H2).norm() / H1.norm();
+}
+
+template<class SFF> 
+double assemblyPlanTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta,
+    int numThreads)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    int ndofs = 3 * (int)curPos.rows() + (int)edgeDOFs.size();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+
+    std::vector<Eigen::Triplet<double> > hessian;
+    LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian,
+        LibShell::HessianProjectType::kMaxZero);
+    Eigen::SparseMatrix<double> H1(ndofs, ndofs);
+    H1.setFromTriplets(hessian.begin(), hessian.end());
+
+    // the second evaluation reuses the matrix filled by the first
+    LibShell::HessianAssemblyPlan plan(mesh, (int)curPos.rows(), SFF::numExtraDOFs);
+    Eigen::SparseMatrix<double> H2;
+    double diff = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        LibShell::ElasticShell<SFF>::elasticEnergy(
+            mesh, curPos, edgeDOFs, mat, restState, NULL, plan, &H2,
+            LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(numThreads));
+        diff += (H1 - H2).norm() / H1.norm();
+    }
+
+    // a matrix with as many nonzeros but a different pattern must be reinitialized, not filled through the offsets
+    Eigen::VectorXi perm(ndofs);
+    for (int i = 0; i < ndofs; i++)
+        perm[i] = (i + 1) % ndofs;
+    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> P(perm);
+    Eigen::SparseMatrix<double> H3 = P * H2 * P.transpose();
+    LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, NULL, plan, &H3,
+        LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(numThreads));
+    diff += (H1 - H3).norm() / H1.norm();
+    return diff;
+}
+
+template<class SFF> 
+double symmetricStorageTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    int ndofs = 3 * (int)curPos.rows() + (int)edgeDOFs.size();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
+
+    LibShell::StVKMaterial<SFF> mat;
+
+    std::vector<Eigen::Triplet<double> > hessian;
+    LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian,
+        LibShell::HessianProjectType::kMaxZero);
+    Eigen::SparseMatrix<double> H(ndofs, ndofs);
+    H.setFromTriplets(hessian.begin(), hessian.end());
+
+    // triangle from triplets, expanded back to the full matrix
+    LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian,
+        LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kLower);
+    Eigen::SparseMatrix<double> L(ndofs, ndofs);
+    L.setFromTriplets(hessian.begin(), hessian.end());
+    Eigen::SparseMatrix<double> fullL = L.selfadjointView<Eigen::Lower>();
+
+    LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian,
+        LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kUpper);
+    Eigen::SparseMatrix<double> U(ndofs, ndofs);
+    U.setFromTriplets(hessian.begin(), hessian.end());
+    Eigen::SparseMatrix<double> fullU = U.selfadjointView<Eigen::Upper>();
+
+    // triangle through an assembly plan
+    LibShell::HessianAssemblyPlan plan(mesh, (int)curPos.rows(), SFF::numExtraDOFs, LibShell::HessianStorage::kLower);
+    Eigen::SparseMatrix<double> P;
+    LibShell::ElasticShell<SFF>::elasticEnergy(
+        mesh, curPos, edgeDOFs, mat, restState, NULL, plan, &P,
+        LibShell::HessianProjectType::kMaxZero);
+    Eigen::SparseMatrix<double> fullP = P.selfadjointView<Eigen::Lower>();
+
+    return (H - fullL).norm() / H.norm() + (H - fullU).norm() / H.norm() + (H - fullP).norm() / H.norm();
+}
+
+// Compares projSymMatrix against a reference eigendecomposition, on random symmetric matrices
+template<int N>
+double projectionTest(LibShell::HessianProjectType projType)
+{
+    const int count = 11;
+    std::uniform_real_distribution<double> dist(-1, 1);
+    Eigen::Matrix<double, N, N> A[count];
+    for (int i = 0; i < count; i++)
+    {
+        Eigen::Matrix<double, N, N> R;
+        for (int j = 0; j < N; j++)
+            for (int k = 0; k < N; k++)
+                R(j, k) = dist(rng);
+        // a mix of positive definite, rank-deficient positive semidefinite, and indefinite matrices
+        if (i % 3 == 0)
+            A[i] = R * R.transpose();
+        else if (i % 3 == 1)
+            A[i] = R.leftCols(N / 3) * R.leftCols(N / 3).transpose();
+        else
+            A[i] = R + R.transpose();
+    }
+
+    double diff = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Eigen::Matrix<double, N, N> B = A[i];
+        LibShell::projSymMatrix(B, projType);
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, N, N> > es(A[i]);
+        Eigen::Matrix<double, N, 1> D = es.eigenvalues();
+        for (int j = 0; j < N; j++)
+        {
+            if (D[j] < 0)
+                D[j] = projType == LibShell::HessianProjectType::kAbs ? -D[j] : 0;
+        }
+        Eigen::Matrix<double, N, N> ref = es.eigenvectors() * D.asDiagonal() * es.eigenvectors().transpose();
+        diff += (ref - B).norm() / ref.norm();
+    }
+    return diff;
+}
+
 template<class SFF> 
 void getHessian(const LibShell::MeshConnectivity &mesh, 
     const Eigen::MatrixXd &curPos, 
@@ -345,15 +553,7 @@ void getHessian(const LibShell::MeshConnectivity &mesh,
     int nedgeDOFs = (int)edgeDOFs.size();
 
     LibShell::MonolayerRestState restState;
-    restState.thicknesses.resize(mesh.nFaces());
-    for (int i = 0; i < mesh.nFaces(); i++)
-        restState.thicknesses[i] = thicknesses[i];
-
-    restState.lameAlpha.resize(mesh.nFaces(), lameAlpha);
-    restState.lameBeta.resize(mesh.nFaces(), lameBeta);
-
-    LibShell::ElasticShell<SFF>::firstFundamentalForms(mesh, curPos, restState.abars);
-    LibShell::ElasticShell<SFF>::secondFundamentalForms(mesh, curPos, edgeDOFs, restState.bbars);
+    makeMonolayerRestState<SFF>(mesh, curPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
 
     std::vector<Eigen::Triplet<double> > hessian;
 
@@ -390,6 +590,903 @@ void getHessian(const LibShell::MeshConnectivity &mesh,
 }
 
 
+// Checks the strain-space projected stretching Hessians of a material: they should match the exact Hessians when the
+// rest shape is stretched by the given scales (as the exact Hessians are positive semidefinite already), both per face and
+// after assembly (against kMaxZero), and be positive semidefinite everywhere. Returns the relative differences, and the
+// smallest relative eigenvalue on a random configuration.
+template<template<class> class Material>
+Eigen::Vector3d strainSpaceProjectionTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta,
+    const Eigen::Vector3d& scales)
+{
+    typedef LibShell::MidedgeAngleTanFormulation SFF;
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, restPos);
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
+
+    Material<SFF> mat;
+    Eigen::Vector3d result(0, 0, 0);
+
+    Eigen::MatrixXd curPos = restPos * scales.asDiagonal();
+    for (int i = 0; i < mesh.nFaces(); i++)
+    {
+        Eigen::Matrix<double, 9, 9> exact, projected;
+        mat.stretchingEnergy(mesh, curPos, restState, i, NULL, &exact);
+        mat.stretchingEnergy(mesh, curPos, restState, i, NULL, &projected, LibShell::HessianProjectType::kStrainSpace);
+        result[0] = std::max(result[0], (exact - projected).norm() / exact.norm());
+    }
+
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    int ndofs = 3 * (int)curPos.rows() + (int)edgeDOFs.size();
+    std::vector<Eigen::Triplet<double> > hessian;
+    LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian, LibShell::HessianProjectType::kMaxZero);
+    Eigen::SparseMatrix<double> H1(ndofs, ndofs);
+    H1.setFromTriplets(hessian.begin(), hessian.end());
+    LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian, LibShell::HessianProjectType::kStrainSpace);
+    Eigen::SparseMatrix<double> H2(ndofs, ndofs);
+    H2.setFromTriplets(hessian.begin(), hessian.end());
+    result[1] = (H1 - H2).norm() / H1.norm();
+
+    curPos.setRandom();
+    for (int i = 0; i < mesh.nFaces(); i++)
+    {
+        Eigen::Matrix<double, 9, 9> projected;
+        mat.stretchingEnergy(mesh, curPos, restState, i, NULL, &projected, LibShell::HessianProjectType::kStrainSpace);
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9> > es(projected);
+        if (es.eigenvalues().cwiseAbs().maxCoeff() > 0)
+            result[2] = std::min(result[2], es.eigenvalues()[0] / es.eigenvalues().cwiseAbs().maxCoeff());
+    }
+    return result;
+}
+
+// Edits a rest state in place after its derived data was cached, then compares the energy and gradient against a
+// freshly built (and cached) rest state holding the same data
+template<class SFF>
+double restStateCacheTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
+
+    restState.updateCache();
+
+    LibShell::StVKMaterial<SFF> mat;
+    Eigen::VectorXd deriv1, deriv2;
+
+    for (int i = 0; i < mesh.nFaces(); i++)
+    {
+        restState.thicknesses[i] *= 2.0;
+        restState.abars[i] *= 1.5;
+    }
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv1, NULL);
+
+    LibShell::MonolayerRestState freshState;
+    freshState.thicknesses = restState.thicknesses;
+    freshState.abars = restState.abars;
+    freshState.bbars = restState.bbars;
+    freshState.lameAlpha = restState.lameAlpha;
+    freshState.lameBeta = restState.lameBeta;
+    freshState.updateCache();
+    double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, freshState, &deriv2, NULL);
+
+    return std::fabs(energy1 - energy2) / std::fabs(energy2) + (deriv1 - deriv2).norm() / deriv2.norm();
+}
+
+// Energy and gradient evaluated from several threads at once on one shared rest state, whose cache was never filled,
+// against a serial evaluation
+template<class SFF>
+double concurrentRestStateTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses,
+    double lameAlpha, double lameBeta)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, lameAlpha, lameBeta, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    const int nthreads = 4;
+    double energies[nthreads];
+    Eigen::VectorXd derivs[nthreads];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++)
+    {
+        threads.emplace_back([&, t]()
+            {
+                energies[t] = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &derivs[t], NULL);
+            });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    Eigen::VectorXd deriv;
+    double energy = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv, NULL);
+    double diff = 0;
+    for (int t = 0; t < nthreads; t++)
+        diff = std::max(diff, std::fabs(energies[t] - energy) / std::fabs(energy) + (derivs[t] - deriv).norm() / deriv.norm());
+    return diff;
+}
+
+// Number of heap allocations made by the stretching and bending kernels of all materials, over all faces
+template<class SFF>
+long allocationTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+    LibShell::MonolayerRestState monoRestState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, monoRestState);
+    LibShell::BilayerRestState biRestState;
+    biRestState.layers[0] = monoRestState;
+    biRestState.layers[1] = monoRestState;
+    monoRestState.updateCache();
+    biRestState.updateCache();
+
+    typename SFF::GeometryCache cache;
+    SFF::computeGeometryCache(mesh, curPos, true, true, cache);
+
+    LibShell::NeoHookeanMaterial<SFF> neoHookean;
+    LibShell::StVKMaterial<SFF> stvk;
+    LibShell::TensionFieldStVKMaterial<SFF> tensionField;
+    LibShell::BilayerStVKMaterial<SFF> bilayer;
+    const LibShell::MaterialModel<SFF>* mats[] = { &neoHookean, &stvk, &tensionField, &bilayer };
+
+    constexpr int ndofs = 18 + 3 * SFF::numExtraDOFs;
+    Eigen::Matrix<double, 1, 9> sderiv;
+    Eigen::Matrix<double, 9, 9> shess;
+    Eigen::Matrix<double, 1, ndofs> bderiv;
+    Eigen::Matrix<double, ndofs, ndofs> bhess;
+
+    long start = numAllocations;
+    for (int m = 0; m < 4; m++)
+    {
+        const LibShell::RestState& restState = m == 3 ? (const LibShell::RestState&)biRestState : monoRestState;
+        for (int i = 0; i < mesh.nFaces(); i++)
+        {
+            mats[m]->stretchingEnergy(mesh, curPos, restState, i, &sderiv, &shess);
+            mats[m]->bendingEnergy(mesh, curPos, edgeDOFs, restState, i, &bderiv, &bhess);
+            mats[m]->bendingEnergy(mesh, curPos, edgeDOFs, restState, i, &bderiv, &bhess, &cache);
+        }
+    }
+    return numAllocations - start;
+}
+
+template<class SFF, class Material>
+double staticDispatchDiff(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& curPos,
+    const Eigen::VectorXd& edgeDOFs,
+    const Material& mat,
+    const LibShell::RestState& restState)
+{
+    Eigen::VectorXd deriv1, deriv2;
+    std::vector<Eigen::Triplet<double> > hess1, hess2;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv1, &hess1);
+    double energy2 = LibShell::ElasticShell<SFF>::template elasticEnergy<Material>(mesh, curPos, edgeDOFs, mat, restState, &deriv2, &hess2);
+
+    int ndofs = (int)deriv1.size();
+    Eigen::SparseMatrix<double> H1(ndofs, ndofs), H2(ndofs, ndofs);
+    H1.setFromTriplets(hess1.begin(), hess1.end());
+    H2.setFromTriplets(hess2.begin(), hess2.end());
+    return std::fabs(energy1 - energy2) + (deriv1 - deriv2).norm() + (H1 - H2).norm();
+}
+
+// Statically dispatched assembly vs. the virtual one, summed over all materials
+template<class SFF>
+double staticDispatchTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+    LibShell::MonolayerRestState monoRestState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, monoRestState);
+    LibShell::BilayerRestState biRestState;
+    biRestState.layers[0] = monoRestState;
+    biRestState.layers[1] = monoRestState;
+
+    double diff = 0;
+    diff += staticDispatchDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::NeoHookeanMaterial<SFF>(), monoRestState);
+    diff += staticDispatchDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::StVKMaterial<SFF>(), monoRestState);
+    diff += staticDispatchDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::TensionFieldStVKMaterial<SFF>(), monoRestState);
+    diff += staticDispatchDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::BilayerStVKMaterial<SFF>(), biRestState);
+    return diff;
+}
+
+// Energy, gradient and Hessian from a flat DOF vector vs. from separate positions and edge DOFs
+template<class SFF>
+double flatDOFsTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    int nverts = (int)curPos.rows();
+    Eigen::VectorXd dofs(3 * nverts + edgeDOFs.size());
+    for (int i = 0; i < nverts; i++)
+        dofs.segment<3>(3 * i) = curPos.row(i).transpose();
+    dofs.tail(edgeDOFs.size()) = edgeDOFs;
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    int whichTerms = LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING | LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING;
+    Eigen::VectorXd deriv1, deriv2, deriv3;
+    std::vector<Eigen::Triplet<double> > hess1, hess2;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, whichTerms, &deriv1, &hess1);
+    double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, dofs, mat, restState, whichTerms, &deriv2, &hess2);
+
+    LibShell::HessianAssemblyPlan plan(mesh, nverts, SFF::numExtraDOFs);
+    Eigen::SparseMatrix<double> H3;
+    double energy3 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, dofs, mat, restState, whichTerms, &deriv3, plan, &H3);
+
+    int ndofs = (int)dofs.size();
+    Eigen::SparseMatrix<double> H1(ndofs, ndofs), H2(ndofs, ndofs);
+    H1.setFromTriplets(hess1.begin(), hess1.end());
+    H2.setFromTriplets(hess2.begin(), hess2.end());
+    return std::fabs(energy1 - energy2) + std::fabs(energy1 - energy3) + (deriv1 - deriv2).norm() + (deriv1 - deriv3).norm()
+        + (H1 - H2).norm() + (H1 - H3).norm();
+}
+
+// Matrix-free Hessian-vector products vs. products with the assembled Hessian, serial and threaded
+template<class SFF>
+double hessianVectorProductTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    int ndofs = 3 * (int)curPos.rows() + SFF::numExtraDOFs * mesh.nEdges();
+    Eigen::VectorXd v = Eigen::VectorXd::Random(ndofs);
+
+    double maxerr = 0;
+    LibShell::HessianProjectType projTypes[] = { LibShell::HessianProjectType::kNone, LibShell::HessianProjectType::kMaxZero };
+    for (auto projType : projTypes)
+    {
+        std::vector<Eigen::Triplet<double> > hessian;
+        double energy = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian, projType);
+        Eigen::SparseMatrix<double> H(ndofs, ndofs);
+        H.setFromTriplets(hessian.begin(), hessian.end());
+        Eigen::VectorXd Hv = H * v;
+
+        for (int nthreads : { 1, 3 })
+        {
+            Eigen::VectorXd out;
+            double productEnergy = LibShell::ElasticShell<SFF>::hessianVectorProduct(mesh, curPos, edgeDOFs, mat, restState, v, out, projType,
+                LibShell::ExecutionContext(nthreads));
+            maxerr = std::max(maxerr, std::fabs(energy - productEnergy) / std::max(1.0, std::fabs(energy)));
+            maxerr = std::max(maxerr, (out - Hv).norm() / std::max(1.0, Hv.norm()));
+        }
+    }
+    return maxerr;
+}
+
+// Diagonal blocks accumulated directly vs. read off the assembled Hessian, serial and threaded
+template<class SFF>
+double diagonalBlocksTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    int nverts = (int)curPos.rows();
+    int ndofs = 3 * nverts + SFF::numExtraDOFs * mesh.nEdges();
+
+    double maxerr = 0;
+    LibShell::HessianProjectType projTypes[] = { LibShell::HessianProjectType::kNone, LibShell::HessianProjectType::kMaxZero };
+    for (auto projType : projTypes)
+    {
+        std::vector<Eigen::Triplet<double> > hessian;
+        LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, &hessian, projType);
+        Eigen::SparseMatrix<double> H(ndofs, ndofs);
+        H.setFromTriplets(hessian.begin(), hessian.end());
+        Eigen::MatrixXd Hdense(H);
+
+        for (int nthreads : { 1, 3 })
+        {
+            std::vector<Eigen::Matrix3d> blocks;
+            Eigen::VectorXd diag;
+            LibShell::ElasticShell<SFF>::hessianDiagonalBlocks(mesh, curPos, edgeDOFs, mat, restState, blocks, diag, projType,
+                LibShell::ExecutionContext(nthreads));
+            double err = 0;
+            for (int i = 0; i < nverts; i++)
+                err += (blocks[i] - Hdense.block<3, 3>(3 * i, 3 * i)).norm();
+            err += (diag - Hdense.diagonal().tail(ndofs - 3 * nverts)).norm();
+            maxerr = std::max(maxerr, err / std::max(1.0, Hdense.norm()));
+        }
+    }
+    return maxerr;
+}
+
+// Incremental update after moving a few vertices and edge DOFs vs. a full evaluation at the new configuration
+template<class SFF>
+double incrementalTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    int nverts = (int)curPos.rows();
+    LibShell::IncrementalElasticEnergy<SFF> incremental(mesh, mat, restState, nverts);
+    incremental.evaluate(curPos, edgeDOFs);
+
+    std::vector<int> dirtyVertices = { 0, nverts / 2, nverts - 1 };
+    std::vector<int> dirtyEdges = { 0, mesh.nEdges() / 3 };
+    for (int v : dirtyVertices)
+        curPos.row(v) += Eigen::RowVector3d::Random();
+    for (int e : dirtyEdges)
+    {
+        for (int k = 0; k < SFF::numExtraDOFs; k++)
+            edgeDOFs[SFF::numExtraDOFs * e + k] += 0.5;
+    }
+    double energy = incremental.update(curPos, edgeDOFs, dirtyVertices, dirtyEdges, LibShell::ExecutionContext(2));
+
+    Eigen::VectorXd derivative;
+    Eigen::SparseMatrix<double> H;
+    double fullEnergy = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &derivative, incremental.plan(), &H);
+    double err = std::fabs(energy - fullEnergy) / std::max(1.0, std::fabs(fullEnergy));
+    err += (incremental.derivative() - derivative).norm() / std::max(1.0, derivative.norm());
+    err += (incremental.hessian() - H).norm() / std::max(1.0, H.norm());
+    return err;
+}
+
+// Validity of the face coloring, and colored vs. buffered threaded assembly of the derivative and Hessian
+template<class SFF>
+double coloredAssemblyTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    LibShell::FaceColoring coloring;
+    mesh.bendingStencilColoring(coloring);
+
+    // count pairs of same-colored faces sharing a stencil vertex
+    double conflicts = 0;
+    int nverts = (int)restPos.rows();
+    for (int c = 0; c < coloring.nColors(); c++)
+    {
+        std::vector<int> seen(nverts, 0);
+        for (int k = coloring.colorOffsets[c]; k < coloring.colorOffsets[c + 1]; k++)
+        {
+            int face = coloring.faces[k];
+            for (int j = 0; j < 3; j++)
+            {
+                int opp = mesh.vertexOppositeFaceEdge(face, j);
+                conflicts += seen[mesh.faceVertex(face, j)]++;
+                if (opp != -1)
+                    conflicts += seen[opp]++;
+            }
+        }
+    }
+    if ((int)coloring.faces.size() != mesh.nFaces())
+        conflicts += 1;
+
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    LibShell::HessianAssemblyPlan plan(mesh, nverts, SFF::numExtraDOFs);
+    Eigen::VectorXd deriv1, deriv2;
+    Eigen::SparseMatrix<double> H1, H2;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv1, plan, &H1,
+        LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(3));
+    double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv2, plan, &H2,
+        LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(3, &coloring));
+    return conflicts + std::fabs(energy1 - energy2) / std::max(1.0, std::fabs(energy1)) + (deriv1 - deriv2).norm() / std::max(1.0, deriv1.norm())
+        + (H1 - H2).norm() / std::max(1.0, H1.norm());
+}
+
+// Block-sparse Hessian vs. the plan-assembled one: conversion to CSC and products, serial and threaded
+template<class SFF>
+double blockSparseTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::NeoHookeanMaterial<SFF> mat;
+    int nverts = (int)curPos.rows();
+    LibShell::HessianAssemblyPlan plan(mesh, nverts, SFF::numExtraDOFs);
+    Eigen::VectorXd deriv1;
+    Eigen::SparseMatrix<double> H1;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv1, plan, &H1);
+    Eigen::VectorXd v = Eigen::VectorXd::Random(H1.rows());
+    Eigen::VectorXd Hv = H1 * v;
+
+    double maxerr = 0;
+    LibShell::FaceColoring coloring;
+    mesh.bendingStencilColoring(coloring);
+    LibShell::ExecutionContext contexts[] = { LibShell::ExecutionContext(1), LibShell::ExecutionContext(3), LibShell::ExecutionContext(3, &coloring) };
+    for (auto& ctx : contexts)
+    {
+        LibShell::BlockSparseMatrix B(mesh, nverts, SFF::numExtraDOFs);
+        Eigen::VectorXd deriv2;
+        double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv2, B,
+            LibShell::HessianProjectType::kMaxZero, ctx);
+        Eigen::SparseMatrix<double> H2;
+        B.toSparse(H2);
+        Eigen::VectorXd Bv;
+        B.multiply(v, Bv, ctx);
+        double err = std::fabs(energy1 - energy2) / std::max(1.0, std::fabs(energy1)) + (deriv1 - deriv2).norm() / std::max(1.0, deriv1.norm())
+            + (H1 - H2).norm() / std::max(1.0, H1.norm()) + (Hv - Bv).norm() / std::max(1.0, Hv.norm());
+        maxerr = std::max(maxerr, err);
+    }
+    return maxerr;
+}
+
+// Predicted vs. actual number of Hessian triplets; the buffer must not have grown past the reserved size
+template<class SFF>
+double tripletCountTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, restPos);
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::StVKMaterial<SFF> mat;
+    double mismatches = 0;
+    LibShell::HessianStorage storages[] = { LibShell::HessianStorage::kFull, LibShell::HessianStorage::kLower };
+    int terms[] = { LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING, LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING,
+        LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING | LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING };
+    for (auto storage : storages)
+    {
+        for (int whichTerms : terms)
+        {
+            for (int nthreads : { 1, 3 })
+            {
+                std::vector<Eigen::Triplet<double> > hessian;
+                LibShell::ElasticShell<SFF>::elasticEnergy(mesh, restPos, edgeDOFs, mat, restState, whichTerms, NULL, &hessian,
+                    LibShell::HessianProjectType::kNone, storage, LibShell::ExecutionContext(nthreads));
+                size_t expected = LibShell::ElasticShell<SFF>::numHessianTriplets(mesh, whichTerms, storage);
+                if (hessian.size() != expected || hessian.capacity() != expected)
+                    mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// Assembly through a reused AssemblyWorkspace vs. without one; the second call with the workspace must not allocate
+template<class SFF>
+double workspaceTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    LibShell::MonolayerRestState restState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, restState);
+
+    LibShell::StVKMaterial<SFF> mat;
+    LibShell::HessianAssemblyPlan plan(mesh, (int)curPos.rows(), SFF::numExtraDOFs);
+    LibShell::AssemblyWorkspace workspace;
+    double maxerr = 0;
+    for (int nthreads : { 1, 3 })
+    {
+        Eigen::VectorXd deriv1, deriv2;
+        std::vector<Eigen::Triplet<double> > hessian1;
+        Eigen::SparseMatrix<double> H1, H2;
+        double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv1, &hessian1,
+            LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(nthreads));
+        LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, plan, &H1,
+            LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(nthreads));
+        H2 = H1;
+
+        // twice, so that the second call runs on the buffers left by the first
+        double energy2 = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &workspace.derivative, &workspace.triplets,
+                LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(nthreads, NULL, &workspace));
+            LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, plan, &H2,
+                LibShell::HessianProjectType::kMaxZero, LibShell::ExecutionContext(nthreads, NULL, &workspace));
+        }
+        Eigen::SparseMatrix<double> T1(deriv1.size(), deriv1.size()), T2(deriv1.size(), deriv1.size());
+        T1.setFromTriplets(hessian1.begin(), hessian1.end());
+        T2.setFromTriplets(workspace.triplets.begin(), workspace.triplets.end());
+
+        double err = std::fabs(energy1 - energy2) / std::max(1.0, std::fabs(energy1)) + (deriv1 - workspace.derivative).norm() / std::max(1.0, deriv1.norm())
+            + (T1 - T2).norm() / std::max(1.0, T1.norm()) + (H1 - H2).norm() / std::max(1.0, H1.norm());
+        maxerr = std::max(maxerr, err);
+    }
+
+    // single threaded, as starting the worker threads allocates
+    long start = numAllocations;
+    LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &workspace.derivative, &workspace.triplets,
+        LibShell::HessianProjectType::kMaxZero, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(1, NULL, &workspace));
+    return maxerr + (numAllocations - start);
+}
+
+// Energy-only evaluation (batched kernels) vs. the energy returned along with the derivative, relative
+template<class SFF, class Material>
+double energyOnlyDiff(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& curPos,
+    const Eigen::VectorXd& edgeDOFs,
+    const Material& mat,
+    const LibShell::RestState& restState)
+{
+    Eigen::VectorXd deriv;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, &deriv, NULL);
+    double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, NULL, NULL);
+    double energy3 = LibShell::ElasticShell<SFF>::template elasticEnergy<Material>(mesh, curPos, edgeDOFs, mat, restState, NULL, NULL);
+    double energy4 = LibShell::ElasticShell<SFF>::template elasticEnergy<Material>(mesh, curPos, edgeDOFs, mat, restState, NULL, NULL,
+        LibShell::HessianProjectType::kNone, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(3));
+    std::vector<double> perElement = LibShell::ElasticShell<SFF>::elasticEnergyPerElement(mesh, curPos, edgeDOFs, mat, restState,
+        LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING | LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING);
+    double energy5 = 0;
+    for (double e : perElement)
+        energy5 += e;
+
+    double scale = std::max(1.0, std::fabs(energy1));
+    return (std::fabs(energy1 - energy2) + std::fabs(energy1 - energy3) + std::fabs(energy1 - energy4) + std::fabs(energy1 - energy5)) / scale;
+}
+
+// Energy-only evaluation, summed over all materials
+template<class SFF>
+double energyOnlyTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+    LibShell::MonolayerRestState monoRestState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, monoRestState);
+    LibShell::BilayerRestState biRestState;
+    biRestState.layers[0] = monoRestState;
+    biRestState.layers[1] = monoRestState;
+
+    double diff = 0;
+    diff += energyOnlyDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::NeoHookeanMaterial<SFF>(), monoRestState);
+    diff += energyOnlyDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::StVKMaterial<SFF>(), monoRestState);
+    diff += energyOnlyDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::TensionFieldStVKMaterial<SFF>(), monoRestState);
+    diff += energyOnlyDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::BilayerStVKMaterial<SFF>(), biRestState);
+    return diff;
+}
+
+// Single-pass assembly of both terms vs. the sum of stretching-only and bending-only assemblies, relative
+template<class SFF, class Material>
+double fusedTermsDiff(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& curPos,
+    const Eigen::VectorXd& edgeDOFs,
+    const Material& mat,
+    const LibShell::RestState& restState)
+{
+    int stretching = LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING;
+    int bending = LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING;
+    int ndofs = 3 * (int)curPos.rows() + (int)edgeDOFs.size();
+
+    Eigen::VectorXd deriv1, deriv2;
+    std::vector<Eigen::Triplet<double> > hessian1, hessian2;
+    double energy1 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, stretching, &deriv1, &hessian1,
+        LibShell::HessianProjectType::kStrainSpace);
+    double energy2 = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, bending, &deriv2, &hessian2,
+        LibShell::HessianProjectType::kStrainSpace);
+    hessian1.insert(hessian1.end(), hessian2.begin(), hessian2.end());
+    Eigen::SparseMatrix<double> H1(ndofs, ndofs);
+    H1.setFromTriplets(hessian1.begin(), hessian1.end());
+
+    double maxerr = 0;
+    for (int nthreads : { 1, 3 })
+    {
+        Eigen::VectorXd deriv;
+        std::vector<Eigen::Triplet<double> > hessian;
+        double energy = LibShell::ElasticShell<SFF>::template elasticEnergy<Material>(mesh, curPos, edgeDOFs, mat, restState, stretching | bending,
+            &deriv, &hessian, LibShell::HessianProjectType::kStrainSpace, LibShell::HessianStorage::kFull, LibShell::ExecutionContext(nthreads));
+        Eigen::SparseMatrix<double> H(ndofs, ndofs);
+        H.setFromTriplets(hessian.begin(), hessian.end());
+        double err = std::fabs(energy1 + energy2 - energy) / std::max(1.0, std::fabs(energy))
+            + (deriv1 + deriv2 - deriv).norm() / std::max(1.0, deriv.norm()) + (H1 - H).norm() / std::max(1.0, H.norm());
+        maxerr = std::max(maxerr, err);
+    }
+    return maxerr;
+}
+
+// Single-pass assembly of both terms, summed over all materials
+template<class SFF>
+double fusedTermsTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+
+    LibShell::MonolayerRestState monoRestState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, monoRestState);
+    LibShell::BilayerRestState biRestState;
+    biRestState.layers[0] = monoRestState;
+    biRestState.layers[1] = monoRestState;
+
+    double diff = 0;
+    diff += fusedTermsDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::NeoHookeanMaterial<SFF>(), monoRestState);
+    diff += fusedTermsDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::StVKMaterial<SFF>(), monoRestState);
+    diff += fusedTermsDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::TensionFieldStVKMaterial<SFF>(), monoRestState);
+    diff += fusedTermsDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::BilayerStVKMaterial<SFF>(), biRestState);
+    return diff;
+}
+
+// Energy, derivative and Hessian evaluated on a reordered copy of the mesh and mapped back vs. those of the original mesh, relative
+template<class SFF, class Material, class RestStateType>
+double reorderingDiff(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& curPos,
+    const Eigen::VectorXd& edgeDOFs,
+    const Material& mat,
+    const RestStateType& restState,
+    const LibShell::MeshReordering& reordering)
+{
+    int terms = LibShell::ElasticShell<SFF>::EnergyTerm::ET_STRETCHING | LibShell::ElasticShell<SFF>::EnergyTerm::ET_BENDING;
+    int ndofs = 3 * (int)curPos.rows() + (int)edgeDOFs.size();
+
+    Eigen::VectorXd deriv;
+    std::vector<Eigen::Triplet<double> > hessian;
+    double energy = LibShell::ElasticShell<SFF>::elasticEnergy(mesh, curPos, edgeDOFs, mat, restState, terms, &deriv, &hessian);
+    Eigen::SparseMatrix<double> H(ndofs, ndofs);
+    H.setFromTriplets(hessian.begin(), hessian.end());
+
+    Eigen::MatrixXd reorderedPos;
+    Eigen::VectorXd reorderedEdgeDOFs;
+    RestStateType reorderedRestState;
+    reordering.reorderVertices(curPos, reorderedPos);
+    reordering.reorderEdgeDOFs(edgeDOFs, SFF::numExtraDOFs, reorderedEdgeDOFs);
+    reordering.reorderRestState(restState, reorderedRestState);
+
+    Eigen::VectorXd reorderedDeriv, restoredDeriv;
+    std::vector<Eigen::Triplet<double> > reorderedHessian;
+    double reorderedEnergy = LibShell::ElasticShell<SFF>::elasticEnergy(reordering.reorderedMesh(), reorderedPos, reorderedEdgeDOFs, mat,
+        reorderedRestState, terms, &reorderedDeriv, &reorderedHessian);
+    Eigen::SparseMatrix<double> reorderedH(ndofs, ndofs), restoredH;
+    reorderedH.setFromTriplets(reorderedHessian.begin(), reorderedHessian.end());
+    reordering.restoreDOFs(reorderedDeriv, SFF::numExtraDOFs, restoredDeriv);
+    reordering.restoreHessian(reorderedH, SFF::numExtraDOFs, restoredH);
+
+    // the maps round-trip
+    Eigen::MatrixXd restoredPos;
+    Eigen::VectorXd restoredEdgeDOFs;
+    reordering.restoreVertices(reorderedPos, restoredPos);
+    reordering.restoreEdgeDOFs(reorderedEdgeDOFs, SFF::numExtraDOFs, restoredEdgeDOFs);
+
+    return std::fabs(energy - reorderedEnergy) / std::max(1.0, std::fabs(energy))
+        + (deriv - restoredDeriv).norm() / std::max(1.0, deriv.norm()) + (H - restoredH).norm() / std::max(1.0, H.norm())
+        + (curPos - restoredPos).norm() + (edgeDOFs - restoredEdgeDOFs).norm();
+}
+
+// Evaluation on the mesh reordered by each method vs. on the original mesh, summed over all materials
+template<class SFF>
+double reorderingTest(const LibShell::MeshConnectivity& mesh,
+    const Eigen::MatrixXd& restPos,
+    const Eigen::VectorXd& thicknesses)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    // nonzero edge DOFs, so that their sign flips on reversed edges are exercised
+    edgeDOFs += 0.1 * Eigen::VectorXd::Random(edgeDOFs.size());
+
+    LibShell::MonolayerRestState monoRestState;
+    makeMonolayerRestState<SFF>(mesh, restPos, edgeDOFs, thicknesses, 1.0, 1.0, monoRestState);
+    LibShell::BilayerRestState biRestState;
+    biRestState.layers[0] = monoRestState;
+    biRestState.layers[1] = monoRestState;
+
+    double diff = 0;
+    for (LibShell::ReorderingMethod method : { LibShell::ReorderingMethod::kReverseCuthillMcKee, LibShell::ReorderingMethod::kMorton })
+    {
+        LibShell::MeshReordering reordering(mesh, curPos, method);
+        diff += reorderingDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::NeoHookeanMaterial<SFF>(), monoRestState, reordering);
+        diff += reorderingDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::StVKMaterial<SFF>(), monoRestState, reordering);
+        diff += reorderingDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::TensionFieldStVKMaterial<SFF>(), monoRestState, reordering);
+        diff += reorderingDiff<SFF>(mesh, curPos, edgeDOFs, LibShell::BilayerStVKMaterial<SFF>(), biRestState, reordering);
+    }
+    return diff;
+}
+
+// Number of entries in which the connectivity of F differs from the one built with the original std::map based construction
+int connectivityMismatches(const Eigen::MatrixXi& F, int nthreads)
+{
+    std::map<std::pair<int, int>, Eigen::Vector2i> edgeFaces;
+    for (int i = 0; i < F.rows(); i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            int v0 = F(i, (j + 1) % 3);
+            int v1 = F(i, (j + 2) % 3);
+            int idx = v0 > v1 ? 1 : 0;
+            std::pair<int, int> p(std::min(v0, v1), std::max(v0, v1));
+            if (!edgeFaces.count(p))
+                edgeFaces[p] = Eigen::Vector2i(-1, -1);
+            edgeFaces[p][idx] = i;
+        }
+    }
+    std::map<std::pair<int, int>, int> edgeIndices;
+    for (auto& it : edgeFaces)
+    {
+        int idx = (int)edgeIndices.size();
+        edgeIndices[it.first] = idx;
+    }
+
+    LibShell::MeshConnectivity mesh(F, LibShell::ExecutionContext(nthreads));
+    if (mesh.nEdges() != (int)edgeFaces.size())
+        return 1;
+    int mismatches = 0;
+    int edge = 0;
+    for (auto& it : edgeFaces)
+    {
+        mismatches += mesh.edgeVertex(edge, 0) != it.first.first || mesh.edgeVertex(edge, 1) != it.first.second;
+        mismatches += mesh.edgeFace(edge, 0) != it.second[0] || mesh.edgeFace(edge, 1) != it.second[1];
+        for (int j = 0; j < 2; j++)
+        {
+            int face = it.second[j];
+            int opp = -1;
+            for (int k = 0; face != -1 && k < 3; k++)
+            {
+                if (F(face, k) != it.first.first && F(face, k) != it.first.second)
+                    opp = F(face, k);
+            }
+            mismatches += mesh.edgeOppositeVertex(edge, j) != opp;
+        }
+        edge++;
+    }
+    for (int i = 0; i < F.rows(); i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            int v0 = F(i, (j + 1) % 3);
+            int v1 = F(i, (j + 2) % 3);
+            int e = edgeIndices[std::pair<int, int>(std::min(v0, v1), std::max(v0, v1))];
+            mismatches += mesh.faceEdge(i, j) != e;
+            mismatches += mesh.faceEdgeOrientation(i, j) != (mesh.edgeFace(e, 0) == i ? 0 : 1);
+
+            // the packed stencil record agrees with the tables
+            const LibShell::FaceStencil& stencil = mesh.faceStencil(i);
+            int orient = mesh.faceEdgeOrientation(i, j);
+            mismatches += stencil.vertices[j] != F(i, j) || stencil.edges[j] != e || stencil.edgeOrientations[j] != orient;
+            mismatches += stencil.oppositeVertices[j] != mesh.edgeOppositeVertex(e, 1 - orient);
+            mismatches += stencil.oppositeFaces[j] != mesh.edgeFace(e, 1 - orient);
+            mismatches += stencil.isBoundaryEdge(j) != (mesh.edgeFace(e, 1 - orient) == -1);
+        }
+    }
+    return mismatches;
+}
+
+// Connectivity of the test mesh, of a shuffled copy with some faces flipped, and of a nonmanifold mesh, vs. the original construction
+int connectivityTest(const LibShell::MeshConnectivity& mesh)
+{
+    Eigen::MatrixXi F = mesh.faces();
+    Eigen::MatrixXi shuffled = F;
+    std::vector<int> order(F.rows());
+    for (int i = 0; i < (int)order.size(); i++)
+        order[i] = i;
+    std::default_random_engine shuffleRng;
+    std::shuffle(order.begin(), order.end(), shuffleRng);
+    for (int i = 0; i < (int)order.size(); i++)
+    {
+        shuffled.row(i) = F.row(order[i]);
+        if (i % 3 == 0)
+            std::swap(shuffled(i, 0), shuffled(i, 1));
+    }
+    // three faces on edge (0, 1), two of them with the same orientation, and an isolated vertex
+    Eigen::MatrixXi nonmanifold(4, 3);
+    nonmanifold << 0, 1, 2,
+        1, 0, 3,
+        0, 1, 4,
+        2, 1, 6;
+
+    int mismatches = 0;
+    for (int nthreads : { 1, 3 })
+    {
+        mismatches += connectivityMismatches(F, nthreads);
+        mismatches += connectivityMismatches(shuffled, nthreads);
+        mismatches += connectivityMismatches(nonmanifold, nthreads);
+    }
+    return mismatches;
+}
+
+template<class SFF>
+double geometryCacheTest(const LibShell::MeshConnectivity& mesh, const Eigen::MatrixXd& restPos)
+{
+    Eigen::MatrixXd curPos = restPos;
+    curPos.setRandom();
+    Eigen::VectorXd edgeDOFs;
+    SFF::initializeExtraDOFs(edgeDOFs, mesh, curPos);
+    edgeDOFs.setRandom();
+
+    constexpr int ndofs = 18 + 3 * SFF::numExtraDOFs;
+    double diff = 0;
+    // caches without Hessians, or without any derivatives, must not be used for the derivatives they lack
+    for (int level = 0; level < 3; level++)
+    {
+        typename SFF::GeometryCache cache;
+        SFF::computeGeometryCache(mesh, curPos, level > 0, level > 1, cache);
+
+        for (int i = 0; i < mesh.nFaces(); i++)
+        {
+            Eigen::Matrix<double, 4, ndofs> deriv1, deriv2;
+            std::array<Eigen::Matrix<double, ndofs, ndofs>, 4> hess1, hess2;
+            Eigen::Matrix2d b1 = SFF::secondFundamentalForm(mesh, curPos, edgeDOFs, i, &deriv1, &hess1);
+            Eigen::Matrix2d b2 = SFF::secondFundamentalForm(mesh, curPos, edgeDOFs, i, &deriv2, &hess2, &cache);
+            // relative, since the cached normals of MidedgeAverage are computed from a different vertex ordering
+            diff = std::max(diff, (b1 - b2).norm() / std::max(1.0, b1.norm()));
+            diff = std::max(diff, (deriv1 - deriv2).norm() / std::max(1.0, deriv1.norm()));
+            for (int j = 0; j < 4; j++)
+                diff = std::max(diff, (hess1[j] - hess2[j]).norm() / std::max(1.0, hess1[j].norm()));
+        }
+    }
+    return diff;
+}
+
 void consistencyTests(const LibShell::MeshConnectivity &mesh, const Eigen::MatrixXd &restPos)
 {
     std::uniform_real_distribution<double> logThicknessDist(-6, 0);
@@ -499,6 +1596,211 @@ void consistencyTests(const LibShell::MeshConnectivity &mesh, const Eigen::Matri
             std::cout << "  - " << sffnames[j] << ": " << diff << std::endl;
         }
     }
+
+    // serial vs. multithreaded assembly
+    std::cout << "Multithreaded assembly consistency tests (1 vs 4 threads): " << std::endl;
+    for (int j = 0; j < numsff; j++)
+    {
+        double diff = 0;
+        switch (j)
+        {
+        case 0:
+            diff = threadingTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, 4);
+            break;
+        case 1:
+            diff = threadingTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, 4);
+            break;
+        case 2:
+            diff = threadingTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, 4);
+            break;
+        case 3:
+            diff = threadingTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, 4);
+            break;
+        default:
+            assert(false);
+        }
+        std::string sffnames[] = { "Tan", "Sin", "Avg", "Theta" };
+        std::cout << "  - " << sffnames[j] << ": " << diff << std::endl;
+    }
+
+    // in-place assembly through a HessianAssemblyPlan vs. triplets
+    for (int numThreads = 1; numThreads <= 4; numThreads += 3)
+    {
+        std::cout << "Hessian assembly plan consistency tests (" << numThreads << " threads): " << std::endl;
+        for (int j = 0; j < numsff; j++)
+        {
+            double diff = 0;
+            switch (j)
+            {
+            case 0:
+                diff = assemblyPlanTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, numThreads);
+                break;
+            case 1:
+                diff = assemblyPlanTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, numThreads);
+                break;
+            case 2:
+                diff = assemblyPlanTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, numThreads);
+                break;
+            case 3:
+                diff = assemblyPlanTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses, 1.0, 1.0, numThreads);
+                break;
+            default:
+                assert(false);
+            }
+            std::string sffnames[] = { "Tan", "Sin", "Avg", "Theta" };
+            std::cout << "  - " << sffnames[j] << ": " << diff << std::endl;
+        }
+    }
+
+    // PSD projection vs. eigendecomposition
+    std::cout << "PSD projection tests: " << std::endl;
+    std::cout << "  - 9x9: " << projectionTest<9>(LibShell::HessianProjectType::kMaxZero) << " (max zero), " << projectionTest<9>(LibShell::HessianProjectType::kAbs) << " (abs)" << std::endl;
+    std::cout << "  - 18x18: " << projectionTest<18>(LibShell::HessianProjectType::kMaxZero) << " (max zero), " << projectionTest<18>(LibShell::HessianProjectType::kAbs) << " (abs)" << std::endl;
+    std::cout << "  - 21x21: " << projectionTest<21>(LibShell::HessianProjectType::kMaxZero) << " (max zero), " << projectionTest<21>(LibShell::HessianProjectType::kAbs) << " (abs)" << std::endl;
+
+    // lower/upper triangle output vs. full Hessian
+    std::cout << "Symmetric Hessian storage consistency tests: " << std::endl;
+    for (int j = 0; j < numsff; j++)
+    {
+        double diff = 0;
+        switch (j)
+        {
+        case 0:
+            diff = symmetricStorageTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses, 1.0, 1.0);
+            break;
+        case 1:
+            diff = symmetricStorageTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses, 1.0, 1.0);
+            break;
+        case 2:
+            diff = symmetricStorageTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses, 1.0, 1.0);
+            break;
+        case 3:
+            diff = symmetricStorageTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses, 1.0, 1.0);
+            break;
+        default:
+            assert(false);
+        }
+        std::string sffnames[] = { "Tan", "Sin", "Avg", "Theta" };
+        std::cout << "  - " << sffnames[j] << ": " << diff << std::endl;
+    }
+
+    // editing the rest state after its derived data was cached
+    std::cout << "Rest state cache invalidation tests: " << std::endl;
+    std::cout << "  - Tan: " << restStateCacheTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses, 1.0, 1.0) << std::endl;
+    std::cout << "  - Avg: " << restStateCacheTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses, 1.0, 1.0) << std::endl;
+    std::cout << "Concurrent evaluation on a shared rest state tests: " << std::endl;
+    std::cout << "  - Tan: " << concurrentRestStateTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses, 1.0, 1.0) << std::endl;
+    std::cout << "  - Avg: " << concurrentRestStateTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses, 1.0, 1.0) << std::endl;
+
+    std::cout << "Per-face kernel heap allocation tests: " << std::endl;
+    {
+        long allocations[] = {
+            allocationTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses),
+            allocationTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses),
+            allocationTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses),
+            allocationTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) };
+        std::string sffnames[] = { "Tan", "Sin", "Avg", "Theta" };
+        for (int j = 0; j < 4; j++)
+        {
+            std::cout << "  - " << sffnames[j] << ": " << allocations[j] << std::endl;
+            if (allocations[j] != 0)
+            {
+                std::cout << "    FAILED: the per-face kernels allocated on the heap" << std::endl;
+                numFailures++;
+            }
+        }
+    }
+
+    std::cout << "Static material dispatch consistency tests: " << std::endl;
+    std::cout << "  - Tan: " << staticDispatchTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << staticDispatchTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << staticDispatchTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << staticDispatchTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Matrix-free Hessian-vector product tests: " << std::endl;
+    std::cout << "  - Tan: " << hessianVectorProductTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << hessianVectorProductTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << hessianVectorProductTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << hessianVectorProductTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Hessian diagonal block tests: " << std::endl;
+    std::cout << "  - Tan: " << diagonalBlocksTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << diagonalBlocksTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << diagonalBlocksTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << diagonalBlocksTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Incremental evaluation tests: " << std::endl;
+    std::cout << "  - Tan: " << incrementalTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << incrementalTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << incrementalTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << incrementalTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Face-colored assembly tests: " << std::endl;
+    std::cout << "  - Tan: " << coloredAssemblyTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << coloredAssemblyTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << coloredAssemblyTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << coloredAssemblyTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Block-sparse Hessian tests: " << std::endl;
+    std::cout << "  - Tan: " << blockSparseTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << blockSparseTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << blockSparseTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << blockSparseTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Hessian triplet count tests: " << std::endl;
+    std::cout << "  - Tan: " << tripletCountTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << tripletCountTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << tripletCountTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << tripletCountTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Assembly workspace reuse tests: " << std::endl;
+    std::cout << "  - Tan: " << workspaceTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << workspaceTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << workspaceTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << workspaceTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Fused stretching and bending assembly tests: " << std::endl;
+    std::cout << "  - Tan: " << fusedTermsTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << fusedTermsTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << fusedTermsTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << fusedTermsTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Energy-only evaluation tests: " << std::endl;
+    std::cout << "  - Tan: " << energyOnlyTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << energyOnlyTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << energyOnlyTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << energyOnlyTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Flat DOF vector consistency tests: " << std::endl;
+    std::cout << "  - Tan: " << flatDOFsTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << flatDOFsTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << flatDOFsTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << flatDOFsTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    std::cout << "Mesh connectivity construction tests: " << connectivityTest(mesh) << std::endl;
+
+    std::cout << "Mesh reordering tests: " << std::endl;
+    std::cout << "  - Tan: " << reorderingTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Sin: " << reorderingTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Avg: " << reorderingTest<LibShell::MidedgeAverageFormulation>(mesh, restPos, thicknesses) << std::endl;
+    std::cout << "  - Theta: " << reorderingTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos, thicknesses) << std::endl;
+
+    // second fundamental forms from precomputed per-edge geometry
+    std::cout << "Geometry cache consistency tests: " << std::endl;
+    std::cout << "  - Tan: " << geometryCacheTest<LibShell::MidedgeAngleTanFormulation>(mesh, restPos) << std::endl;
+    std::cout << "  - Sin: " << geometryCacheTest<LibShell::MidedgeAngleSinFormulation>(mesh, restPos) << std::endl;
+    std::cout << "  - Avg: " << geometryCacheTest<LibShell::MidedgeAverageFormulation>(mesh, restPos) << std::endl;
+    std::cout << "  - Theta: " << geometryCacheTest<LibShell::MidedgeAngleThetaFormulation>(mesh, restPos) << std::endl;
+
+    // analytically projected stretching Hessians
+    std::cout << "Strain-space stretching projection tests (stretched, assembled, min relative eigenvalue): " << std::endl;
+    Eigen::Vector3d stretch(1.1, 1.1, 1.0);
+    Eigen::Vector3d tensionField(1.1, 0.9, 1.0);
+    std::cout << "  - NeoHookean: " << strainSpaceProjectionTest<LibShell::NeoHookeanMaterial>(mesh, restPos, thicknesses, 1.0, 1.0, stretch).transpose() << std::endl;
+    std::cout << "  - StVK: " << strainSpaceProjectionTest<LibShell::StVKMaterial>(mesh, restPos, thicknesses, 1.0, 1.0, stretch).transpose() << std::endl;
+    std::cout << "  - TensionField: " << strainSpaceProjectionTest<LibShell::TensionFieldStVKMaterial>(mesh, restPos, thicknesses, 1.0, 1.0, stretch).transpose() << std::endl;
+    // compressed in y: the faces are in the tension field regime
+    std::cout << "  - TensionField (wrinkled): " << strainSpaceProjectionTest<LibShell::TensionFieldStVKMaterial>(mesh, restPos, thicknesses, 1.0, 1.0, tensionField).transpose() << std::endl;
 }
 
 
@@ -556,6 +1858,7 @@ int main()
         consistencyTests(mesh, V);
         std::cout << "Consistency tests done" << std::endl;
     }
+    return numFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 